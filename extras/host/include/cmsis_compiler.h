@@ -0,0 +1,15 @@
+/**
+  ******************************************************************************
+  * @file    cmsis_compiler.h
+  * @brief   Host stand-in for the CMSIS compiler header
+  *
+  * The timer server includes this header for the critical section
+  * intrinsics, which the host stand-in of stm32_def.h provides.
+  ******************************************************************************
+  */
+#ifndef __CMSIS_COMPILER_H__
+#define __CMSIS_COMPILER_H__
+
+#include "stm32_def.h"
+
+#endif /* __CMSIS_COMPILER_H__ */
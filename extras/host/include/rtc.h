@@ -0,0 +1,25 @@
+/**
+  ******************************************************************************
+  * @file    rtc.h
+  * @brief   Host stand-in for the STM32 RTC header
+  *
+  * The timer server passes an RTC handle to its driver. The host timer
+  * driver runs on a virtual clock and does not use it.
+  ******************************************************************************
+  */
+#ifndef __RTC_H__
+#define __RTC_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  void *Instance;
+} RTC_HandleTypeDef;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RTC_H__ */
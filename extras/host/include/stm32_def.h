@@ -0,0 +1,130 @@
+/**
+  ******************************************************************************
+  * @file    stm32_def.h
+  * @brief   Host stand-in for the STM32 core header
+  *
+  * Declares the few HAL and CMSIS names that the library headers use, so
+  * that hardware independent sources can be built on the development
+  * machine. Only types and prototypes are provided: a test that calls
+  * into the HAL must define the functions it needs.
+  ******************************************************************************
+  */
+#ifndef __STM32_DEF_H__
+#define __STM32_DEF_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define __weak __attribute__((weak))
+
+typedef enum {
+  HAL_OK = 0x00,
+  HAL_ERROR = 0x01,
+  HAL_BUSY = 0x02,
+  HAL_TIMEOUT = 0x03
+} HAL_StatusTypeDef;
+
+typedef struct {
+  uint32_t BaudratePrescaler;
+} SUBGHZ_InitTypeDef;
+
+typedef struct {
+  SUBGHZ_InitTypeDef Init;
+} SUBGHZ_HandleTypeDef;
+
+typedef enum {
+  HAL_SUBGHZ_CAD_CLEAR = 0x00,
+  HAL_SUBGHZ_CAD_DETECTED = 0x01
+} HAL_SUBGHZ_CadStatusTypeDef;
+
+typedef enum {
+  RADIO_SET_SLEEP = 0x84,
+  RADIO_SET_STANDBY = 0x80,
+  RADIO_SET_FS = 0xC1,
+  RADIO_SET_TX = 0x83,
+  RADIO_SET_RX = 0x82,
+  RADIO_SET_RXDUTYCYCLE = 0x94,
+  RADIO_SET_CAD = 0xC5,
+  RADIO_SET_TXCONTINUOUSWAVE = 0xD1,
+  RADIO_SET_TXCONTINUOUSPREAMBLE = 0xD2,
+  RADIO_SET_PACKETTYPE = 0x8A,
+  RADIO_SET_RFFREQUENCY = 0x86,
+  RADIO_SET_TXPARAMS = 0x8E,
+  RADIO_SET_PACONFIG = 0x95,
+  RADIO_SET_CADPARAMS = 0x88,
+  RADIO_SET_BUFFERBASEADDRESS = 0x8F,
+  RADIO_SET_MODULATIONPARAMS = 0x8B,
+  RADIO_SET_PACKETPARAMS = 0x8C,
+  RADIO_CFG_DIOIRQ = 0x08,
+  RADIO_CLR_IRQSTATUS = 0x02,
+  RADIO_CALIBRATE = 0x89,
+  RADIO_CALIBRATEIMAGE = 0x98,
+  RADIO_SET_REGULATORMODE = 0x96,
+  RADIO_SET_TCXOMODE = 0x97,
+  RADIO_SET_TXFALLBACKMODE = 0x93,
+  RADIO_SET_RFSWITCHMODE = 0x9D,
+  RADIO_SET_STOPRXTIMERONPREAMBLE = 0x9F,
+  RADIO_SET_LORASYMBTIMEOUT = 0xA0,
+  RADIO_CLR_ERROR = 0x07
+} SUBGHZ_RadioSetCmd_t;
+
+typedef enum {
+  RADIO_GET_STATUS = 0xC0,
+  RADIO_GET_PACKETTYPE = 0x11,
+  RADIO_GET_RXBUFFERSTATUS = 0x13,
+  RADIO_GET_PACKETSTATUS = 0x14,
+  RADIO_GET_RSSIINST = 0x15,
+  RADIO_GET_STATS = 0x10,
+  RADIO_RESET_STATS = 0x00,
+  RADIO_GET_IRQSTATUS = 0x12,
+  RADIO_GET_ERROR = 0x17
+} SUBGHZ_RadioGetCmd_t;
+
+HAL_StatusTypeDef HAL_SUBGHZ_Init(SUBGHZ_HandleTypeDef *hsubghz);
+HAL_StatusTypeDef HAL_SUBGHZ_ExecSetCmd(SUBGHZ_HandleTypeDef *hsubghz, SUBGHZ_RadioSetCmd_t Command,
+                                        uint8_t *pBuffer, uint16_t Size);
+HAL_StatusTypeDef HAL_SUBGHZ_ExecGetCmd(SUBGHZ_HandleTypeDef *hsubghz, SUBGHZ_RadioGetCmd_t Command,
+                                        uint8_t *pBuffer, uint16_t Size);
+HAL_StatusTypeDef HAL_SUBGHZ_WriteRegisters(SUBGHZ_HandleTypeDef *hsubghz, uint16_t Address, uint8_t *pBuffer,
+                                            uint16_t Size);
+HAL_StatusTypeDef HAL_SUBGHZ_ReadRegisters(SUBGHZ_HandleTypeDef *hsubghz, uint16_t Address, uint8_t *pBuffer,
+                                           uint16_t Size);
+HAL_StatusTypeDef HAL_SUBGHZ_WriteBuffer(SUBGHZ_HandleTypeDef *hsubghz, uint8_t Offset, uint8_t *pBuffer,
+                                         uint16_t Size);
+HAL_StatusTypeDef HAL_SUBGHZ_ReadBuffer(SUBGHZ_HandleTypeDef *hsubghz, uint8_t Offset, uint8_t *pBuffer,
+                                        uint16_t Size);
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+
+/* There are no interrupts on the host, critical sections are no-ops */
+static inline uint32_t __get_PRIMASK(void)
+{
+  return 0;
+}
+
+static inline void __set_PRIMASK(uint32_t priMask)
+{
+  (void)priMask;
+}
+
+static inline void __disable_irq(void)
+{
+}
+
+static inline void __enable_irq(void)
+{
+}
+
+static inline void __NOP(void)
+{
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STM32_DEF_H__ */
@@ -0,0 +1,261 @@
+/**
+  ******************************************************************************
+  * @file    lorawan_bench.c
+  * @brief   Benchmark of several simulated devices sharing one air interface
+  *
+  * The stack keeps its state in file-static variables, so one copy of it
+  * is one device. Each device is a private copy of sim_device.so, the
+  * stack, radio.c, and the simulated radio and timer driver, loaded with
+  * dlopen. All copies share the virtual clock, the air and the network
+  * server stand-in of this program, which they link against.
+  *
+  * The EU868 devices join, then send confirmed uplinks at DR5, every
+  * fourth one answered with application data. The program reports the
+  * frames sent and received by the stacks per second of CPU, and fails if
+  * a device did not join or did not finish its uplinks.
+  *
+  * Usage: lorawan_bench [devices] [uplinks] [seed]
+  ******************************************************************************
+  */
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "LoRaMacInterfaces.h"
+#include "sim_air.h"
+#include "sim_clock.h"
+#include "sim_device.h"
+#include "sim_ns.h"
+
+#define DEFAULT_DEVICES 16
+#define DEFAULT_UPLINKS 20
+#define DEVICE_LIBRARY "sim_device.so"
+/* The devices start within this time, us, rather than all joining at once */
+#define START_SPREAD 10000000
+
+typedef struct {
+  bool (*Init)(const SimDeviceConfig_t *config);
+  bool (*Process)(void);
+  void (*GetStats)(SimDeviceStats_t *stats);
+  SimEvent_t Start;
+  bool IsPending;
+  bool Done;
+} device_t;
+
+static const uint8_t AppKey[16] = {
+  0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C
+};
+
+static device_t *Devices;
+/* Devices notified since they last ran */
+static unsigned *PendingDevices;
+static unsigned PendingCount;
+
+static void Notify(void *context)
+{
+  unsigned index = (unsigned)(uintptr_t)context;
+
+  if (!Devices[index].IsPending) {
+    Devices[index].IsPending = true;
+    PendingDevices[PendingCount++] = index;
+  }
+}
+
+static uint32_t Random(uint32_t *state)
+{
+  /* xorshift32, so runs are reproducible from the seed */
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+static double CpuTime(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool CopyFile(const char *from, int to)
+{
+  char buffer[65536];
+  ssize_t size;
+  int fd = open(from, O_RDONLY);
+
+  if (fd < 0) {
+    return false;
+  }
+  while ((size = read(fd, buffer, sizeof(buffer))) > 0) {
+    if (write(to, buffer, size) != size) {
+      size = -1;
+      break;
+    }
+  }
+  close(fd);
+  return size == 0;
+}
+
+/*
+ * dlopen returns the library already loaded for a path it saw before, so
+ * each device loads a copy of the library under its own temporary name
+ */
+static bool LoadDevice(const char *library, device_t *device)
+{
+  const char *dir = getenv("TMPDIR");
+  char path[4096];
+  void *handle;
+  int fd;
+
+  snprintf(path, sizeof(path), "%s/sim_device_XXXXXX", dir != NULL ? dir : "/tmp");
+  fd = mkstemp(path);
+  if (fd < 0) {
+    perror("lorawan_bench: mkstemp");
+    return false;
+  }
+  if (!CopyFile(library, fd)) {
+    fprintf(stderr, "lorawan_bench: cannot copy %s\n", library);
+    close(fd);
+    unlink(path);
+    return false;
+  }
+  close(fd);
+  handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  unlink(path);
+  if (handle == NULL) {
+    fprintf(stderr, "lorawan_bench: %s\n", dlerror());
+    return false;
+  }
+  *(void **)&device->Init = dlsym(handle, "SimDeviceInit");
+  *(void **)&device->Process = dlsym(handle, "SimDeviceProcess");
+  *(void **)&device->GetStats = dlsym(handle, "SimDeviceGetStats");
+  return device->Init != NULL && device->Process != NULL && device->GetStats != NULL;
+}
+
+int main(int argc, char **argv)
+{
+  SimNsConfig_t ns = {
+    .NetId = 0x000013,
+    .Rssi = -80,
+    .Snr = 7,
+    .DownlinkPeriod = 4,
+  };
+  SimDeviceConfig_t config = {
+    .DevEui = { 0x00, 0x80, 0xE1, 0x15, 0x00, 0x00, 0x00, 0x00 },
+    .Region = LORAMAC_REGION_EU868,
+    .Datarate = DR_5,
+    .PayloadSize = 12,
+    .Confirmed = true,
+    .Notify = Notify,
+  };
+  char program[4096];
+  char library[4096];
+  unsigned count;
+  unsigned remaining;
+  uint32_t seed;
+  SimDeviceStats_t total = { 0 };
+  unsigned joined = 0;
+  uint64_t frames;
+  SimAirStats_t air;
+  SimNsStats_t nsStats;
+  double cpu;
+
+  count = argc > 1 ? (unsigned)strtoul(argv[1], NULL, 0) : DEFAULT_DEVICES;
+  config.Uplinks = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 0) : DEFAULT_UPLINKS;
+  seed = argc > 3 ? (uint32_t)strtoul(argv[3], NULL, 0) : 0x2545F491;
+  if (count == 0) {
+    count = 1;
+  }
+  if (seed == 0) {
+    seed = 1;
+  }
+  memcpy(ns.AppKey, AppKey, sizeof(AppKey));
+  memcpy(config.AppKey, AppKey, sizeof(AppKey));
+
+  /* The library is next to the program */
+  snprintf(program, sizeof(program), "%s", argv[0]);
+  snprintf(library, sizeof(library), "%s/" DEVICE_LIBRARY, dirname(program));
+  Devices = calloc(count, sizeof(*Devices));
+  PendingDevices = calloc(count, sizeof(*PendingDevices));
+  if (Devices == NULL || PendingDevices == NULL) {
+    fprintf(stderr, "lorawan_bench: out of memory\n");
+    return 2;
+  }
+  for (unsigned i = 0; i < count; i++) {
+    if (!LoadDevice(library, &Devices[i])) {
+      printf("lorawan_bench: cannot load device %u from %s\n", i, library);
+      return 1;
+    }
+  }
+
+  cpu = CpuTime();
+  SimNsInit(&ns);
+  for (unsigned i = 0; i < count; i++) {
+    config.DevEui[6] = (uint8_t)(i >> 8);
+    config.DevEui[7] = (uint8_t)i;
+    config.Seed = Random(&seed);
+    config.NotifyContext = (void *)(uintptr_t)i;
+    if (!Devices[i].Init(&config)) {
+      printf("lorawan_bench: the stack of device %u did not start\n", i);
+      return 1;
+    }
+  }
+  /* Each device runs once when it starts, then after each Notify */
+  for (unsigned i = 0; i < count; i++) {
+    Devices[i].Start.Callback = Notify;
+    Devices[i].Start.Context = (void *)(uintptr_t)i;
+    SimClockStart(&Devices[i].Start, Random(&seed) % START_SPREAD);
+  }
+  remaining = count;
+  while (remaining > 0 && SimClockRunNext()) {
+    while (PendingCount > 0) {
+      device_t *device = &Devices[PendingDevices[--PendingCount]];
+      bool done;
+
+      device->IsPending = false;
+      done = device->Process();
+      if (done && !device->Done) {
+        device->Done = true;
+        remaining--;
+      }
+    }
+  }
+  cpu = CpuTime() - cpu;
+
+  for (unsigned i = 0; i < count; i++) {
+    SimDeviceStats_t stats;
+
+    Devices[i].GetStats(&stats);
+    joined += stats.Joined;
+    total.JoinAttempts += stats.JoinAttempts;
+    total.UplinksDone += stats.UplinksDone;
+    total.UplinksAcked += stats.UplinksAcked;
+    total.DownlinksReceived += stats.DownlinksReceived;
+    total.Radio.TxFrames += stats.Radio.TxFrames;
+    total.Radio.RxFrames += stats.Radio.RxFrames;
+    total.Radio.RxTimeouts += stats.Radio.RxTimeouts;
+  }
+  SimAirGetStats(&air);
+  SimNsGetStats(&nsStats);
+  frames = (uint64_t)total.Radio.TxFrames + total.Radio.RxFrames;
+  printf("lorawan_bench: %u devices joined after %u attempts, %u of %u uplinks acknowledged, "
+         "%u downlinks with data\n", joined, (unsigned)total.JoinAttempts, (unsigned)total.UplinksAcked,
+         (unsigned)(count * config.Uplinks), (unsigned)total.DownlinksReceived);
+  printf("lorawan_bench: %u frames sent, %u received, %u uplinks lost in collisions, %u receive windows missed\n",
+         (unsigned)total.Radio.TxFrames, (unsigned)total.Radio.RxFrames, (unsigned)air.Collisions,
+         (unsigned)total.Radio.RxTimeouts);
+  printf("lorawan_bench: %.1f s of virtual time, %.3f s of CPU, %.0f frames per second of CPU\n",
+         SimClockGetTime() * 1e-6, cpu, cpu > 0 ? frames / cpu : 0.0);
+
+  if (remaining > 0 || joined != count || total.UplinksDone != count * config.Uplinks || nsStats.MicErrors != 0) {
+    printf("lorawan_bench: FAILED (%u devices not done, %u MIC errors)\n", remaining, (unsigned)nsStats.MicErrors);
+    return 1;
+  }
+  printf("lorawan_bench: passed\n");
+  return 0;
+}
@@ -0,0 +1,540 @@
+/**
+  ******************************************************************************
+  * @file    radio_driver_sim.c
+  * @brief   Simulated SUBGHZ radio, in place of radio_driver.c
+  *
+  * Implements the SUBGRF_* functions that radio.c uses. Commands change
+  * the operating mode and the parameters kept here, and the interrupts
+  * radio.c expects are raised through the handler given to SUBGRF_Init,
+  * at their time on the virtual clock:
+  * - SendPayload puts an uplink on air for the time on air computed by
+  *   radio.c for the current parameters, then raises IRQ_TX_DONE.
+  * - SetRx receives a downlink on the same frequency, modulation and IQ
+  *   polarity when it hears SIM_RADIO_DETECT_SYMBOLS of its preamble
+  *   before the symbol timeout or the Rx timeout. It then raises
+  *   IRQ_RX_DONE at the end of the frame, else IRQ_RX_TX_TIMEOUT.
+  * - SetRxDutyCycle listens continuously, the sleep periods are not
+  *   modelled.
+  * Registers are plain memory. Channel activity detection always finds
+  * the channel clear and the instantaneous RSSI is the noise floor.
+  ******************************************************************************
+  */
+#include <string.h>
+#include "radio.h"
+#include "radio_driver.h"
+#include "sim_air.h"
+#include "sim_clock.h"
+#include "sim_radio.h"
+
+/* Preamble symbols a LoRa receiver needs to detect a frame, preamble bytes for FSK */
+#define SIM_RADIO_DETECT_SYMBOLS 4
+#define SIM_RADIO_NOISE_FLOOR (-120)
+#define SIM_RADIO_REGISTERS_SIZE 0x1000
+/* SetRx and SetTx timeouts are in steps of 15.625 us */
+#define SIM_RADIO_TIMEOUT_STEP_NS 15625
+#define SIM_RADIO_RX_CONTINUOUS 0xFFFFFF
+
+static struct {
+  DioIrqHandler DioIrq;
+  RadioOperatingModes_t Mode;
+  uint16_t IrqMask;
+  RadioPacketTypes_t PacketType;
+  ModulationParams_t ModulationParams;
+  PacketParams_t PacketParams;
+  uint32_t Frequency;
+  uint8_t SymbTimeout;
+  int8_t TxPower;
+
+  SimEvent_t IrqEvent;
+  RadioIrqMasks_t PendingIrq;
+  SimListener_t Listener;
+  uint64_t ModeStart;       /*!< Start of the current Tx or Rx */
+  uint64_t RxStart;         /*!< Start of the reception, once the radio woke up */
+  uint64_t RxDeadline;      /*!< Latest preamble detection, 0 for none */
+  bool RxContinuous;
+  bool RxLocked;
+  SimFrame_t RxFrame;
+
+  uint8_t Registers[SIM_RADIO_REGISTERS_SIZE];
+  uint32_t RandomState;
+  SimRadioStats_t Stats;
+} Sim = {
+  .RandomState = 1,
+};
+
+static void SetMode(RadioOperatingModes_t mode)
+{
+  uint64_t now = SimClockGetTime();
+
+  if (Sim.Mode == MODE_TX) {
+    Sim.Stats.TxTime += now - Sim.ModeStart;
+  } else if (Sim.Mode == MODE_RX || Sim.Mode == MODE_RX_DC) {
+    Sim.Stats.RxTime += now - Sim.ModeStart;
+  }
+  if (mode != MODE_RX && mode != MODE_RX_DC) {
+    SimAirUnlisten(&Sim.Listener);
+  }
+  SimClockStop(&Sim.IrqEvent);
+  Sim.Mode = mode;
+  Sim.ModeStart = now;
+  Sim.RxLocked = false;
+}
+
+static void RaiseIrq(RadioIrqMasks_t irq, uint64_t time)
+{
+  Sim.PendingIrq = irq;
+  SimClockStart(&Sim.IrqEvent, time);
+}
+
+/* LoRaWAN only uses these three bandwidths, radio.c numbers them from LORA_BW_125 */
+static uint32_t LoRaBandwidthInHz(RadioLoRaBandwidths_t bw)
+{
+  switch (bw) {
+    case LORA_BW_250:
+      return 250000;
+    case LORA_BW_500:
+      return 500000;
+    default:
+      return 125000;
+  }
+}
+
+/* Time on air of a frame with the current parameters, as computed by radio.c */
+static uint64_t TimeOnAir(uint8_t size)
+{
+  uint32_t ms;
+
+  if (Sim.PacketType == PACKET_TYPE_LORA) {
+    ms = Radio.TimeOnAir(MODEM_LORA, Sim.ModulationParams.Params.LoRa.Bandwidth - LORA_BW_125,
+                         Sim.ModulationParams.Params.LoRa.SpreadingFactor,
+                         Sim.ModulationParams.Params.LoRa.CodingRate,
+                         Sim.PacketParams.Params.LoRa.PreambleLength,
+                         Sim.PacketParams.Params.LoRa.HeaderType == LORA_PACKET_FIXED_LENGTH, size,
+                         Sim.PacketParams.Params.LoRa.CrcMode == LORA_CRC_ON);
+  } else if (Sim.PacketType == PACKET_TYPE_BPSK) {
+    /* Radio.TimeOnAir has no BPSK: the frame is the payload only */
+    return (uint64_t)size * 8 * 1000000 / Sim.ModulationParams.Params.Bpsk.BitRate;
+  } else {
+    ms = Radio.TimeOnAir(MODEM_FSK, 0, Sim.ModulationParams.Params.Gfsk.BitRate, 0,
+                         Sim.PacketParams.Params.Gfsk.PreambleLength >> 3,
+                         Sim.PacketParams.Params.Gfsk.HeaderType == RADIO_PACKET_FIXED_LENGTH, size,
+                         Sim.PacketParams.Params.Gfsk.CrcLength != RADIO_CRC_OFF);
+  }
+  return (uint64_t)ms * 1000;
+}
+
+static void FillFrameParams(SimFrame_t *frame)
+{
+  frame->Frequency = Sim.Frequency;
+  if (Sim.PacketType == PACKET_TYPE_LORA) {
+    frame->Modem = SIM_MODEM_LORA;
+    frame->SpreadingFactor = Sim.ModulationParams.Params.LoRa.SpreadingFactor;
+    frame->Bandwidth = LoRaBandwidthInHz(Sim.ModulationParams.Params.LoRa.Bandwidth);
+    frame->PreambleLength = Sim.PacketParams.Params.LoRa.PreambleLength;
+    frame->IqInverted = Sim.PacketParams.Params.LoRa.InvertIQ == LORA_IQ_INVERTED;
+  } else if (Sim.PacketType == PACKET_TYPE_BPSK) {
+    /* Sent as an FSK frame without preamble, the air only needs its bit rate */
+    frame->Modem = SIM_MODEM_FSK;
+    frame->BitRate = Sim.ModulationParams.Params.Bpsk.BitRate;
+    frame->PreambleLength = 0;
+    frame->IqInverted = false;
+  } else {
+    frame->Modem = SIM_MODEM_FSK;
+    frame->BitRate = Sim.ModulationParams.Params.Gfsk.BitRate;
+    frame->PreambleLength = Sim.PacketParams.Params.Gfsk.PreambleLength >> 3;
+    frame->IqInverted = false;
+  }
+}
+
+static bool SameModulation(const SimFrame_t *a, const SimFrame_t *b)
+{
+  if (a->Frequency != b->Frequency || a->Modem != b->Modem) {
+    return false;
+  }
+  if (a->Modem == SIM_MODEM_LORA) {
+    return a->SpreadingFactor == b->SpreadingFactor && a->Bandwidth == b->Bandwidth &&
+           a->IqInverted == b->IqInverted;
+  }
+  return a->BitRate == b->BitRate;
+}
+
+static void OnDownlink(void *context, const SimFrame_t *frame)
+{
+  SimFrame_t rx = { 0 };
+  uint64_t detect;
+
+  (void)context;
+  if ((Sim.Mode != MODE_RX && Sim.Mode != MODE_RX_DC) || Sim.RxLocked) {
+    return;
+  }
+  FillFrameParams(&rx);
+  if (!SameModulation(&rx, frame)) {
+    return;
+  }
+  detect = SimAirGetPreambleTime(frame) * SIM_RADIO_DETECT_SYMBOLS / frame->PreambleLength;
+  detect += frame->Start > Sim.RxStart ? frame->Start : Sim.RxStart;
+  if (detect > frame->Start + SimAirGetPreambleTime(frame) || (Sim.RxDeadline != 0 && detect > Sim.RxDeadline)) {
+    return;
+  }
+
+  Sim.RxLocked = true;
+  Sim.RxFrame = *frame;
+  RaiseIrq(IRQ_RX_DONE, frame->Start + TimeOnAir(frame->Size));
+}
+
+static void OnIrqEvent(void *context)
+{
+  RadioIrqMasks_t irq = Sim.PendingIrq;
+
+  (void)context;
+  switch (irq) {
+    case IRQ_TX_DONE:
+      Sim.Stats.TxFrames++;
+      SetMode(MODE_STDBY_RC);
+      break;
+    case IRQ_RX_DONE:
+      Sim.Stats.RxFrames++;
+      if (Sim.RxContinuous) {
+        /* Keeps listening */
+        Sim.Stats.RxTime += SimClockGetTime() - Sim.ModeStart;
+        Sim.ModeStart = SimClockGetTime();
+        Sim.RxStart = Sim.ModeStart;
+        Sim.RxLocked = false;
+      } else {
+        SetMode(MODE_STDBY_RC);
+      }
+      break;
+    case IRQ_RX_TX_TIMEOUT:
+      if (Sim.Mode != MODE_TX) {
+        Sim.Stats.RxTimeouts++;
+      }
+      /* radio.c checks the mode the timeout happened in, then sets standby */
+      break;
+    default:
+      SetMode(MODE_STDBY_RC);
+      break;
+  }
+  if ((Sim.IrqMask & irq) != 0 && Sim.DioIrq != NULL) {
+    Sim.DioIrq(irq);
+  }
+  if (Sim.Listener.IsListening && !Sim.RxLocked && (Sim.Mode == MODE_RX || Sim.Mode == MODE_RX_DC)) {
+    /* A continuous receiver can take the next downlink already on air */
+    SimAirListen(&Sim.Listener);
+  }
+}
+
+static void StartRx(RadioOperatingModes_t mode, uint32_t timeout)
+{
+  uint64_t now = SimClockGetTime();
+  uint64_t deadline = 0;
+
+  /* The stack opens the windows the wakeup time early, the radio receives once awake */
+  if (Sim.Mode != MODE_RX && Sim.Mode != MODE_RX_DC) {
+    now += (uint64_t)Radio.GetWakeupTime() * 1000;
+  }
+  SetMode(mode);
+  Sim.RxStart = now;
+  Sim.RxContinuous = mode == MODE_RX_DC || timeout == SIM_RADIO_RX_CONTINUOUS;
+  if (!Sim.RxContinuous) {
+    if (timeout != 0) {
+      deadline = now + (uint64_t)timeout * SIM_RADIO_TIMEOUT_STEP_NS / 1000;
+    }
+    if (Sim.PacketType == PACKET_TYPE_LORA && Sim.SymbTimeout != 0) {
+      uint64_t symbols = ((uint64_t)Sim.SymbTimeout << Sim.ModulationParams.Params.LoRa.SpreadingFactor) * 1000000 /
+                         LoRaBandwidthInHz(Sim.ModulationParams.Params.LoRa.Bandwidth);
+
+      if (deadline == 0 || now + symbols < deadline) {
+        deadline = now + symbols;
+      }
+    }
+  }
+  Sim.RxDeadline = deadline;
+  if (deadline != 0) {
+    Sim.Stats.RxWindow = deadline - now;
+    RaiseIrq(IRQ_RX_TX_TIMEOUT, deadline);
+  }
+  Sim.Listener.OnDownlink = OnDownlink;
+  SimAirListen(&Sim.Listener);
+}
+
+void SimRadioSetSeed(uint32_t seed)
+{
+  Sim.RandomState = seed != 0 ? seed : 1;
+}
+
+void SimRadioGetStats(SimRadioStats_t *stats)
+{
+  *stats = Sim.Stats;
+}
+
+void SUBGRF_Init(DioIrqHandler dioIrq)
+{
+  Sim.DioIrq = dioIrq;
+  Sim.IrqEvent.Callback = OnIrqEvent;
+  SetMode(MODE_STDBY_RC);
+}
+
+RadioOperatingModes_t SUBGRF_GetOperatingMode(void)
+{
+  return Sim.Mode;
+}
+
+uint8_t SUBGRF_GetPayload(uint8_t *payload, uint8_t *size, uint8_t maxSize)
+{
+  if (Sim.RxFrame.Size > maxSize) {
+    return 1;
+  }
+  *size = Sim.RxFrame.Size;
+  memcpy(payload, Sim.RxFrame.Payload, *size);
+  return 0;
+}
+
+void SUBGRF_SendPayload(uint8_t *payload, uint8_t size, uint32_t timeout)
+{
+  SimFrame_t frame = { 0 };
+
+  (void)timeout;
+  SetMode(MODE_TX);
+  FillFrameParams(&frame);
+  frame.Start = SimClockGetTime();
+  frame.End = frame.Start + TimeOnAir(size);
+  frame.Size = size;
+  memcpy(frame.Payload, payload, size);
+  SimAirSendUplink(&frame);
+  RaiseIrq(IRQ_TX_DONE, frame.End);
+}
+
+uint8_t SUBGRF_SetSyncWord(uint8_t *syncWord)
+{
+  (void)syncWord;
+  return 0;
+}
+
+void SUBGRF_SetCrcSeed(uint16_t seed)
+{
+  (void)seed;
+}
+
+void SUBGRF_SetCrcPolynomial(uint16_t polynomial)
+{
+  (void)polynomial;
+}
+
+void SUBGRF_SetWhiteningSeed(uint16_t seed)
+{
+  (void)seed;
+}
+
+uint32_t SUBGRF_GetRandom(void)
+{
+  /* xorshift32, so runs are reproducible from the seed */
+  Sim.RandomState ^= Sim.RandomState << 13;
+  Sim.RandomState ^= Sim.RandomState >> 17;
+  Sim.RandomState ^= Sim.RandomState << 5;
+  return Sim.RandomState;
+}
+
+void SUBGRF_SetSleep(SleepParams_t sleepConfig)
+{
+  (void)sleepConfig;
+  SetMode(MODE_SLEEP);
+}
+
+void SUBGRF_SetStandby(RadioStandbyModes_t mode)
+{
+  SetMode(mode == STDBY_RC ? MODE_STDBY_RC : MODE_STDBY_XOSC);
+}
+
+void SUBGRF_SetTx(uint32_t timeout)
+{
+  SetMode(MODE_TX);
+  if (timeout != 0) {
+    RaiseIrq(IRQ_RX_TX_TIMEOUT, SimClockGetTime() + (uint64_t)timeout * SIM_RADIO_TIMEOUT_STEP_NS / 1000);
+  }
+}
+
+void SUBGRF_SetRx(uint32_t timeout)
+{
+  StartRx(MODE_RX, timeout);
+}
+
+void SUBGRF_SetRxBoosted(uint32_t timeout)
+{
+  StartRx(MODE_RX, timeout);
+}
+
+void SUBGRF_SetRxDutyCycle(uint32_t rxTime, uint32_t sleepTime)
+{
+  (void)rxTime;
+  (void)sleepTime;
+  StartRx(MODE_RX_DC, 0);
+}
+
+void SUBGRF_SetCad(void)
+{
+  uint32_t bw = LoRaBandwidthInHz(Sim.ModulationParams.Params.LoRa.Bandwidth);
+
+  SetMode(MODE_CAD);
+  RaiseIrq(IRQ_CAD_CLEAR,
+           SimClockGetTime() + ((uint64_t)2 << Sim.ModulationParams.Params.LoRa.SpreadingFactor) * 1000000 / bw);
+}
+
+void SUBGRF_SetTxContinuousWave(void)
+{
+  SetMode(MODE_TX);
+}
+
+void SUBGRF_SetTxInfinitePreamble(void)
+{
+  SetMode(MODE_TX);
+}
+
+void SUBGRF_SetStopRxTimerOnPreambleDetect(bool enable)
+{
+  (void)enable;
+}
+
+void SUBGRF_SetLoRaSymbNumTimeout(uint8_t symbNum)
+{
+  Sim.SymbTimeout = symbNum;
+}
+
+void SUBGRF_SetRegulatorMode(void)
+{
+}
+
+void SUBGRF_WriteRegisters(uint16_t address, uint8_t *buffer, uint16_t size)
+{
+  for (uint16_t i = 0; i < size && address + i < SIM_RADIO_REGISTERS_SIZE; i++) {
+    Sim.Registers[address + i] = buffer[i];
+  }
+}
+
+void SUBGRF_ReadRegisters(uint16_t address, uint8_t *buffer, uint16_t size)
+{
+  for (uint16_t i = 0; i < size; i++) {
+    buffer[i] = address + i < SIM_RADIO_REGISTERS_SIZE ? Sim.Registers[address + i] : 0;
+  }
+}
+
+void SUBGRF_WriteRegister(uint16_t address, uint8_t data)
+{
+  SUBGRF_WriteRegisters(address, &data, 1);
+}
+
+uint8_t SUBGRF_ReadRegister(uint16_t address)
+{
+  uint8_t data;
+
+  SUBGRF_ReadRegisters(address, &data, 1);
+  return data;
+}
+
+void SUBGRF_WriteBuffer(uint8_t offset, uint8_t *buffer, uint8_t size)
+{
+  (void)offset;
+  (void)buffer;
+  (void)size;
+}
+
+void SUBGRF_WriteCommand(SUBGHZ_RadioSetCmd_t Command, uint8_t *pBuffer, uint16_t Size)
+{
+  (void)Command;
+  (void)pBuffer;
+  (void)Size;
+}
+
+void SUBGRF_SetDioIrqParams(uint16_t irqMask, uint16_t dio1Mask, uint16_t dio2Mask, uint16_t dio3Mask)
+{
+  (void)dio1Mask;
+  (void)dio2Mask;
+  (void)dio3Mask;
+  Sim.IrqMask = irqMask;
+}
+
+void SUBGRF_SetRfFrequency(uint32_t frequency)
+{
+  Sim.Frequency = frequency;
+}
+
+void SUBGRF_SetPacketType(RadioPacketTypes_t packetType)
+{
+  Sim.PacketType = packetType;
+}
+
+void SUBGRF_SetTxParams(uint8_t paSelect, int8_t power, RadioRampTimes_t rampTime)
+{
+  (void)paSelect;
+  (void)rampTime;
+  Sim.TxPower = power;
+}
+
+void SUBGRF_SetModulationParams(ModulationParams_t *modParams)
+{
+  Sim.ModulationParams = *modParams;
+}
+
+void SUBGRF_SetPacketParams(PacketParams_t *packetParams)
+{
+  Sim.PacketParams = *packetParams;
+}
+
+void SUBGRF_SetBufferBaseAddress(uint8_t txBaseAddress, uint8_t rxBaseAddress)
+{
+  (void)txBaseAddress;
+  (void)rxBaseAddress;
+}
+
+int8_t SUBGRF_GetRssiInst(void)
+{
+  return SIM_RADIO_NOISE_FLOOR;
+}
+
+void SUBGRF_GetPacketStatus(PacketStatus_t *pktStatus)
+{
+  memset(pktStatus, 0, sizeof(*pktStatus));
+  pktStatus->packetType = Sim.PacketType;
+  if (Sim.PacketType == PACKET_TYPE_LORA) {
+    pktStatus->Params.LoRa.RssiPkt = (int8_t)Sim.RxFrame.Rssi;
+    pktStatus->Params.LoRa.SnrPkt = Sim.RxFrame.Snr;
+    pktStatus->Params.LoRa.SignalRssiPkt = (int8_t)Sim.RxFrame.Rssi;
+  } else {
+    pktStatus->Params.Gfsk.RssiAvg = (int8_t)Sim.RxFrame.Rssi;
+    pktStatus->Params.Gfsk.RssiSync = (int8_t)Sim.RxFrame.Rssi;
+  }
+}
+
+void SUBGRF_SetSwitch(uint8_t paSelect, RFState_t rxtx)
+{
+  (void)paSelect;
+  (void)rxtx;
+}
+
+uint8_t SUBGRF_SetRfTxPower(int8_t power)
+{
+  SUBGRF_SetTxParams(RFO_LP, power, RADIO_RAMP_40_US);
+  return RFO_LP;
+}
+
+uint32_t SUBGRF_GetRadioWakeUpTime(void)
+{
+  return RF_WAKEUP_TIME;
+}
+
+uint8_t SUBGRF_GetFskBandwidthRegValue(uint32_t bandwidth)
+{
+  (void)bandwidth;
+  return 0;
+}
+
+void SUBGRF_GetCFO(uint32_t bitrate, int32_t *cfo)
+{
+  (void)bitrate;
+  *cfo = 0;
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+  /* Only radio.c waits, for the radio to settle: nothing to wait for */
+  (void)Delay;
+}
@@ -0,0 +1,175 @@
+/**
+  ******************************************************************************
+  * @file    sim_air.c
+  * @brief   Simulated air interface shared by the devices of a host simulation
+  ******************************************************************************
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include "sim_air.h"
+#include "sim_clock.h"
+
+typedef struct SimAirSlot_s {
+  SimFrame_t Frame;
+  SimEvent_t Event;         /*!< Delivery of an uplink, end of the preamble of a downlink */
+  bool IsDownlink;
+  bool Collided;
+  struct SimAirSlot_s *Next;
+} SimAirSlot_t;
+
+static SimAirSlot_t Slots[SIM_AIR_MAX_FRAMES];
+static SimAirSlot_t *FreeSlots;
+static SimAirSlot_t *ActiveSlots;
+static bool SlotsInitialized;
+
+static SimListener_t *Listeners;
+static void (*Gateway)(void *context, const SimFrame_t *frame);
+static void *GatewayContext;
+static SimAirStats_t Stats;
+
+static SimAirSlot_t *AllocSlot(void)
+{
+  SimAirSlot_t *slot;
+
+  if (!SlotsInitialized) {
+    for (unsigned i = 0; i < SIM_AIR_MAX_FRAMES; i++) {
+      Slots[i].Next = FreeSlots;
+      FreeSlots = &Slots[i];
+    }
+    SlotsInitialized = true;
+  }
+  slot = FreeSlots;
+  if (slot == NULL) {
+    fprintf(stderr, "sim_air: more than %u frames in flight\n", SIM_AIR_MAX_FRAMES);
+    exit(2);
+  }
+  FreeSlots = slot->Next;
+  slot->Next = ActiveSlots;
+  ActiveSlots = slot;
+  slot->Collided = false;
+  return slot;
+}
+
+static void FreeSlot(SimAirSlot_t *slot)
+{
+  SimAirSlot_t **prev = &ActiveSlots;
+
+  while (*prev != slot) {
+    prev = &(*prev)->Next;
+  }
+  *prev = slot->Next;
+  slot->Next = FreeSlots;
+  FreeSlots = slot;
+}
+
+static bool SameChannel(const SimFrame_t *a, const SimFrame_t *b)
+{
+  if (a->Frequency != b->Frequency || a->Modem != b->Modem) {
+    return false;
+  }
+  if (a->Modem == SIM_MODEM_LORA) {
+    /* Different spreading factors are close to orthogonal */
+    return a->SpreadingFactor == b->SpreadingFactor && a->Bandwidth == b->Bandwidth;
+  }
+  return a->BitRate == b->BitRate;
+}
+
+static void OnUplinkEnd(void *context)
+{
+  SimAirSlot_t *slot = context;
+
+  if (slot->Collided) {
+    Stats.Collisions++;
+  } else if (Gateway != NULL) {
+    Gateway(GatewayContext, &slot->Frame);
+  }
+  FreeSlot(slot);
+}
+
+static void OnDownlinkPreambleEnd(void *context)
+{
+  /* No receiver can lock on the downlink any more, the ones that did have a copy */
+  FreeSlot(context);
+}
+
+void SimAirSetGateway(void (*onUplink)(void *context, const SimFrame_t *frame), void *context)
+{
+  Gateway = onUplink;
+  GatewayContext = context;
+}
+
+void SimAirSendUplink(const SimFrame_t *frame)
+{
+  SimAirSlot_t *slot = AllocSlot();
+
+  slot->Frame = *frame;
+  slot->IsDownlink = false;
+  for (SimAirSlot_t *other = slot->Next; other != NULL; other = other->Next) {
+    if (!other->IsDownlink && other->Frame.Start < frame->End && frame->Start < other->Frame.End &&
+        SameChannel(&other->Frame, frame)) {
+      other->Collided = true;
+      slot->Collided = true;
+    }
+  }
+  slot->Event.Callback = OnUplinkEnd;
+  slot->Event.Context = slot;
+  SimClockStart(&slot->Event, frame->End);
+  Stats.Uplinks++;
+}
+
+void SimAirSendDownlink(const SimFrame_t *frame)
+{
+  SimAirSlot_t *slot = AllocSlot();
+
+  slot->Frame = *frame;
+  slot->IsDownlink = true;
+  slot->Event.Callback = OnDownlinkPreambleEnd;
+  slot->Event.Context = slot;
+  SimClockStart(&slot->Event, frame->Start + SimAirGetPreambleTime(frame));
+  Stats.Downlinks++;
+
+  for (SimListener_t *l = Listeners; l != NULL; l = l->Next) {
+    l->OnDownlink(l->Context, &slot->Frame);
+  }
+}
+
+void SimAirListen(SimListener_t *listener)
+{
+  if (!listener->IsListening) {
+    listener->Next = Listeners;
+    Listeners = listener;
+    listener->IsListening = true;
+  }
+  for (SimAirSlot_t *slot = ActiveSlots; slot != NULL; slot = slot->Next) {
+    if (slot->IsDownlink) {
+      listener->OnDownlink(listener->Context, &slot->Frame);
+    }
+  }
+}
+
+void SimAirUnlisten(SimListener_t *listener)
+{
+  SimListener_t **prev = &Listeners;
+
+  if (!listener->IsListening) {
+    return;
+  }
+  while (*prev != listener) {
+    prev = &(*prev)->Next;
+  }
+  *prev = listener->Next;
+  listener->IsListening = false;
+}
+
+uint64_t SimAirGetPreambleTime(const SimFrame_t *frame)
+{
+  if (frame->Modem == SIM_MODEM_LORA) {
+    return ((uint64_t)frame->PreambleLength << frame->SpreadingFactor) * 1000000 / frame->Bandwidth;
+  }
+  return (uint64_t)frame->PreambleLength * 8 * 1000000 / frame->BitRate;
+}
+
+void SimAirGetStats(SimAirStats_t *stats)
+{
+  *stats = Stats;
+}
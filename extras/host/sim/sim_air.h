@@ -0,0 +1,98 @@
+/**
+  ******************************************************************************
+  * @file    sim_air.h
+  * @brief   Simulated air interface shared by the devices of a host simulation
+  *
+  * Devices send uplinks, which reach the gateway, that is the network
+  * server stand-in, when their last symbol is on air. Two uplinks that
+  * overlap in time on the same frequency with the same modulation collide
+  * and are both lost. The gateway sends downlinks, which every listening
+  * device radio gets to see: the radio decides if it can receive them.
+  ******************************************************************************
+  */
+#ifndef __SIM_AIR_H__
+#define __SIM_AIR_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+  * @brief Frames in flight at the same time, uplinks and downlinks together
+  */
+#define SIM_AIR_MAX_FRAMES 1024
+
+typedef enum {
+  SIM_MODEM_LORA,
+  SIM_MODEM_FSK,
+} SimModem_t;
+
+typedef struct {
+  uint64_t Start;           /*!< Start of the preamble, in us of virtual time */
+  uint64_t End;             /*!< End of an uplink, in us. The receiver of a downlink computes it. */
+  uint32_t Frequency;       /*!< Hz */
+  SimModem_t Modem;
+  uint8_t SpreadingFactor;  /*!< LoRa only */
+  uint32_t Bandwidth;       /*!< LoRa only, Hz */
+  uint32_t BitRate;         /*!< FSK only, bit/s */
+  uint16_t PreambleLength;  /*!< Symbols for LoRa, bytes for FSK */
+  bool IqInverted;          /*!< LoRa only, set for downlinks */
+  int16_t Rssi;             /*!< Signal strength at the receiver, dBm */
+  int8_t Snr;               /*!< dB */
+  uint8_t Size;
+  uint8_t Payload[255];
+} SimFrame_t;
+
+typedef struct SimListener_s {
+  void (*OnDownlink)(void *context, const SimFrame_t *frame);  /*!< A downlink the radio may receive */
+  void *Context;
+  bool IsListening;
+  struct SimListener_s *Next;
+} SimListener_t;
+
+typedef struct {
+  uint32_t Uplinks;       /*!< Uplinks sent */
+  uint32_t Collisions;    /*!< Uplinks lost in a collision */
+  uint32_t Downlinks;     /*!< Downlinks sent */
+} SimAirStats_t;
+
+/**
+  * @brief Sets the receiver of the uplinks
+  */
+void SimAirSetGateway(void (*onUplink)(void *context, const SimFrame_t *frame), void *context);
+
+/**
+  * @brief Sends an uplink, with its Start and End times set
+  */
+void SimAirSendUplink(const SimFrame_t *frame);
+
+/**
+  * @brief Sends a downlink from the gateway, Start may be in the future
+  */
+void SimAirSendDownlink(const SimFrame_t *frame);
+
+/**
+  * @brief Shows downlinks to a radio, until SimAirUnlisten
+  *
+  * The radio is shown at once the downlinks of which a receiver starting
+  * now could still hear the preamble, then each downlink as it is sent.
+  */
+void SimAirListen(SimListener_t *listener);
+
+void SimAirUnlisten(SimListener_t *listener);
+
+/**
+  * @brief Returns the length of the preamble of a frame, in us
+  */
+uint64_t SimAirGetPreambleTime(const SimFrame_t *frame);
+
+void SimAirGetStats(SimAirStats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SIM_AIR_H__ */
@@ -0,0 +1,60 @@
+/**
+  ******************************************************************************
+  * @file    sim_clock.c
+  * @brief   Virtual clock of the host simulation
+  ******************************************************************************
+  */
+#include <stddef.h>
+#include "sim_clock.h"
+
+static uint64_t Now;
+
+/* Scheduled events, earliest first. Events of the same time run in the order they were scheduled. */
+static SimEvent_t *EventListHead;
+
+uint64_t SimClockGetTime(void)
+{
+  return Now;
+}
+
+void SimClockStart(SimEvent_t *event, uint64_t time)
+{
+  SimEvent_t **prev = &EventListHead;
+
+  SimClockStop(event);
+  event->Time = time < Now ? Now : time;
+  while (*prev != NULL && (*prev)->Time <= event->Time) {
+    prev = &(*prev)->Next;
+  }
+  event->Next = *prev;
+  event->IsPending = true;
+  *prev = event;
+}
+
+void SimClockStop(SimEvent_t *event)
+{
+  SimEvent_t **prev = &EventListHead;
+
+  if (!event->IsPending) {
+    return;
+  }
+  while (*prev != event) {
+    prev = &(*prev)->Next;
+  }
+  *prev = event->Next;
+  event->IsPending = false;
+}
+
+bool SimClockRunNext(void)
+{
+  SimEvent_t *event = EventListHead;
+
+  if (event == NULL) {
+    return false;
+  }
+  EventListHead = event->Next;
+  event->IsPending = false;
+  Now = event->Time;
+  event->Callback(event->Context);
+  return true;
+}
@@ -0,0 +1,56 @@
+/**
+  ******************************************************************************
+  * @file    sim_clock.h
+  * @brief   Virtual clock of the host simulation
+  *
+  * Time only advances from one scheduled event to the next, so a
+  * simulated second costs no wall-clock time. The timer driver of each
+  * simulated device and the air interface schedule their events here.
+  ******************************************************************************
+  */
+#ifndef __SIM_CLOCK_H__
+#define __SIM_CLOCK_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct SimEvent_s {
+  uint64_t Time;                    /*!< Time of the event, in us of virtual time */
+  void (*Callback)(void *context);  /*!< Function called at that time */
+  void *Context;                    /*!< Argument of the callback */
+  bool IsPending;                   /*!< The event is scheduled */
+  struct SimEvent_s *Next;
+} SimEvent_t;
+
+/**
+  * @brief Returns the virtual time, in us since the start of the simulation
+  */
+uint64_t SimClockGetTime(void);
+
+/**
+  * @brief Schedules an event, or moves it if it is already scheduled
+  * @param event Event, with its callback and context set
+  * @param time Virtual time of the event, in us. A time in the past runs it next.
+  */
+void SimClockStart(SimEvent_t *event, uint64_t time);
+
+/**
+  * @brief Removes a scheduled event. Stopping an event that is not scheduled does nothing.
+  */
+void SimClockStop(SimEvent_t *event);
+
+/**
+  * @brief Advances the virtual time to the next event and runs it
+  * @return false when no event is scheduled
+  */
+bool SimClockRunNext(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SIM_CLOCK_H__ */
@@ -0,0 +1,173 @@
+/**
+  ******************************************************************************
+  * @file    sim_device.c
+  * @brief   Simulated end device of the host simulation
+  ******************************************************************************
+  */
+#include <string.h>
+#include "LoRaMac.h"
+#include "timer.h"
+#include "sim_device.h"
+
+static SimDeviceConfig_t Config;
+static SimDeviceStats_t Stats;
+static bool RequestPending;
+static uint8_t Payload[255];
+
+static void MacMcpsConfirm(McpsConfirm_t *confirm)
+{
+  RequestPending = false;
+  Stats.UplinksDone++;
+  if (confirm->AckReceived) {
+    Stats.UplinksAcked++;
+  }
+  if (confirm->Status != LORAMAC_EVENT_INFO_STATUS_OK) {
+    Stats.Errors++;
+  }
+}
+
+static void MacMcpsIndication(McpsIndication_t *indication, LoRaMacRxStatus_t *status)
+{
+  (void)status;
+  if (indication->Status == LORAMAC_EVENT_INFO_STATUS_OK && indication->RxData) {
+    Stats.DownlinksReceived++;
+  }
+}
+
+static void MacMlmeConfirm(MlmeConfirm_t *confirm)
+{
+  if (confirm->MlmeRequest == MLME_JOIN) {
+    RequestPending = false;
+    Stats.Joined = confirm->Status == LORAMAC_EVENT_INFO_STATUS_OK;
+  }
+}
+
+static void MacMlmeIndication(MlmeIndication_t *indication, LoRaMacRxStatus_t *status)
+{
+  (void)indication;
+  (void)status;
+}
+
+static void MacProcessNotify(void)
+{
+  if (Config.Notify != NULL) {
+    Config.Notify(Config.NotifyContext);
+  }
+}
+
+static LoRaMacPrimitives_t Primitives = {
+  .MacMcpsConfirm = MacMcpsConfirm,
+  .MacMcpsIndication = MacMcpsIndication,
+  .MacMlmeConfirm = MacMlmeConfirm,
+  .MacMlmeIndication = MacMlmeIndication,
+};
+
+static LoRaMacCallback_t Callbacks = {
+  .MacProcessNotify = MacProcessNotify,
+};
+
+static bool SetMib(Mib_t type, MibRequestConfirm_t *mib)
+{
+  mib->Type = type;
+  return LoRaMacMibSetRequestConfirm(mib) == LORAMAC_STATUS_OK;
+}
+
+bool SimDeviceInit(const SimDeviceConfig_t *config)
+{
+  MibRequestConfirm_t mib;
+
+  Config = *config;
+  SimRadioSetSeed(config->Seed);
+  UTIL_TIMER_Init(NULL);
+  if (LoRaMacInitialization(&Primitives, &Callbacks, (LoRaMacRegion_t)config->Region) != LORAMAC_STATUS_OK ||
+      LoRaMacStart() != LORAMAC_STATUS_OK) {
+    return false;
+  }
+
+  mib.Param.DevEui = Config.DevEui;
+  if (!SetMib(MIB_DEV_EUI, &mib)) {
+    return false;
+  }
+  mib.Param.JoinEui = Config.JoinEui;
+  if (!SetMib(MIB_JOIN_EUI, &mib)) {
+    return false;
+  }
+  /* LoRaWAN 1.0.x joins with the NwkKey, the AppKey is its other name */
+  mib.Param.AppKey = Config.AppKey;
+  if (!SetMib(MIB_APP_KEY, &mib)) {
+    return false;
+  }
+  mib.Param.NwkKey = Config.AppKey;
+  if (!SetMib(MIB_NWK_KEY, &mib)) {
+    return false;
+  }
+  mib.Param.AdrEnable = false;
+  if (!SetMib(MIB_ADR, &mib)) {
+    return false;
+  }
+  if (Config.MinRxSymbols != 0) {
+    mib.Param.MinRxSymbols = Config.MinRxSymbols;
+    if (!SetMib(MIB_MIN_RX_SYMBOLS, &mib)) {
+      return false;
+    }
+  }
+  mib.Param.ChannelsDatarate = Config.Datarate;
+  return SetMib(MIB_CHANNELS_DATARATE, &mib);
+}
+
+bool SimDeviceProcess(void)
+{
+  LoRaMacProcess();
+
+  if (RequestPending || Stats.UplinksDone == Config.Uplinks) {
+    return Stats.Joined && Stats.UplinksDone == Config.Uplinks;
+  }
+  if (!Stats.Joined) {
+    MlmeReq_t mlme = { 0 };
+
+    mlme.Type = MLME_JOIN;
+    mlme.Req.Join.NetworkActivation = ACTIVATION_TYPE_OTAA;
+    mlme.Req.Join.Datarate = Config.Datarate;
+    mlme.Req.Join.TxPower = TX_POWER_0;
+    Stats.JoinAttempts++;
+    if (LoRaMacMlmeRequest(&mlme) == LORAMAC_STATUS_OK) {
+      RequestPending = true;
+    } else {
+      Stats.Errors++;
+    }
+  } else {
+    McpsReq_t mcps = { 0 };
+
+    /* The uplink counter, then a filler */
+    memset(Payload, 0x55, Config.PayloadSize);
+    memcpy(Payload, &Stats.UplinksDone, Config.PayloadSize < 4 ? Config.PayloadSize : 4);
+    if (Config.Confirmed) {
+      mcps.Type = MCPS_CONFIRMED;
+      mcps.Req.Confirmed.fPort = 1;
+      mcps.Req.Confirmed.fBuffer = Payload;
+      mcps.Req.Confirmed.fBufferSize = Config.PayloadSize;
+      mcps.Req.Confirmed.Datarate = Config.Datarate;
+#if (defined( LORAMAC_VERSION ) && ( LORAMAC_VERSION == 0x01000300 ))
+      mcps.Req.Confirmed.NbTrials = 8;
+#endif /* LORAMAC_VERSION */
+    } else {
+      mcps.Type = MCPS_UNCONFIRMED;
+      mcps.Req.Unconfirmed.fPort = 1;
+      mcps.Req.Unconfirmed.fBuffer = Payload;
+      mcps.Req.Unconfirmed.fBufferSize = Config.PayloadSize;
+      mcps.Req.Unconfirmed.Datarate = Config.Datarate;
+    }
+    if (LoRaMacMcpsRequest(&mcps, true) == LORAMAC_STATUS_OK) {
+      RequestPending = true;
+    } else {
+      Stats.Errors++;
+    }
+  }
+  return false;
+}
+
+void SimDeviceGetStats(SimDeviceStats_t *stats)
+{
+  *stats = Stats;
+  SimRadioGetStats(&stats->Radio);
+}
@@ -0,0 +1,71 @@
+/**
+  ******************************************************************************
+  * @file    sim_device.h
+  * @brief   Simulated end device of the host simulation
+  *
+  * Runs the LoRaMac stack over the simulated radio: the device joins with
+  * OTAA, then sends its uplinks one after the other, each as soon as the
+  * stack confirmed the previous one. Duty cycle restrictions apply, so
+  * the stack delays transmissions as it would on the STM32WL.
+  *
+  * The device and the stack keep their state in file-static variables:
+  * a program runs more devices by loading more copies of sim_device.so.
+  ******************************************************************************
+  */
+#ifndef __SIM_DEVICE_H__
+#define __SIM_DEVICE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sim_radio.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  uint8_t DevEui[8];
+  uint8_t JoinEui[8];
+  uint8_t AppKey[16];
+  uint8_t Region;                   /*!< LoRaMacRegion_t */
+  int8_t Datarate;                  /*!< Of the join request and the uplinks, ADR is off */
+  uint32_t Uplinks;                 /*!< Uplinks to send after joining */
+  uint8_t PayloadSize;
+  bool Confirmed;
+  uint32_t Seed;                    /*!< Of the random numbers of the radio */
+  uint8_t MinRxSymbols;             /*!< MIB_MIN_RX_SYMBOLS, 0 for the stack default */
+  void (*Notify)(void *context);    /*!< The device has work for SimDeviceProcess */
+  void *NotifyContext;
+} SimDeviceConfig_t;
+
+typedef struct {
+  bool Joined;
+  uint32_t JoinAttempts;
+  uint32_t UplinksDone;             /*!< Uplinks confirmed by the stack */
+  uint32_t UplinksAcked;
+  uint32_t DownlinksReceived;       /*!< Downlinks with application data */
+  uint32_t Errors;                  /*!< Requests refused and failed confirms */
+  SimRadioStats_t Radio;
+} SimDeviceStats_t;
+
+/**
+  * @brief Starts the stack of the device
+  * @return false if the stack could not be started
+  */
+bool SimDeviceInit(const SimDeviceConfig_t *config);
+
+/**
+  * @brief Runs the stack, then sends the next request when it is idle
+  *
+  * To call once after SimDeviceInit, then after each Notify.
+  * @return true once all the uplinks are done
+  */
+bool SimDeviceProcess(void);
+
+void SimDeviceGetStats(SimDeviceStats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SIM_DEVICE_H__ */
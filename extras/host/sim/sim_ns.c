@@ -0,0 +1,296 @@
+/**
+  ******************************************************************************
+  * @file    sim_ns.c
+  * @brief   Network server stand-in of the host simulation
+  *
+  * Uses the AES and CMAC code of the stack. A join accept is encrypted
+  * with AES decryption, so lorawan_aes.c must be built with
+  * AES_DEC_PREKEYED defined for this file.
+  ******************************************************************************
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cmac.h"
+#include "lorawan_aes.h"
+#include "sim_air.h"
+#include "sim_ns.h"
+
+#if !defined(AES_DEC_PREKEYED)
+#error "build with AES_DEC_PREKEYED defined, the join accept needs AES decryption"
+#endif
+
+#define JOIN_ACCEPT_DELAY 5000000
+#define RECEIVE_DELAY 1000000
+#define DEV_ADDR_BASE 0x26000000
+#define DOWNLINK_PREAMBLE_LENGTH 8
+
+#define MTYPE_JOIN_REQUEST 0x00
+#define MTYPE_JOIN_ACCEPT 0x01
+#define MTYPE_UNCONFIRMED_UP 0x02
+#define MTYPE_UNCONFIRMED_DOWN 0x03
+#define MTYPE_CONFIRMED_UP 0x04
+
+#define FCTRL_ADR_ACK_REQ 0x40
+#define FCTRL_ACK 0x20
+
+#define JOIN_REQUEST_SIZE 23
+#define MIN_DATA_SIZE 12
+
+typedef struct {
+  uint8_t DevEui[8];
+  uint16_t LastDevNonce;
+  uint8_t NwkSKey[16];
+  uint8_t AppSKey[16];
+  uint32_t FCntUp;
+  uint32_t FCntDown;
+  uint32_t UplinksSinceDownlink;
+  bool Joined;
+} SimNsDevice_t;
+
+static SimNsConfig_t Config;
+static SimNsStats_t Stats;
+static SimNsDevice_t *Devices;
+static uint32_t DeviceCount;
+static uint32_t JoinNonce;
+
+static void PutU32(uint8_t *p, uint32_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t GetU32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void ComputeCmac(const uint8_t key[16], const uint8_t *b0, const uint8_t *msg, uint32_t len, uint8_t mic[4])
+{
+  AES_CMAC_CTX ctx;
+  uint8_t digest[AES_CMAC_DIGEST_LENGTH];
+
+  AES_CMAC_Init(&ctx);
+  AES_CMAC_SetKey(&ctx, key);
+  if (b0 != NULL) {
+    AES_CMAC_Update(&ctx, b0, 16);
+  }
+  AES_CMAC_Update(&ctx, msg, len);
+  AES_CMAC_Final(digest, &ctx);
+  memcpy(mic, digest, 4);
+}
+
+/* B0 block of the MIC of a data frame, or Ai block of its encryption, of LoRaWAN 1.0.x */
+static void PrepareBlock(uint8_t block[16], uint8_t first, uint8_t dir, uint32_t devAddr, uint32_t fCnt, uint8_t last)
+{
+  memset(block, 0, 16);
+  block[0] = first;
+  block[5] = dir;
+  PutU32(&block[6], devAddr);
+  PutU32(&block[10], fCnt);
+  block[15] = last;
+}
+
+static void DeriveKey(const uint8_t *joinAccept, uint16_t devNonce, uint8_t prefix, uint8_t key[16])
+{
+  lorawan_aes_context aes;
+  uint8_t block[16] = { 0 };
+
+  block[0] = prefix;
+  /* JoinNonce and NetID, as sent */
+  memcpy(&block[1], joinAccept, 6);
+  block[7] = (uint8_t)devNonce;
+  block[8] = (uint8_t)(devNonce >> 8);
+  lorawan_aes_set_key(Config.AppKey, 16, &aes);
+  lorawan_aes_encrypt(block, key, &aes);
+}
+
+static void SendDownlink(const SimFrame_t *uplink, uint64_t delay, const uint8_t *payload, uint8_t size)
+{
+  SimFrame_t frame = { 0 };
+
+  frame.Start = uplink->End + delay;
+  if (Config.Jitter != NULL) {
+    frame.Start += Config.Jitter(Config.JitterContext);
+  }
+  frame.Frequency = uplink->Frequency;
+  frame.Modem = uplink->Modem;
+  frame.SpreadingFactor = uplink->SpreadingFactor;
+  frame.Bandwidth = uplink->Bandwidth;
+  frame.BitRate = uplink->BitRate;
+  frame.PreambleLength = uplink->Modem == SIM_MODEM_LORA ? DOWNLINK_PREAMBLE_LENGTH : 5;
+  frame.IqInverted = uplink->Modem == SIM_MODEM_LORA;
+  frame.Rssi = Config.Rssi;
+  frame.Snr = Config.Snr;
+  frame.Size = size;
+  memcpy(frame.Payload, payload, size);
+  SimAirSendDownlink(&frame);
+}
+
+static void OnJoinRequest(const SimFrame_t *uplink)
+{
+  const uint8_t *p = uplink->Payload;
+  SimNsDevice_t *dev = NULL;
+  uint8_t mic[4];
+  uint8_t msg[1 + 16];
+  uint8_t encrypted[16];
+  lorawan_aes_context aes;
+  uint16_t devNonce;
+  uint32_t index;
+
+  if (uplink->Size != JOIN_REQUEST_SIZE) {
+    Stats.MicErrors++;
+    return;
+  }
+  ComputeCmac(Config.AppKey, NULL, p, JOIN_REQUEST_SIZE - 4, mic);
+  if (memcmp(mic, &p[JOIN_REQUEST_SIZE - 4], 4) != 0) {
+    Stats.MicErrors++;
+    return;
+  }
+  devNonce = p[17] | (p[18] << 8);
+  for (index = 0; index < DeviceCount; index++) {
+    if (memcmp(Devices[index].DevEui, &p[9], 8) == 0) {
+      dev = &Devices[index];
+      break;
+    }
+  }
+  if (dev == NULL) {
+    Devices = realloc(Devices, (DeviceCount + 1) * sizeof(*Devices));
+    if (Devices == NULL) {
+      fprintf(stderr, "sim_ns: out of memory\n");
+      exit(2);
+    }
+    dev = &Devices[DeviceCount++];
+    memcpy(dev->DevEui, &p[9], 8);
+  } else if (dev->Joined && devNonce == dev->LastDevNonce) {
+    /* A replayed join request is ignored */
+    return;
+  }
+  dev->LastDevNonce = devNonce;
+  dev->FCntUp = 0;
+  dev->FCntDown = 0;
+  dev->UplinksSinceDownlink = 0;
+  dev->Joined = true;
+
+  /* JoinNonce, NetID, DevAddr, DLSettings (Rx1 datarate offset and Rx2 datarate 0), RxDelay */
+  msg[0] = MTYPE_JOIN_ACCEPT << 5;
+  PutU32(&msg[1], ++JoinNonce & 0xFFFFFF);
+  PutU32(&msg[4], Config.NetId & 0xFFFFFF);
+  PutU32(&msg[7], DEV_ADDR_BASE + index);
+  msg[11] = 0;
+  msg[12] = RECEIVE_DELAY / 1000000;
+  ComputeCmac(Config.AppKey, NULL, msg, 13, &msg[13]);
+  DeriveKey(&msg[1], devNonce, 0x01, dev->NwkSKey);
+  DeriveKey(&msg[1], devNonce, 0x02, dev->AppSKey);
+
+  /* The device decrypts the join accept with AES encryption */
+  lorawan_aes_set_key(Config.AppKey, 16, &aes);
+  lorawan_aes_decrypt(&msg[1], encrypted, &aes);
+  memcpy(&msg[1], encrypted, 16);
+  SendDownlink(uplink, JOIN_ACCEPT_DELAY, msg, sizeof(msg));
+  Stats.JoinAccepts++;
+}
+
+static void OnDataUplink(const SimFrame_t *uplink, bool confirmed)
+{
+  const uint8_t *p = uplink->Payload;
+  uint32_t devAddr = GetU32(&p[1]);
+  uint32_t index = devAddr - DEV_ADDR_BASE;
+  SimNsDevice_t *dev;
+  uint32_t fCnt;
+  uint8_t block[16];
+  uint8_t mic[4];
+  uint8_t msg[MIN_DATA_SIZE + 1 + 4];
+  uint8_t size = 8;
+  bool appData;
+
+  if (index >= DeviceCount || uplink->Size < MIN_DATA_SIZE) {
+    Stats.MicErrors++;
+    return;
+  }
+  dev = &Devices[index];
+  /* 32 bit counter from the 16 bits sent, counters only go up */
+  fCnt = (dev->FCntUp & 0xFFFF0000) | p[6] | (p[7] << 8);
+  if (fCnt < dev->FCntUp) {
+    fCnt += 0x10000;
+  }
+  PrepareBlock(block, 0x49, 0, devAddr, fCnt, uplink->Size - 4);
+  ComputeCmac(dev->NwkSKey, block, p, uplink->Size - 4, mic);
+  if (memcmp(mic, &p[uplink->Size - 4], 4) != 0) {
+    Stats.MicErrors++;
+    return;
+  }
+  dev->FCntUp = fCnt;
+  Stats.Uplinks++;
+  if (confirmed) {
+    Stats.ConfirmedUplinks++;
+  }
+
+  dev->UplinksSinceDownlink++;
+  appData = Config.DownlinkPeriod != 0 && dev->UplinksSinceDownlink >= Config.DownlinkPeriod;
+  if (!confirmed && !appData && (p[5] & FCTRL_ADR_ACK_REQ) == 0) {
+    return;
+  }
+
+  /* MHDR, FHDR without FOpts, then the application data if any */
+  msg[0] = MTYPE_UNCONFIRMED_DOWN << 5;
+  PutU32(&msg[1], devAddr);
+  msg[5] = confirmed ? FCTRL_ACK : 0;
+  msg[6] = (uint8_t)dev->FCntDown;
+  msg[7] = (uint8_t)(dev->FCntDown >> 8);
+  if (appData) {
+    uint8_t keystream[16];
+    lorawan_aes_context aes;
+
+    dev->UplinksSinceDownlink = 0;
+    msg[size++] = SIM_NS_DOWNLINK_PORT;
+    PutU32(&msg[size], fCnt);
+    PrepareBlock(block, 0x01, 1, devAddr, dev->FCntDown, 1);
+    lorawan_aes_set_key(dev->AppSKey, 16, &aes);
+    lorawan_aes_encrypt(block, keystream, &aes);
+    for (unsigned i = 0; i < 4; i++) {
+      msg[size + i] ^= keystream[i];
+    }
+    size += 4;
+  }
+  PrepareBlock(block, 0x49, 1, devAddr, dev->FCntDown, size);
+  ComputeCmac(dev->NwkSKey, block, msg, size, &msg[size]);
+  size += 4;
+  dev->FCntDown++;
+  SendDownlink(uplink, RECEIVE_DELAY, msg, size);
+  Stats.Downlinks++;
+}
+
+static void OnUplink(void *context, const SimFrame_t *uplink)
+{
+  (void)context;
+  if (uplink->Size == 0) {
+    return;
+  }
+  switch (uplink->Payload[0] >> 5) {
+    case MTYPE_JOIN_REQUEST:
+      OnJoinRequest(uplink);
+      break;
+    case MTYPE_UNCONFIRMED_UP:
+      OnDataUplink(uplink, false);
+      break;
+    case MTYPE_CONFIRMED_UP:
+      OnDataUplink(uplink, true);
+      break;
+    default:
+      break;
+  }
+}
+
+void SimNsInit(const SimNsConfig_t *config)
+{
+  Config = *config;
+  SimAirSetGateway(OnUplink, NULL);
+}
+
+void SimNsGetStats(SimNsStats_t *stats)
+{
+  *stats = Stats;
+}
@@ -0,0 +1,60 @@
+/**
+  ******************************************************************************
+  * @file    sim_ns.h
+  * @brief   Network server stand-in of the host simulation
+  *
+  * Receives the uplinks of the simulated air interface as a gateway and
+  * answers like a LoRaWAN 1.0.x network server would:
+  * - A join request with a valid MIC gets a join accept in Rx1, 5 s after
+  *   its end, with a new device address.
+  * - A data uplink with a valid MIC is acknowledged in Rx1, 1 s after its
+  *   end, when it is confirmed or asks for an ADR acknowledgement. Every
+  *   DownlinkPeriod uplinks, the answer also carries application data.
+  * Rx1 uses the channel and the datarate of the uplink, as in EU868 with
+  * an Rx1 datarate offset of 0. All devices share the same AppKey.
+  ******************************************************************************
+  */
+#ifndef __SIM_NS_H__
+#define __SIM_NS_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+  * @brief Port of the application data in the downlinks
+  */
+#define SIM_NS_DOWNLINK_PORT 1
+
+typedef struct {
+  uint8_t AppKey[16];         /*!< Root key of all the devices */
+  uint32_t NetId;
+  int16_t Rssi;               /*!< Signal strength of the downlinks at the devices, dBm */
+  int8_t Snr;                 /*!< dB */
+  uint32_t DownlinkPeriod;    /*!< Application data every this many uplinks of a device, 0 for none */
+  int32_t (*Jitter)(void *context);  /*!< Offset of the start of each downlink, us, NULL for none */
+  void *JitterContext;
+} SimNsConfig_t;
+
+typedef struct {
+  uint32_t JoinAccepts;       /*!< Join requests accepted */
+  uint32_t Uplinks;           /*!< Data uplinks received, repetitions included */
+  uint32_t ConfirmedUplinks;  /*!< Confirmed data uplinks received, repetitions included */
+  uint32_t Downlinks;         /*!< Data downlinks sent */
+  uint32_t MicErrors;         /*!< Frames dropped for a wrong MIC or an unknown device */
+} SimNsStats_t;
+
+/**
+  * @brief Starts the network server and makes it the gateway of the air interface
+  */
+void SimNsInit(const SimNsConfig_t *config);
+
+void SimNsGetStats(SimNsStats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SIM_NS_H__ */
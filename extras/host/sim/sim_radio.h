@@ -0,0 +1,41 @@
+/**
+  ******************************************************************************
+  * @file    sim_radio.h
+  * @brief   Simulated SUBGHZ radio of a host simulated device
+  *
+  * radio_driver_sim.c replaces radio_driver.c: it implements the SUBGRF_*
+  * functions that radio.c drives, over the simulated air interface and
+  * the virtual clock. radio.c itself, with its time on air computation
+  * and its interrupt handling, is the same as on the STM32WL.
+  ******************************************************************************
+  */
+#ifndef __SIM_RADIO_H__
+#define __SIM_RADIO_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  uint32_t TxFrames;      /*!< Frames sent */
+  uint32_t RxFrames;      /*!< Frames received */
+  uint32_t RxTimeouts;    /*!< Receptions that timed out */
+  uint64_t TxTime;        /*!< Time spent sending, us */
+  uint64_t RxTime;        /*!< Time spent receiving, us */
+  uint64_t RxWindow;      /*!< Length of the last reception with a timeout, us */
+} SimRadioStats_t;
+
+/**
+  * @brief Seeds the random numbers of the radio, call before the stack starts
+  */
+void SimRadioSetSeed(uint32_t seed);
+
+void SimRadioGetStats(SimRadioStats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SIM_RADIO_H__ */
@@ -0,0 +1,174 @@
+/**
+  ******************************************************************************
+  * @file    timer_if_sim.c
+  * @brief   Timer and SysTime drivers of a host simulated device
+  *
+  * Replaces BSP/timer_if.c: the timer server runs on the virtual clock,
+  * with a tick of 1 ms like the RTC based driver, and its alarm is an
+  * event of the virtual clock. MW_LOG goes to stderr when the
+  * SIM_MW_LOG environment variable is set.
+  ******************************************************************************
+  */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "timer_if.h"
+#include "mw_log_conf.h"
+#include "sim_clock.h"
+
+#define MIN_ALARM_DELAY 1
+
+static SimEvent_t AlarmEvent;
+static uint32_t TimerContext;
+static uint32_t BackupSeconds;
+static uint32_t BackupSubSeconds;
+
+static uint32_t GetTimerTicks(void)
+{
+  return (uint32_t)(SimClockGetTime() / 1000);
+}
+
+static void OnAlarm(void *context)
+{
+  (void)context;
+  UTIL_TIMER_IRQ_Handler();
+}
+
+UTIL_TIMER_Status_t TIMER_IF_Init(RTC_HandleTypeDef *RtcHandle)
+{
+  (void)RtcHandle;
+  AlarmEvent.Callback = OnAlarm;
+  TIMER_IF_SetTimerContext();
+  return UTIL_TIMER_OK;
+}
+
+UTIL_TIMER_Status_t TIMER_IF_StartTimer(uint32_t timeout)
+{
+  /* The alarm is at TimerContext + timeout ticks, past the current tick if the context is old */
+  uint64_t now = SimClockGetTime();
+  uint32_t delay = TimerContext + timeout - GetTimerTicks();
+
+  if (delay > timeout) {
+    delay = 0;
+  }
+  SimClockStart(&AlarmEvent, (now / 1000 + delay) * 1000);
+  return UTIL_TIMER_OK;
+}
+
+UTIL_TIMER_Status_t TIMER_IF_StopTimer(void)
+{
+  SimClockStop(&AlarmEvent);
+  return UTIL_TIMER_OK;
+}
+
+uint32_t TIMER_IF_SetTimerContext(void)
+{
+  TimerContext = GetTimerTicks();
+  return TimerContext;
+}
+
+uint32_t TIMER_IF_GetTimerContext(void)
+{
+  return TimerContext;
+}
+
+uint32_t TIMER_IF_GetTimerElapsedTime(void)
+{
+  return GetTimerTicks() - TimerContext;
+}
+
+uint32_t TIMER_IF_GetTimerValue(void)
+{
+  return GetTimerTicks();
+}
+
+uint32_t TIMER_IF_GetMinimumTimeout(void)
+{
+  return MIN_ALARM_DELAY;
+}
+
+uint32_t TIMER_IF_Convert_ms2Tick(uint32_t timeMilliSec)
+{
+  return timeMilliSec;
+}
+
+uint32_t TIMER_IF_Convert_Tick2ms(uint32_t tick)
+{
+  return tick;
+}
+
+void TIMER_IF_DelayMs(uint32_t delay)
+{
+  (void)delay;
+}
+
+uint32_t TIMER_IF_GetTime(uint32_t *mSeconds)
+{
+  uint64_t ms = SimClockGetTime() / 1000;
+
+  *mSeconds = (uint32_t)(ms % 1000);
+  return (uint32_t)(ms / 1000);
+}
+
+void TIMER_IF_BkUp_Write_Seconds(uint32_t Seconds)
+{
+  BackupSeconds = Seconds;
+}
+
+void TIMER_IF_BkUp_Write_SubSeconds(uint32_t SubSeconds)
+{
+  BackupSubSeconds = SubSeconds;
+}
+
+uint32_t TIMER_IF_BkUp_Read_Seconds(void)
+{
+  return BackupSeconds;
+}
+
+uint32_t TIMER_IF_BkUp_Read_SubSeconds(void)
+{
+  return BackupSubSeconds;
+}
+
+const UTIL_TIMER_Driver_s UTIL_TimerDriver = {
+  TIMER_IF_Init,
+  NULL,
+
+  TIMER_IF_StartTimer,
+  TIMER_IF_StopTimer,
+
+  TIMER_IF_SetTimerContext,
+  TIMER_IF_GetTimerContext,
+
+  TIMER_IF_GetTimerElapsedTime,
+  TIMER_IF_GetTimerValue,
+  TIMER_IF_GetMinimumTimeout,
+
+  TIMER_IF_Convert_ms2Tick,
+  TIMER_IF_Convert_Tick2ms,
+};
+
+const UTIL_SYSTIM_Driver_s UTIL_SYSTIMDriver = {
+  TIMER_IF_BkUp_Write_Seconds,
+  TIMER_IF_BkUp_Read_Seconds,
+  TIMER_IF_BkUp_Write_SubSeconds,
+  TIMER_IF_BkUp_Read_SubSeconds,
+  TIMER_IF_GetTime,
+};
+
+void MW_LOG(MwLogTimestamp_t ts, MwLogLevel_t level, const char *fmt, ...)
+{
+  static int enabled = -1;
+  va_list ap;
+
+  (void)ts;
+  (void)level;
+  if (enabled < 0) {
+    enabled = getenv("SIM_MW_LOG") != NULL;
+  }
+  if (enabled) {
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+  }
+}
@@ -0,0 +1,299 @@
+/**
+  ******************************************************************************
+  * @file    test_hop_cache.c
+  * @brief   Test of the LR-FHSS hop cache
+  *
+  * Runs LR-FHSS transmissions through wl_lr_fhss.c with the hop cache
+  * empty, then with the hop sequence precomputed, and checks that both
+  * write the same hop table to the radio. The radio register accesses
+  * are recorded by the SUBGRF_* stand-ins below.
+  *
+  * A second test replays the order radio.c uses the cache in: the
+  * sequence of a later transmission is filled while the current one is
+  * still hopping.
+  *
+  * Usage: test_hop_cache [seed]
+  ******************************************************************************
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wl_lr_fhss.h"
+
+#if (WL_LR_FHSS_HOP_CACHE_SIZE < 2)
+#error "build with WL_LR_FHSS_HOP_CACHE_SIZE of at least 2"
+#endif
+
+#define RANDOM_FRAMES_PER_CONFIG 50
+#define CHAINED_FRAMES 500
+#define MAX_WRITES 512
+/* Largest register write of wl_lr_fhss.c, a hop table entry */
+#define MAX_WRITE_SIZE 6
+
+/*
+ * Radio stand-in: records register writes, the hop table included
+ */
+typedef struct {
+  uint16_t address;
+  uint8_t size;
+  uint8_t data[MAX_WRITE_SIZE];
+} reg_write_t;
+
+typedef struct {
+  reg_write_t writes[MAX_WRITES];
+  unsigned count;
+  uint8_t payload[LR_FHSS_MAX_PHY_PAYLOAD_BYTES];
+  uint16_t payload_size;
+} radio_log_t;
+
+static radio_log_t *radio_log;
+
+void SUBGRF_WriteRegisters(uint16_t address, uint8_t *buffer, uint16_t size)
+{
+  if (radio_log == NULL || radio_log->count == MAX_WRITES || size > MAX_WRITE_SIZE) {
+    fprintf(stderr, "test_hop_cache: unexpected register write at 0x%04x\n", address);
+    exit(2);
+  }
+  reg_write_t *w = &radio_log->writes[radio_log->count++];
+  w->address = address;
+  w->size = (uint8_t)size;
+  memcpy(w->data, buffer, size);
+}
+
+void SUBGRF_WriteRegister(uint16_t address, uint8_t value)
+{
+  SUBGRF_WriteRegisters(address, &value, 1);
+}
+
+void SUBGRF_WriteBuffer(uint8_t offset, uint8_t *buffer, uint8_t size)
+{
+  (void)offset;
+  memcpy(radio_log->payload, buffer, size);
+  radio_log->payload_size = size;
+}
+
+void SUBGRF_WriteCommand(SUBGHZ_RadioSetCmd_t command, uint8_t *buffer, uint16_t size)
+{
+  (void)command;
+  (void)buffer;
+  (void)size;
+}
+
+void SUBGRF_SetPacketType(RadioPacketTypes_t packetType)
+{
+  (void)packetType;
+}
+
+void SUBGRF_SetBufferBaseAddress(uint8_t txBaseAddress, uint8_t rxBaseAddress)
+{
+  (void)txBaseAddress;
+  (void)rxBaseAddress;
+}
+
+/*
+ * Test driver
+ */
+typedef struct {
+  wl_lr_fhss_params_t params;
+  uint8_t sync_word[LR_FHSS_SYNC_WORD_BYTES];
+  uint8_t payload[LR_FHSS_MAX_PHY_PAYLOAD_BYTES];
+  uint16_t length;
+  uint16_t hop_sequence_id;
+} frame_t;
+
+static uint32_t rng_state;
+static unsigned failures;
+
+static uint32_t rng(void)
+{
+  /* xorshift32, so runs are reproducible from the seed */
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static void check(int ok, const char *what, unsigned a, unsigned b, unsigned c)
+{
+  if (!ok) {
+    if (failures < 20) {
+      printf("FAIL: %s (%u, %u, %u)\n", what, a, b, c);
+    }
+    failures++;
+  }
+}
+
+static void random_frame(frame_t *f, lr_fhss_v1_grid_t grid, uint8_t header_count, bool enable_hopping)
+{
+  lr_fhss_v1_params_t *p = &f->params.lr_fhss_params;
+  lr_fhss_digest_t digest;
+  uint16_t length;
+
+  memset(f, 0, sizeof(*f));
+  for (unsigned i = 0; i < sizeof(f->sync_word); i++) {
+    f->sync_word[i] = (uint8_t)rng();
+  }
+  p->sync_word = f->sync_word;
+  p->modulation_type = LR_FHSS_V1_MODULATION_TYPE_GMSK_488;
+  p->cr = (lr_fhss_v1_cr_t)(rng() % (LR_FHSS_V1_CR_1_3 + 1));
+  p->grid = grid;
+  /* The 25 kHz grid needs at least 722 kHz of bandwidth */
+  if (grid == LR_FHSS_V1_GRID_25391_HZ) {
+    p->bw = (lr_fhss_v1_bw_t)(LR_FHSS_V1_BW_722656_HZ + rng() % 4);
+    f->params.device_offset = (int8_t)(rng() % 52) - 26;
+  } else {
+    p->bw = (lr_fhss_v1_bw_t)(rng() % (LR_FHSS_V1_BW_1574219_HZ + 1));
+    f->params.device_offset = (int8_t)(rng() % 8) - 4;
+  }
+  p->enable_hopping = enable_hopping;
+  p->header_count = header_count;
+  /* 868.1 MHz */
+  f->params.center_freq_in_pll_steps = 910268825;
+
+  /* Longest payload whose frame still fits, then a random length up to it, the longest one half of the time */
+  for (length = 1; length < LR_FHSS_MAX_PHY_PAYLOAD_BYTES - 3; length++) {
+    lr_fhss_process_parameters(p, length + 1, &digest);
+    if (digest.nb_bytes > LR_FHSS_MAX_PHY_PAYLOAD_BYTES) {
+      break;
+    }
+  }
+  f->length = (rng() & 1) ? length : 1 + rng() % length;
+  for (unsigned i = 0; i < f->length; i++) {
+    f->payload[i] = (uint8_t)rng();
+  }
+  f->hop_sequence_id = rng() % lr_fhss_get_hop_sequence_count(p);
+}
+
+/* Build the frame, then handle hop interrupts until all hops are written, like radio.c */
+static bool transmit(const frame_t *f, radio_log_t *log, unsigned fill_after_hops, const frame_t *fill)
+{
+  wl_lr_fhss_state_t state;
+  bool cached;
+
+  memset(log, 0, sizeof(*log));
+  radio_log = log;
+  if (wl_lr_fhss_build_frame(&f->params, &state, f->hop_sequence_id, f->payload, f->length, NULL) !=
+      RADIO_STATUS_OK) {
+    check(0, "build_frame (hop sequence, length)", f->hop_sequence_id, f->length, 0);
+  }
+  cached = state.hop_cache != NULL;
+  for (unsigned hop = 0; state.current_hop < state.digest.nb_hops; hop++) {
+    if (fill != NULL && hop == fill_after_hops) {
+      wl_lr_fhss_hop_cache_fill(&fill->params.lr_fhss_params, fill->hop_sequence_id);
+      fill = NULL;
+    }
+    wl_lr_fhss_handle_hop(&f->params, &state);
+  }
+  if (fill != NULL) {
+    wl_lr_fhss_hop_cache_fill(&fill->params.lr_fhss_params, fill->hop_sequence_id);
+  }
+  wl_lr_fhss_handle_tx_done(&f->params, &state);
+  radio_log = NULL;
+  return cached;
+}
+
+static bool same_log(const radio_log_t *a, const radio_log_t *b)
+{
+  if (a->count != b->count || a->payload_size != b->payload_size ||
+      memcmp(a->payload, b->payload, a->payload_size) != 0) {
+    return false;
+  }
+  for (unsigned i = 0; i < a->count; i++) {
+    if (a->writes[i].address != b->writes[i].address || a->writes[i].size != b->writes[i].size ||
+        memcmp(a->writes[i].data, b->writes[i].data, a->writes[i].size) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void test_cached_frames(void)
+{
+  static radio_log_t log, ref_log;
+  unsigned frames = 0;
+
+  for (unsigned grid = LR_FHSS_V1_GRID_25391_HZ; grid <= LR_FHSS_V1_GRID_3906_HZ; grid++) {
+    for (uint8_t header_count = 1; header_count <= 4; header_count++) {
+      for (unsigned hopping = 0; hopping <= 1; hopping++) {
+        for (unsigned n = 0; n < RANDOM_FRAMES_PER_CONFIG; n++) {
+          frame_t f;
+
+          random_frame(&f, (lr_fhss_v1_grid_t)grid, header_count, hopping != 0);
+
+          wl_lr_fhss_hop_cache_clear();
+          bool cached = transmit(&f, &ref_log, 0, NULL);
+          check(!cached, "uncached transmission used the cache (grid, header count)", grid, header_count, 0);
+
+          wl_lr_fhss_hop_cache_clear();
+          wl_lr_fhss_hop_cache_fill(&f.params.lr_fhss_params, f.hop_sequence_id);
+          cached = transmit(&f, &log, 0, NULL);
+          check(cached == (hopping != 0), "cached transmission missed the cache (grid, header count)", grid,
+                header_count, 0);
+          check(same_log(&log, &ref_log), "cached hops (grid, header count, length)", grid, header_count, f.length);
+          frames++;
+        }
+      }
+    }
+  }
+  printf("%u frames compared with and without the cache\n", frames);
+}
+
+static void test_fill_during_transmission(void)
+{
+  static frame_t frames[CHAINED_FRAMES];
+  static radio_log_t ref_logs[CHAINED_FRAMES];
+  static radio_log_t log;
+  const unsigned look_ahead = WL_LR_FHSS_HOP_CACHE_SIZE - 1;
+  unsigned hits = 0;
+
+  /* Repeated frames exercise the copy of an already cached sequence */
+  for (unsigned i = 0; i < CHAINED_FRAMES; i++) {
+    if (i > 0 && rng() % 8 == 0) {
+      frames[i] = frames[i - 1 - rng() % (i < look_ahead ? i : look_ahead)];
+      frames[i].params.lr_fhss_params.sync_word = frames[i].sync_word;
+    } else {
+      random_frame(&frames[i], (lr_fhss_v1_grid_t)(rng() & 1), 1 + rng() % 4, true);
+    }
+  }
+  for (unsigned i = 0; i < CHAINED_FRAMES; i++) {
+    wl_lr_fhss_hop_cache_clear();
+    transmit(&frames[i], &ref_logs[i], 0, NULL);
+  }
+
+  /* As radio.c: look_ahead sequences filled in advance, the next one filled while transmitting */
+  wl_lr_fhss_hop_cache_clear();
+  for (unsigned i = 0; i < look_ahead; i++) {
+    wl_lr_fhss_hop_cache_fill(&frames[i].params.lr_fhss_params, frames[i].hop_sequence_id);
+  }
+  for (unsigned i = 0; i < CHAINED_FRAMES; i++) {
+    const frame_t *fill = i + look_ahead < CHAINED_FRAMES ? &frames[i + look_ahead] : NULL;
+    unsigned fill_after_hops = rng() % 8;
+
+    if (transmit(&frames[i], &log, fill_after_hops, fill)) {
+      hits++;
+    }
+    check(same_log(&log, &ref_logs[i]), "hops with a fill during the transmission (frame, hop)", i,
+          fill_after_hops, 0);
+  }
+  check(hits == CHAINED_FRAMES, "chained transmissions missed the cache (hits)", hits, 0, 0);
+  printf("%u chained transmissions compared\n", CHAINED_FRAMES);
+}
+
+int main(int argc, char **argv)
+{
+  rng_state = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 0x2545F491;
+  if (rng_state == 0) {
+    rng_state = 1;
+  }
+  printf("test_hop_cache: seed 0x%08x\n", (unsigned)rng_state);
+
+  test_cached_frames();
+  test_fill_during_transmission();
+
+  if (failures) {
+    printf("test_hop_cache: %u failures\n", failures);
+    return 1;
+  }
+  printf("test_hop_cache: passed\n");
+  return 0;
+}
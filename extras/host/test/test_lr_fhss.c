@@ -0,0 +1,401 @@
+/**
+  ******************************************************************************
+  * @file    test_lr_fhss.c
+  * @brief   Golden-vector test of the LR-FHSS frame encoder
+  *
+  * Compares the table-driven convolutional encoders, the word-wise
+  * interleaver and puncturing, and the square root of lr_fhss_mac.c
+  * with the bit-at-a-time implementation they replaced, which is
+  * reproduced below. lr_fhss_mac.c is built with TEST defined, so its
+  * private functions can be called directly.
+  *
+  * Usage: test_lr_fhss [seed]
+  ******************************************************************************
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lr_fhss_mac.h"
+
+#define LR_FHSS_MAX_TMP_BUF_BYTES 608
+#define RANDOM_FRAMES_PER_CONFIG 200
+
+/* Private functions and tables of lr_fhss_mac.c, visible with TEST */
+extern const uint8_t lr_fhss_header_interleaver_minus_one[80];
+uint16_t sqrt_uint16(uint16_t x);
+uint16_t lr_fhss_payload_crc16(const uint8_t *data_in, uint16_t data_in_bytecount);
+uint8_t lr_fhss_header_crc8(const uint8_t *data_in, uint16_t data_in_bytecount);
+void lr_fhss_payload_whitening(const uint8_t *data_in, uint16_t data_in_bytecount, uint8_t *data_out);
+uint8_t lr_fhss_extract_bit_in_byte_vector(const uint8_t *data_in, uint32_t bit_number);
+void lr_fhss_set_bit_in_byte_vector(uint8_t *vector, uint32_t bit_number, uint8_t bit_value);
+uint16_t lr_fhss_convolution_encode_viterbi_1_2_base(uint8_t *encod_state, const uint8_t *data_in,
+                                                     uint16_t data_in_bitcount, uint8_t *data_out);
+uint16_t lr_fhss_convolution_encode_viterbi_1_3_base(uint8_t *encod_state, const uint8_t *data_in,
+                                                     uint16_t data_in_bitcount, uint8_t *data_out);
+uint16_t lr_fhss_payload_interleaving(const uint8_t *data_in, uint16_t data_in_bitcount, uint8_t *data_out,
+                                      uint32_t output_offset);
+void lr_fhss_raw_header(const lr_fhss_v1_params_t *params, uint16_t hop_sequence_id, uint16_t payload_length,
+                        uint8_t *data_out);
+void lr_fhss_store_header_sync_word_index(uint8_t sync_word_index, uint8_t *data_out);
+
+/*
+ * Reference implementation: the bit-at-a-time code of the original
+ * lr_fhss_mac.c
+ */
+static const uint8_t ref_viterbi_1_3_table[64][2] = {
+  { 0, 7 }, { 3, 4 }, { 7, 0 }, { 4, 3 }, { 6, 1 }, { 5, 2 }, { 1, 6 }, { 2, 5 }, { 1, 6 }, { 2, 5 }, { 6, 1 },
+  { 5, 2 }, { 7, 0 }, { 4, 3 }, { 0, 7 }, { 3, 4 }, { 4, 3 }, { 7, 0 }, { 3, 4 }, { 0, 7 }, { 2, 5 }, { 1, 6 },
+  { 5, 2 }, { 6, 1 }, { 5, 2 }, { 6, 1 }, { 2, 5 }, { 1, 6 }, { 3, 4 }, { 0, 7 }, { 4, 3 }, { 7, 0 }, { 7, 0 },
+  { 4, 3 }, { 0, 7 }, { 3, 4 }, { 1, 6 }, { 2, 5 }, { 6, 1 }, { 5, 2 }, { 6, 1 }, { 5, 2 }, { 1, 6 }, { 2, 5 },
+  { 0, 7 }, { 3, 4 }, { 7, 0 }, { 4, 3 }, { 3, 4 }, { 0, 7 }, { 4, 3 }, { 7, 0 }, { 5, 2 }, { 6, 1 }, { 2, 5 },
+  { 1, 6 }, { 2, 5 }, { 1, 6 }, { 5, 2 }, { 6, 1 }, { 4, 3 }, { 7, 0 }, { 3, 4 }, { 0, 7 }
+};
+
+static const uint8_t ref_viterbi_1_2_table[16][2] = {
+  { 0, 3 }, { 1, 2 }, { 2, 1 }, { 3, 0 }, { 2, 1 }, { 3, 0 },
+  { 0, 3 }, { 1, 2 }, { 3, 0 }, { 2, 1 }, { 1, 2 }, { 0, 3 },
+  { 1, 2 }, { 0, 3 }, { 3, 0 }, { 2, 1 }
+};
+
+static uint16_t ref_viterbi_1_2_base(uint8_t *encod_state, const uint8_t *data_in, uint16_t data_in_bitcount,
+                                     uint8_t *data_out)
+{
+  uint16_t ind_bit;
+  uint16_t data_out_bitcount = 0;
+  uint16_t bin_out_16 = 0;
+
+  for (ind_bit = 0; ind_bit < data_in_bitcount; ind_bit++) {
+    uint8_t cur_bit = lr_fhss_extract_bit_in_byte_vector(data_in, ind_bit);
+    uint8_t g1g0 = ref_viterbi_1_2_table[*encod_state][cur_bit];
+    *encod_state = (*encod_state * 2 + cur_bit) % 16;
+    bin_out_16 |= (g1g0 << ((7 - (ind_bit % 8)) << 1));
+    if (ind_bit % 8 == 7) {
+      *data_out++ = (uint8_t)(bin_out_16 >> 8);
+      *data_out++ = (uint8_t)bin_out_16;
+      bin_out_16 = 0;
+    }
+    data_out_bitcount += 2;
+  }
+  if (ind_bit % 8) {
+    *data_out++ = (uint8_t)(bin_out_16 >> 8);
+    *data_out++ = (uint8_t)bin_out_16;
+  }
+
+  return data_out_bitcount;
+}
+
+static uint16_t ref_viterbi_1_3_base(uint8_t *encod_state, const uint8_t *data_in, uint16_t data_in_bitcount,
+                                     uint8_t *data_out)
+{
+  uint16_t ind_bit;
+  uint16_t data_out_bitcount = 0;
+  uint32_t bin_out_32 = 0;
+
+  for (ind_bit = 0; ind_bit < data_in_bitcount; ind_bit++) {
+    uint8_t cur_bit = lr_fhss_extract_bit_in_byte_vector(data_in, ind_bit);
+    uint8_t g1g0 = ref_viterbi_1_3_table[*encod_state][cur_bit];
+    *encod_state = (*encod_state * 2 + cur_bit) % 64;
+    bin_out_32 |= (g1g0 << ((7 - (ind_bit % 8)) * 3));
+    if (ind_bit % 8 == 7) {
+      *data_out++ = (uint8_t)(bin_out_32 >> 16);
+      *data_out++ = (uint8_t)(bin_out_32 >> 8);
+      *data_out++ = (uint8_t)bin_out_32;
+      bin_out_32 = 0;
+    }
+    data_out_bitcount += 3;
+  }
+  if (ind_bit % 8) {
+    *data_out++ = (uint8_t)(bin_out_32 >> 16);
+    *data_out++ = (uint8_t)(bin_out_32 >> 8);
+    *data_out++ = (uint8_t)bin_out_32;
+  }
+
+  return data_out_bitcount;
+}
+
+static uint16_t ref_sqrt_uint16(uint16_t x)
+{
+  uint16_t y = 0;
+
+  while (y * y < x) {
+    y += 1;
+  }
+
+  return y;
+}
+
+static uint16_t ref_payload_interleaving(const uint8_t *data_in, uint16_t data_in_bitcount, uint8_t *data_out,
+                                         uint32_t output_offset)
+{
+  uint16_t step = ref_sqrt_uint16(data_in_bitcount);
+  const uint16_t step_v = step >> 1;
+  step = step << 1;
+
+  uint16_t pos = 0;
+  uint16_t st_idx = 0;
+  uint16_t st_idx_init = 0;
+  int16_t bits_left = data_in_bitcount;
+  uint16_t out_row_index = output_offset;
+
+  while (bits_left > 0) {
+    int16_t in_row_width = bits_left;
+    if (in_row_width > LR_FHSS_FRAG_BITS) {
+      in_row_width = LR_FHSS_FRAG_BITS;
+    }
+
+    lr_fhss_set_bit_in_byte_vector(data_out, 0 + out_row_index, 0);  // guard bits
+    lr_fhss_set_bit_in_byte_vector(data_out, 1 + out_row_index, 0);  // guard bits
+    for (int32_t j = 0; j < in_row_width; j++) {
+      lr_fhss_set_bit_in_byte_vector(data_out, j + 2 + out_row_index,
+                                     lr_fhss_extract_bit_in_byte_vector(data_in, pos));
+
+      pos += step;
+      if (pos >= data_in_bitcount) {
+        st_idx += step_v;
+        if (st_idx >= step) {
+          st_idx_init++;
+          st_idx = st_idx_init;
+        }
+        pos = st_idx;
+      }
+    }
+
+    bits_left -= LR_FHSS_FRAG_BITS;
+    out_row_index += 2 + in_row_width;
+  }
+
+  return out_row_index - output_offset;
+}
+
+static uint16_t ref_build_frame(const lr_fhss_v1_params_t *params, uint16_t hop_sequence_id, const uint8_t *data_in,
+                                uint16_t data_in_bytecount, uint8_t *data_out)
+{
+  uint8_t data_out_tmp[LR_FHSS_MAX_TMP_BUF_BYTES] = { 0 };
+  uint8_t encode_state = 0;
+
+  lr_fhss_payload_whitening(data_in, data_in_bytecount, data_out);
+  uint16_t payload_crc = lr_fhss_payload_crc16(data_out, data_in_bytecount);
+
+  data_out[data_in_bytecount] = (payload_crc >> 8) & 0xFF;
+  data_out[data_in_bytecount + 1] = payload_crc & 0xFF;
+  data_out[data_in_bytecount + 2] = 0;
+
+  uint16_t nb_bits = ref_viterbi_1_3_base(&encode_state, data_out, 8 * (data_in_bytecount + 2) + 6, data_out_tmp);
+
+  memset(data_out, 0, LR_FHSS_MAX_PHY_PAYLOAD_BYTES);
+
+  if (params->cr != LR_FHSS_V1_CR_1_3) {
+    uint32_t matrix_index = 0;
+    uint8_t matrix[15] = { 1, 1, 0, 0, 1, 0, 1, 0, 0, 0, 1, 0, 1, 0, 0 };
+    uint8_t matrix_len = params->cr == LR_FHSS_V1_CR_5_6 ? 15 : params->cr == LR_FHSS_V1_CR_2_3 ? 6 : 3;
+
+    uint32_t j = 0;
+    for (uint32_t i = 0; i < nb_bits; i++) {
+      if (matrix[matrix_index]) {
+        lr_fhss_set_bit_in_byte_vector(data_out, j++, lr_fhss_extract_bit_in_byte_vector(data_out_tmp, i));
+      }
+      if (++matrix_index == matrix_len) {
+        matrix_index = 0;
+      }
+    }
+    nb_bits = j;
+
+    memcpy(data_out_tmp, data_out, (nb_bits + 7) / 8);
+  }
+
+  nb_bits = ref_payload_interleaving(data_out_tmp, nb_bits, data_out, LR_FHSS_HEADER_BITS * params->header_count);
+
+  uint8_t raw_header[LR_FHSS_HALF_HDR_BYTES];
+  lr_fhss_raw_header(params, hop_sequence_id, data_in_bytecount, raw_header);
+
+  uint16_t header_offset = 0;
+  for (uint32_t i = 0; i < params->header_count; i++) {
+    lr_fhss_store_header_sync_word_index(params->header_count - i - 1, raw_header);
+    raw_header[4] = lr_fhss_header_crc8(raw_header, 4);
+
+    /* Tail-biting 1/2 rate encoding: run the encoder twice from state 0 */
+    uint8_t coded_header[LR_FHSS_HDR_BYTES] = { 0 };
+    encode_state = 0;
+    ref_viterbi_1_2_base(&encode_state, raw_header, LR_FHSS_HALF_HDR_BITS, coded_header);
+    ref_viterbi_1_2_base(&encode_state, raw_header, LR_FHSS_HALF_HDR_BITS, coded_header);
+
+    lr_fhss_set_bit_in_byte_vector(data_out, header_offset + 0, 0);
+    lr_fhss_set_bit_in_byte_vector(data_out, header_offset + 1, 0);
+
+    for (uint32_t j = 0; j < LR_FHSS_HALF_HDR_BITS; j++) {
+      uint8_t bit = lr_fhss_extract_bit_in_byte_vector(coded_header, lr_fhss_header_interleaver_minus_one[j]);
+      lr_fhss_set_bit_in_byte_vector(data_out, header_offset + 2 + j, bit);
+    }
+    for (uint32_t j = 0; j < LR_FHSS_HALF_HDR_BITS; j++) {
+      uint8_t bit = lr_fhss_extract_bit_in_byte_vector(coded_header,
+                                                       lr_fhss_header_interleaver_minus_one[LR_FHSS_HALF_HDR_BITS + j]);
+      lr_fhss_set_bit_in_byte_vector(data_out, header_offset + 2 + LR_FHSS_HALF_HDR_BITS + LR_FHSS_SYNC_WORD_BITS + j,
+                                     bit);
+    }
+
+    for (uint32_t j = 0; j < LR_FHSS_SYNC_WORD_BITS; j++) {
+      lr_fhss_set_bit_in_byte_vector(data_out, header_offset + 2 + LR_FHSS_HALF_HDR_BITS + j,
+                                     lr_fhss_extract_bit_in_byte_vector(params->sync_word, j));
+    }
+
+    header_offset += LR_FHSS_HEADER_BITS;
+  }
+
+  return (header_offset + nb_bits + 7) / 8;
+}
+
+/*
+ * Test driver
+ */
+static uint32_t rng_state;
+static unsigned failures;
+
+static uint32_t rng(void)
+{
+  /* xorshift32, so runs are reproducible from the seed */
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static void random_bytes(uint8_t *buf, size_t len)
+{
+  for (size_t i = 0; i < len; i++) {
+    buf[i] = (uint8_t)rng();
+  }
+}
+
+static void check(int ok, const char *what, unsigned a, unsigned b, unsigned c)
+{
+  if (!ok) {
+    if (failures < 20) {
+      printf("FAIL: %s (%u, %u, %u)\n", what, a, b, c);
+    }
+    failures++;
+  }
+}
+
+static void test_sqrt(void)
+{
+  for (uint32_t x = 0; x <= 0xFFFF; x++) {
+    check(sqrt_uint16(x) == ref_sqrt_uint16(x), "sqrt_uint16", x, 0, 0);
+  }
+}
+
+static void test_encoders(void)
+{
+  for (unsigned n = 0; n < 20000; n++) {
+    uint8_t in[64];
+    uint8_t out[3 * sizeof(in)], ref_out[3 * sizeof(in)];
+    uint16_t bitcount = rng() % (8 * sizeof(in) + 1);
+    uint8_t state = rng() % 16, ref_state = state;
+
+    random_bytes(in, sizeof(in));
+    random_bytes(out, sizeof(out));
+    memcpy(ref_out, out, sizeof(out));
+    uint16_t len = lr_fhss_convolution_encode_viterbi_1_2_base(&state, in, bitcount, out);
+    uint16_t ref_len = ref_viterbi_1_2_base(&ref_state, in, bitcount, ref_out);
+    check(len == ref_len && state == ref_state && memcmp(out, ref_out, sizeof(out)) == 0,
+          "viterbi 1/2", n, bitcount, 0);
+
+    state = rng() % 64;
+    ref_state = state;
+    random_bytes(out, sizeof(out));
+    memcpy(ref_out, out, sizeof(out));
+    len = lr_fhss_convolution_encode_viterbi_1_3_base(&state, in, bitcount, out);
+    ref_len = ref_viterbi_1_3_base(&ref_state, in, bitcount, ref_out);
+    check(len == ref_len && state == ref_state && memcmp(out, ref_out, sizeof(out)) == 0,
+          "viterbi 1/3", n, bitcount, 0);
+  }
+}
+
+static void test_interleaving(void)
+{
+  for (unsigned n = 0; n < 20000; n++) {
+    uint8_t in[LR_FHSS_MAX_TMP_BUF_BYTES];
+    uint8_t out[2 * LR_FHSS_MAX_TMP_BUF_BYTES], ref_out[2 * LR_FHSS_MAX_TMP_BUF_BYTES];
+    uint16_t bitcount = 1 + rng() % (8 * sizeof(in));
+    uint32_t offset = rng() % (4 * LR_FHSS_HEADER_BITS + 1);
+
+    random_bytes(in, sizeof(in));
+    /* Bits around the written range must be preserved, so start from garbage */
+    random_bytes(out, sizeof(out));
+    memcpy(ref_out, out, sizeof(out));
+    uint16_t len = lr_fhss_payload_interleaving(in, bitcount, out, offset);
+    uint16_t ref_len = ref_payload_interleaving(in, bitcount, ref_out, offset);
+    check(len == ref_len && memcmp(out, ref_out, sizeof(out)) == 0, "interleaving", n, bitcount, offset);
+  }
+}
+
+static void test_frames(void)
+{
+  static const lr_fhss_v1_cr_t crs[] = {
+    LR_FHSS_V1_CR_5_6, LR_FHSS_V1_CR_2_3, LR_FHSS_V1_CR_1_2, LR_FHSS_V1_CR_1_3
+  };
+  uint8_t sync_word[LR_FHSS_SYNC_WORD_BYTES];
+  unsigned frames = 0;
+
+  for (unsigned c = 0; c < sizeof(crs) / sizeof(crs[0]); c++) {
+    for (uint8_t header_count = 1; header_count <= 4; header_count++) {
+      for (unsigned grid = LR_FHSS_V1_GRID_25391_HZ; grid <= LR_FHSS_V1_GRID_3906_HZ; grid++) {
+        for (unsigned n = 0; n < RANDOM_FRAMES_PER_CONFIG; n++) {
+          lr_fhss_v1_params_t params = {
+            .sync_word = sync_word,
+            .modulation_type = LR_FHSS_V1_MODULATION_TYPE_GMSK_488,
+            .cr = crs[c],
+            .grid = (lr_fhss_v1_grid_t)grid,
+            .bw = (lr_fhss_v1_bw_t)(rng() % (LR_FHSS_V1_BW_1574219_HZ + 1)),
+            .enable_hopping = (rng() & 1) != 0,
+            .header_count = header_count,
+          };
+          uint8_t payload[LR_FHSS_MAX_PHY_PAYLOAD_BYTES];
+          uint8_t frame[LR_FHSS_MAX_PHY_PAYLOAD_BYTES], ref_frame[LR_FHSS_MAX_PHY_PAYLOAD_BYTES];
+          lr_fhss_digest_t digest;
+          uint16_t length;
+
+          /* Longest payload whose frame still fits, then a random length up to it */
+          for (length = 1; length < LR_FHSS_MAX_PHY_PAYLOAD_BYTES - 3; length++) {
+            lr_fhss_process_parameters(&params, length + 1, &digest);
+            if (digest.nb_bytes > LR_FHSS_MAX_PHY_PAYLOAD_BYTES) {
+              break;
+            }
+          }
+          length = 1 + rng() % length;
+
+          random_bytes(sync_word, sizeof(sync_word));
+          random_bytes(payload, length);
+          uint16_t hop_sequence_id = rng() % lr_fhss_get_hop_sequence_count(&params);
+
+          uint16_t size = lr_fhss_build_frame(&params, hop_sequence_id, payload, length, frame);
+          uint16_t ref_size = ref_build_frame(&params, hop_sequence_id, payload, length, ref_frame);
+          check(size == ref_size && memcmp(frame, ref_frame, sizeof(frame)) == 0,
+                "build_frame (cr, header count, length)", crs[c], header_count, length);
+          frames++;
+        }
+      }
+    }
+  }
+  printf("%u random frames compared\n", frames);
+}
+
+int main(int argc, char **argv)
+{
+  rng_state = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 0x2545F491;
+  if (rng_state == 0) {
+    rng_state = 1;
+  }
+  printf("test_lr_fhss: seed 0x%08x\n", (unsigned)rng_state);
+
+  test_sqrt();
+  test_encoders();
+  test_interleaving();
+  test_frames();
+
+  if (failures) {
+    printf("test_lr_fhss: %u failures\n", failures);
+    return 1;
+  }
+  printf("test_lr_fhss: passed\n");
+  return 0;
+}
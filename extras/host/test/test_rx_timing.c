@@ -0,0 +1,198 @@
+/**
+  ******************************************************************************
+  * @file    test_rx_timing.c
+  * @brief   Test of the Rx window sizing from the learned downlink timing
+  *
+  * Runs a simulated session of confirmed uplinks with the stack built with
+  * LORAMAC_RX_TIMING_LEARNING, the network server starting each downlink
+  * with some jitter: mostly within 0.5 ms, sometimes up to 6 ms, less than
+  * the default SystemMaxRxError. Checks that:
+  * - Every downlink starting within the spread of the downlinks received
+  *   since the last missed one is received, so the learned window never
+  *   gets shorter than the measured spread.
+  * - The learned windows get shorter than the first one, sized from
+  *   SystemMaxRxError.
+  *
+  * Usage: test_rx_timing [seed]
+  ******************************************************************************
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "LoRaMacInterfaces.h"
+#include "sim_clock.h"
+#include "sim_device.h"
+#include "sim_ns.h"
+#include "sim_radio.h"
+
+#if ( LORAMAC_RX_TIMING_LEARNING != 1 )
+#error "build with LORAMAC_RX_TIMING_LEARNING set to 1"
+#endif
+
+#define UPLINKS 300
+/* Most downlinks start within SMALL_JITTER of their expected time, one in LARGE_JITTER_PERIOD within LARGE_JITTER */
+#define SMALL_JITTER 500
+#define LARGE_JITTER 6000
+#define LARGE_JITTER_PERIOD 10
+
+static const uint8_t AppKey[16] = {
+  0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C
+};
+
+typedef struct {
+  bool pending;               /* A downlink was sent, its reception is not checked yet */
+  int32_t offset;             /* Start offset of that downlink, us */
+  uint32_t rx_frames;         /* Frames received by the device before that downlink */
+  unsigned received;          /* Downlinks received since the last missed one */
+  int32_t min_offset;         /* Earliest and latest start of these downlinks, us */
+  int32_t max_offset;
+  unsigned downlinks;
+  unsigned missed;
+  uint64_t first_window;      /* Rx1 window of the first data downlink, us */
+  uint64_t min_window;        /* Shortest Rx1 window of a received downlink, us */
+} timing_t;
+
+static uint32_t rng_state;
+static unsigned failures;
+static bool process_pending;
+
+static uint32_t rng(void)
+{
+  /* xorshift32, so runs are reproducible from the seed */
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static void check(int ok, const char *what, unsigned a, unsigned b, unsigned c)
+{
+  if (!ok) {
+    if (failures < 20) {
+      printf("FAIL: %s (%u, %u, %u)\n", what, a, b, c);
+    }
+    failures++;
+  }
+}
+
+/* Checks the reception of the last downlink, once the device is done with it */
+static void check_downlink(timing_t *t)
+{
+  SimRadioStats_t radio;
+  bool received;
+
+  if (!t->pending) {
+    return;
+  }
+  t->pending = false;
+  SimRadioGetStats(&radio);
+  received = radio.RxFrames > t->rx_frames;
+  if (t->received > 0 && t->offset >= t->min_offset && t->offset <= t->max_offset) {
+    check(received, "downlink within the measured spread missed (downlink, offset + 10 ms, spread)", t->downlinks,
+          (unsigned)(t->offset + 10000), (unsigned)(t->max_offset - t->min_offset));
+  }
+  if (!received) {
+    t->received = 0;
+    t->missed++;
+    return;
+  }
+  if (t->received == 0 || t->offset < t->min_offset) {
+    t->min_offset = t->offset;
+  }
+  if (t->received == 0 || t->offset > t->max_offset) {
+    t->max_offset = t->offset;
+  }
+  t->received++;
+  if (t->downlinks == 2) {
+    t->first_window = radio.RxWindow;
+  }
+  if (t->min_window == 0 || radio.RxWindow < t->min_window) {
+    t->min_window = radio.RxWindow;
+  }
+}
+
+static int32_t jitter(void *context)
+{
+  timing_t *t = context;
+  SimRadioStats_t radio;
+
+  check_downlink(t);
+  SimRadioGetStats(&radio);
+  t->pending = true;
+  t->rx_frames = radio.RxFrames;
+  t->downlinks++;
+  if (rng() % LARGE_JITTER_PERIOD == 0) {
+    t->offset = (int32_t)(rng() % (2 * LARGE_JITTER + 1)) - LARGE_JITTER;
+  } else {
+    t->offset = (int32_t)(rng() % (2 * SMALL_JITTER + 1)) - SMALL_JITTER;
+  }
+  return t->offset;
+}
+
+static void notify(void *context)
+{
+  (void)context;
+  process_pending = true;
+}
+
+int main(int argc, char **argv)
+{
+  static timing_t timing;
+  SimNsConfig_t ns = {
+    .NetId = 0x000013,
+    .Rssi = -80,
+    .Snr = 7,
+    .Jitter = jitter,
+    .JitterContext = &timing,
+  };
+  SimDeviceConfig_t device = {
+    .DevEui = { 0x00, 0x80, 0xE1, 0x15, 0x00, 0x00, 0x00, 0x01 },
+    .Region = LORAMAC_REGION_EU868,
+    .Datarate = DR_5,
+    .Uplinks = UPLINKS,
+    .PayloadSize = 12,
+    .Confirmed = true,
+    /* The radio detects a preamble in 4 symbols: no slack in the windows beyond the timing error */
+    .MinRxSymbols = 4,
+    .Notify = notify,
+  };
+  SimDeviceStats_t stats;
+  bool done;
+
+  rng_state = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 0x2545F491;
+  if (rng_state == 0) {
+    rng_state = 1;
+  }
+  printf("test_rx_timing: seed 0x%08x\n", (unsigned)rng_state);
+  device.Seed = rng_state;
+  memcpy(ns.AppKey, AppKey, sizeof(AppKey));
+  memcpy(device.AppKey, AppKey, sizeof(AppKey));
+
+  SimNsInit(&ns);
+  if (!SimDeviceInit(&device)) {
+    printf("test_rx_timing: the stack did not start\n");
+    return 1;
+  }
+  done = SimDeviceProcess();
+  while (!done && SimClockRunNext()) {
+    if (process_pending) {
+      process_pending = false;
+      done = SimDeviceProcess();
+    }
+  }
+  check_downlink(&timing);
+
+  SimDeviceGetStats(&stats);
+  check(done, "session not finished (uplinks done)", stats.UplinksDone, 0, 0);
+  check(timing.min_window < timing.first_window, "learned window not shorter (first, shortest window us)",
+        (unsigned)timing.first_window, (unsigned)timing.min_window, 0);
+  printf("%u downlinks, %u missed, Rx1 window of %u us at first, %u us at the shortest\n", timing.downlinks,
+         timing.missed, (unsigned)timing.first_window, (unsigned)timing.min_window);
+
+  if (failures) {
+    printf("test_rx_timing: %u failures\n", failures);
+    return 1;
+  }
+  printf("test_rx_timing: passed\n");
+  return 0;
+}
@@ -0,0 +1,177 @@
+/**
+  ******************************************************************************
+  * @file    test_sigfox.c
+  * @brief   Test of the Sigfox D-BPSK payload integration of radio.c
+  *
+  * Sends payloads with Radio.Send in MODEM_SIGFOX_TX over the simulated
+  * radio, and checks that the frame written to the radio is the one the
+  * original bit-at-a-time integration gives, and that the payload of the
+  * caller is left unchanged. The payloads are every byte value, after
+  * both integration states, then random chains of bytes.
+  *
+  * Usage: test_sigfox [seed]
+  ******************************************************************************
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "radio.h"
+#include "sim_air.h"
+#include "sim_clock.h"
+#include "timer.h"
+
+#if (RADIO_SIGFOX_ENABLE != 1)
+#error "build with RADIO_SIGFOX_ENABLE set to 1"
+#endif
+
+#define RANDOM_PAYLOADS 2000
+/* radio.c adds a byte to the payload */
+#define MAX_PAYLOAD 254
+
+typedef struct {
+  bool sent;
+  uint8_t size;
+  uint8_t payload[MAX_PAYLOAD + 1];
+} uplink_t;
+
+static uint32_t rng_state;
+static unsigned failures;
+
+static uint32_t rng(void)
+{
+  /* xorshift32, so runs are reproducible from the seed */
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static void check(int ok, const char *what, unsigned a, unsigned b, unsigned c)
+{
+  if (!ok) {
+    if (failures < 20) {
+      printf("FAIL: %s (%u, %u, %u)\n", what, a, b, c);
+    }
+    failures++;
+  }
+}
+
+/* The integration as radio.c did it before, on a copy of the input as the original inverted it in place */
+static void reference_integration(uint8_t *outBuffer, const uint8_t *payload, uint8_t size)
+{
+  uint8_t inBuffer[MAX_PAYLOAD];
+  uint8_t prevInt = 0;
+  uint8_t currBit;
+  uint8_t index_bit;
+  uint8_t index_byte;
+  uint8_t index_bit_out;
+  uint8_t index_byte_out;
+  int32_t i = 0;
+
+  for (i = 0; i < size; i++) {
+    /* reverse all inputs */
+    inBuffer[i] = ~payload[i];
+    /* init outBuffer */
+    outBuffer[i] = 0;
+  }
+
+  for (i = 0; i < (size * 8); i++) {
+    /* index to take bit in inBuffer */
+    index_bit = 7 - (i % 8);
+    index_byte = i / 8;
+    /* index to place bit in outBuffer is shifted 1 bit right */
+    index_bit_out = 7 - ((i + 1) % 8);
+    index_byte_out = (i + 1) / 8;
+    /* extract current bit from input */
+    currBit = (inBuffer[index_byte] >> index_bit) & 0x01;
+    /* integration */
+    prevInt ^= currBit;
+    /* write result integration in output */
+    outBuffer[index_byte_out] |= (prevInt << index_bit_out);
+  }
+
+  outBuffer[size] = (prevInt << 7) | (prevInt << 6) | (((!prevInt) & 0x01) << 5);
+}
+
+static void OnUplink(void *context, const SimFrame_t *frame)
+{
+  uplink_t *uplink = context;
+
+  uplink->sent = true;
+  uplink->size = frame->Size;
+  memcpy(uplink->payload, frame->Payload, frame->Size);
+}
+
+static void OnTxDone(void)
+{
+}
+
+static RadioEvents_t RadioEvents = {
+  .TxDone = OnTxDone,
+};
+
+static void check_payload(const uint8_t *payload, uint8_t size, uplink_t *uplink)
+{
+  uint8_t expected[MAX_PAYLOAD + 1];
+  uint8_t copy[MAX_PAYLOAD];
+
+  reference_integration(expected, payload, size);
+  memcpy(copy, payload, size);
+  uplink->sent = false;
+  Radio.Send(copy, size);
+  while (SimClockRunNext()) {
+  }
+  check(uplink->sent, "payload not sent (size, first byte)", size, payload[0], 0);
+  check(uplink->size == size + 1, "frame size (size, first byte)", size, payload[0], uplink->size);
+  check(memcmp(uplink->payload, expected, size + 1) == 0, "integrated payload (size, first byte, last byte)", size,
+        payload[0], payload[size - 1]);
+  check(memcmp(copy, payload, size) == 0, "payload of the caller changed (size, first byte)", size, payload[0], 0);
+}
+
+int main(int argc, char **argv)
+{
+  static uplink_t uplink;
+  uint8_t payload[MAX_PAYLOAD];
+  unsigned payloads = 0;
+
+  rng_state = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 0x2545F491;
+  if (rng_state == 0) {
+    rng_state = 1;
+  }
+  printf("test_sigfox: seed 0x%08x\n", (unsigned)rng_state);
+
+  UTIL_TIMER_Init(NULL);
+  Radio.Init(&RadioEvents);
+  SimAirSetGateway(OnUplink, &uplink);
+  Radio.SetTxConfig(MODEM_SIGFOX_TX, 14, 0, 0, 100, 0, 0, false, false, 0, 0, false, 4000);
+
+  /* Every byte alone, then after a byte leaving each integration state */
+  for (unsigned b = 0; b < 256; b++) {
+    payload[0] = (uint8_t)b;
+    check_payload(payload, 1, &uplink);
+    payload[0] = 0x00;
+    payload[1] = (uint8_t)b;
+    check_payload(payload, 2, &uplink);
+    payload[0] = 0x01;
+    check_payload(payload, 2, &uplink);
+    payloads += 3;
+  }
+  /* Chains of random bytes, up to the longest payload */
+  for (unsigned n = 0; n < RANDOM_PAYLOADS; n++) {
+    uint8_t size = (uint8_t)(1 + rng() % MAX_PAYLOAD);
+
+    for (unsigned i = 0; i < size; i++) {
+      payload[i] = (uint8_t)rng();
+    }
+    check_payload(payload, size, &uplink);
+    payloads++;
+  }
+  printf("%u payloads compared\n", payloads);
+
+  if (failures) {
+    printf("test_sigfox: %u failures\n", failures);
+    return 1;
+  }
+  printf("test_sigfox: passed\n");
+  return 0;
+}
@@ -0,0 +1,181 @@
+/**
+  ******************************************************************************
+  * @file    test_time_on_air.c
+  * @brief   Test of the uplink time on air of the regions
+  *
+  * Configures an uplink with RegionTxConfig for every region, uplink
+  * datarate and length from 0 to 255, sends it with radio.c over the
+  * simulated radio, and checks that the time on air the region returned
+  * is the one of the frame the radio sent, as Radio.TimeOnAir computes
+  * it from the modulation the region configured. The datarates and
+  * lengths are taken in a random order, so the time on air kept by
+  * RegionCommonGetTimeOnAir is both hit and replaced.
+  *
+  * Usage: test_time_on_air [seed]
+  ******************************************************************************
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "LoRaMac.h"
+#include "Region/Region.h"
+#include "radio.h"
+#include "sim_air.h"
+#include "sim_clock.h"
+
+#define MAX_DATARATES 16
+#define MAX_LENGTH 255
+
+typedef struct {
+  bool received;
+  uint64_t duration;
+} uplink_t;
+
+static uint32_t rng_state;
+static unsigned failures;
+
+static uint32_t rng(void)
+{
+  /* xorshift32, so runs are reproducible from the seed */
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static void check(int ok, const char *what, unsigned a, unsigned b, unsigned c)
+{
+  if (!ok) {
+    if (failures < 20) {
+      printf("FAIL: %s (%u, %u, %u)\n", what, a, b, c);
+    }
+    failures++;
+  }
+}
+
+/*
+ * The stack needs its primitives, which this test does not use
+ */
+static void McpsConfirm(McpsConfirm_t *confirm)
+{
+  (void)confirm;
+}
+
+static void McpsIndication(McpsIndication_t *indication, LoRaMacRxStatus_t *status)
+{
+  (void)indication;
+  (void)status;
+}
+
+static void MlmeConfirm(MlmeConfirm_t *confirm)
+{
+  (void)confirm;
+}
+
+static void MlmeIndication(MlmeIndication_t *indication, LoRaMacRxStatus_t *status)
+{
+  (void)indication;
+  (void)status;
+}
+
+static void MacProcessNotify(void)
+{
+}
+
+static LoRaMacPrimitives_t Primitives = {
+  .MacMcpsConfirm = McpsConfirm,
+  .MacMcpsIndication = McpsIndication,
+  .MacMlmeConfirm = MlmeConfirm,
+  .MacMlmeIndication = MlmeIndication,
+};
+
+static LoRaMacCallback_t Callbacks = {
+  .MacProcessNotify = MacProcessNotify,
+};
+
+static void OnUplink(void *context, const SimFrame_t *frame)
+{
+  uplink_t *uplink = context;
+
+  uplink->received = true;
+  uplink->duration = frame->End - frame->Start;
+}
+
+static void test_region(LoRaMacRegion_t region)
+{
+  static uint16_t configs[MAX_DATARATES * (MAX_LENGTH + 1)];
+  static uint8_t payload[MAX_LENGTH];
+  unsigned count = 0;
+  uplink_t uplink;
+
+  if (LoRaMacInitialization(&Primitives, &Callbacks, region) != LORAMAC_STATUS_OK) {
+    check(0, "region initialization (region)", region, 0, 0);
+    return;
+  }
+  SimAirSetGateway(OnUplink, &uplink);
+
+  for (int8_t dr = 0; dr < MAX_DATARATES; dr++) {
+    VerifyParams_t verify = { .DatarateParams = { .Datarate = dr, .UplinkDwellTime = 0 } };
+
+    if (RegionVerify(region, &verify, PHY_TX_DR)) {
+      for (unsigned length = 0; length <= MAX_LENGTH; length++) {
+        configs[count++] = (uint16_t)(dr << 8 | length);
+      }
+    }
+  }
+  /* Fisher-Yates shuffle */
+  for (unsigned i = count - 1; i > 0; i--) {
+    unsigned j = rng() % (i + 1);
+    uint16_t t = configs[i];
+
+    configs[i] = configs[j];
+    configs[j] = t;
+  }
+
+  for (unsigned i = 0; i < count; i++) {
+    TxConfigParams_t tx = {
+      .Channel = 0,
+      .Datarate = (int8_t)(configs[i] >> 8),
+      .TxPower = 0,
+      .MaxEirp = 16,
+      .AntennaGain = 2.15f,
+      .PktLen = configs[i] & 0xFF,
+    };
+    TimerTime_t timeOnAir = 0;
+    int8_t txPower;
+
+    if (!RegionTxConfig(region, &tx, &txPower, &timeOnAir)) {
+      check(0, "RegionTxConfig (region, datarate, length)", region, tx.Datarate, tx.PktLen);
+      continue;
+    }
+    uplink.received = false;
+    Radio.Send(payload, (uint8_t)tx.PktLen);
+    while (SimClockRunNext()) {
+    }
+    check(uplink.received, "uplink not sent (region, datarate, length)", region, tx.Datarate, tx.PktLen);
+    check(uplink.duration == (uint64_t)timeOnAir * 1000, "time on air (region, datarate, length)", region,
+          tx.Datarate, tx.PktLen);
+  }
+  printf("region %u: %u uplinks compared\n", (unsigned)region, count);
+}
+
+int main(int argc, char **argv)
+{
+  rng_state = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 0x2545F491;
+  if (rng_state == 0) {
+    rng_state = 1;
+  }
+  printf("test_time_on_air: seed 0x%08x\n", (unsigned)rng_state);
+
+  UTIL_TIMER_Init(NULL);
+  for (unsigned region = LORAMAC_REGION_AS923; region <= LORAMAC_REGION_RU864; region++) {
+    test_region((LoRaMacRegion_t)region);
+  }
+
+  if (failures) {
+    printf("test_time_on_air: %u failures\n", failures);
+    return 1;
+  }
+  printf("test_time_on_air: passed\n");
+  return 0;
+}
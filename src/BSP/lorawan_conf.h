@@ -127,6 +127,39 @@
   */
 #define DISABLE_LORAWAN_RX_WINDOW                       0
 
+/**
+  * \brief Size the ClassA receive windows from the timing error measured on the received downlinks
+  * \note  Per window and datarate, once a few downlinks were received, the windows cover the spread of
+  *        their measured start times plus a margin, instead of SystemMaxRxError (MIB_SYSTEM_MAX_RX_ERROR),
+  *        which remains the upper bound and the fallback value after an expected downlink was missed.
+  *        A downlink starting later or earlier than all the measured ones may be missed once.
+  *        Set to 1 to enable, 0 (the default) keeps the windows sized from SystemMaxRxError.
+  */
+#ifndef LORAMAC_RX_TIMING_LEARNING
+#define LORAMAC_RX_TIMING_LEARNING                      0
+#endif
+
+/**
+  * \brief Listen for ClassC downlinks with a receiver duty cycled on the downlink preamble (Radio.RxSniff)
+  * \note  Lowers the average ClassC reception current, the downlink latency being bounded by the
+  *        preamble length. Downlinks sent with a preamble shorter than the sniff period are missed,
+  *        so this is off by default and the receiver stays continuously on.
+  *        With the 8 symbols preamble of LoRaWAN downlinks, the receiver still listens 2 of every
+  *        6 symbols plus its wakeup time: the reception current drops about 3 times at SF12 and
+  *        less at higher datarates, not by an order of magnitude.
+  */
+#define LORAMAC_CLASSC_RX_SNIFF                         0
+
+/**
+  * \brief Track the link quality of each uplink channel and select the uplink channels accordingly
+  * \note  A channel whose expected downlinks are missed (e.g. because of a jammer) is selected less often,
+  *        but never excluded, the selection remaining random among the channels allowed by the duty cycle.
+  *        The channels are then no longer used equally, check that the regulations allow this.
+  *        US915 and AU915 (frequency hopping) always select uniformly and only track the link quality.
+  *        Set to 1 to enable, 0 (the default) keeps the uniform selection of the LoRaWAN specification.
+  */
+#define LORAMAC_CHANNEL_QUALITY                         0
+
 /* Exported macro ------------------------------------------------------------*/
 #ifndef CRITICAL_SECTION_BEGIN
   #define CRITICAL_SECTION_BEGIN( )      UTILS_ENTER_CRITICAL_SECTION( )
@@ -107,11 +107,38 @@
   #define DCDC_ENABLE                 ( 1UL )
 #endif
 
+/**
+  * @brief Keep a shadow copy of the last radio configuration written, so that
+  *        unchanged settings are not sent again over SUBGHZ SPI
+  * @note override the default configuration of radio_driver.c
+  */
+#ifndef RADIO_SHADOW_ENABLE
+  #define RADIO_SHADOW_ENABLE         ( 1UL )
+#endif
+
 /**
   * @brief disable the Sigfox radio modulation
   * @note enabled by default
   */
-#define RADIO_SIGFOX_ENABLE 0
+#ifndef RADIO_SIGFOX_ENABLE
+  #define RADIO_SIGFOX_ENABLE         ( 0UL )
+#endif
+
+/**
+  * @brief Number of LR-FHSS hop sequences kept precomputed, so an LR-FHSS
+  *        transmission does not need to generate its hop frequencies. The
+  *        sequence of a later transmission is computed while the current
+  *        one is on air. Each entry uses about 100 bytes of RAM.
+  * @note 2 by default when RADIO_LR_FHSS_IS_ON is 1, 0 disables the cache.
+  *       1 is not allowed.
+  */
+#ifndef WL_LR_FHSS_HOP_CACHE_SIZE
+  #if (RADIO_LR_FHSS_IS_ON == 1)
+    #define WL_LR_FHSS_HOP_CACHE_SIZE   ( 2 )
+  #else
+    #define WL_LR_FHSS_HOP_CACHE_SIZE   ( 0 )
+  #endif
+#endif
 
 /**
   * @brief disable the radio generic features
@@ -74,6 +74,21 @@
  */
 #define LORA_MAC_COMMAND_MAX_FOPTS_LENGTH           15
 
+/*!
+ * Pending event of LoRaMacProcess: radio IRQ events to handle
+ */
+#define LORAMAC_EVENT_RADIO                         0x00000001
+
+/*!
+ * Pending event of LoRaMacProcess: MAC timer or state event
+ */
+#define LORAMAC_EVENT_MAC                           0x00000002
+
+/*!
+ * Pending event of LoRaMacProcess: Class B event
+ */
+#define LORAMAC_EVENT_CLASSB                        0x00000004
+
 /*!
  * LoRaMac duty cycle for the back-off procedure during the first hour.
  */
@@ -99,6 +114,23 @@
  */
 #define ABP_JOIN_PENDING_DELAY_MS                   10
 
+/*!
+ * Number of datarates for which the Rx1 and Rx2 timing error is learned
+ */
+#define RX_TIMING_NB_DATARATES                      16
+
+/*!
+ * Margin added around the learned downlink start times [ms]. The uplink end and the downlink start
+ * are timestamped with a 1 ms resolution, as is the window start: each measured time may be 1 ms
+ * early, and the window may open 1 ms late.
+ */
+#define RX_TIMING_ERROR_MARGIN                      2
+
+/*!
+ * Number of downlinks received in a window before its learned timing is used
+ */
+#define RX_TIMING_MIN_DOWNLINKS                     4
+
 #if defined(__ICCARM__)
 #ifndef __NO_INIT
 #define __NO_INIT __no_init
@@ -145,6 +177,25 @@ typedef enum eLoRaMacRequestHandling
     LORAMAC_REQUEST_HANDLING_ON = !LORAMAC_REQUEST_HANDLING_OFF
 }LoRaMacRequestHandling_t;
 
+/*!
+ * Receive timing learned from the downlinks of a Rx window at a datarate
+ */
+typedef struct sRxTimingError
+{
+    /*!
+     * Number of downlinks received, SystemMaxRxError is used below RX_TIMING_MIN_DOWNLINKS
+     */
+    uint8_t NbDownlinks;
+    /*!
+     * Earliest start of the downlinks from their expected time [ms]
+     */
+    int8_t MinOffset;
+    /*!
+     * Latest start of the downlinks from their expected time [ms]
+     */
+    int8_t MaxOffset;
+}RxTimingError_t;
+
 typedef struct sLoRaMacCtx
 {
     /*!
@@ -167,6 +218,10 @@ typedef struct sLoRaMacCtx
      * Size of buffer containing the application data.
      */
     uint8_t AppDataSize;
+    /*!
+     * Incremented each time AppData is overwritten with a copied payload
+     */
+    uint32_t AppDataGeneration;
     /*!
      * Buffer containing the upper layer data.
      */
@@ -343,6 +398,31 @@ typedef struct sLoRaMacCtx
      * \remark Used for the BACKOFF_DC computation.
      */
     bool IsFirstJoinReqTx;
+    /*
+     * Events pending for LoRaMacProcess, LORAMAC_EVENT_* bits set by the
+     * radio, timer and Class B callbacks.
+     */
+    uint32_t PendingEvents;
+#if ( defined( LORAMAC_RX_TIMING_LEARNING ) && ( LORAMAC_RX_TIMING_LEARNING == 1 ) )
+    /*
+     * Receive timing learned for the Rx1 and Rx2 windows, per datarate.
+     *
+     * \remark Used to size the windows instead of SystemMaxRxError.
+     */
+    RxTimingError_t RxTimingError[2][RX_TIMING_NB_DATARATES];
+#endif /* LORAMAC_RX_TIMING_LEARNING == 1 */
+#if ( defined( LORAMAC_CHANNEL_QUALITY ) && ( LORAMAC_CHANNEL_QUALITY == 1 ) )
+    /*
+     * Link quality of the uplink channels.
+     *
+     * \remark Used to weight the channel selection.
+     */
+    LoRaMacChannelQuality_t ChannelsQuality[REGION_NVM_MAX_NB_CHANNELS];
+    /*
+     * Channel mask the link quality was tracked with.
+     */
+    uint16_t ChannelsQualityMask[REGION_NVM_CHANNELS_MASK_SIZE];
+#endif /* LORAMAC_CHANNEL_QUALITY == 1 */
 }LoRaMacCtx_t;
 
 /*!
@@ -639,6 +719,61 @@ static LoRaMacStatus_t PrepareFrame( LoRaMacHeader_t* macHdr, LoRaMacFrameCtrl_t
  */
 static LoRaMacStatus_t ScheduleTx( bool allowDelayedTx );
 
+/*!
+ * \brief Gets the receive timing error used to size a Rx1 or Rx2 window
+ *
+ * \param [in]  rxSlot       RX_SLOT_WIN_1 or RX_SLOT_WIN_2
+ * \param [in]  datarate     Window datarate
+ * \param [out] windowOffset Learned offset to add to the window offset [ms]
+ * \retval rxError           Half the learned spread plus margin, SystemMaxRxError when not learned [ms]
+ */
+static uint32_t GetRxTimingError( LoRaMacRxSlot_t rxSlot, int8_t datarate, int32_t* windowOffset );
+
+/*!
+ * \brief Learns the receive timing from the downlink just received in Rx1 or Rx2
+ */
+static void UpdateRxTimingError( void );
+
+/*!
+ * \brief Forgets the receive timing learned for the Rx1 and Rx2 windows of the last uplink
+ */
+static void ResetRxTimingError( void );
+
+#if ( ( defined( LORAMAC_RX_TIMING_LEARNING ) && ( LORAMAC_RX_TIMING_LEARNING == 1 ) ) || \
+      ( defined( LORAMAC_CHANNEL_QUALITY ) && ( LORAMAC_CHANNEL_QUALITY == 1 ) ) )
+/*!
+ * \brief Checks if the frame was received in a Class A Rx1 or Rx2 window opened after the last uplink
+ *
+ * \remark A Class C device also receives network initiated downlinks in the Rx2 slot,
+ *         these tell nothing about the timing or the channel of the uplink.
+ *
+ * \retval Returns true if the frame answers the last uplink
+ */
+static bool IsUplinkRxWindow( void );
+#endif
+
+/*!
+ * \brief Updates the link quality of the channel of the last uplink
+ *
+ * \param [in] received Set to true when a downlink was received in Rx1 or Rx2,
+ *                      to false when the expected one was missed
+ */
+static void UpdateChannelQuality( bool received );
+
+/*!
+ * \brief Forgets the link quality tracked for a channel, e.g. because it was redefined
+ *
+ * \param [in] channel Index of the channel
+ */
+static void ResetChannelQuality( uint8_t channel );
+
+#if ( defined( LORAMAC_CHANNEL_QUALITY ) && ( LORAMAC_CHANNEL_QUALITY == 1 ) )
+/*!
+ * \brief Forgets the link quality of the channels enabled or disabled since the last call
+ */
+static void SyncChannelsQualityMask( void );
+#endif /* LORAMAC_CHANNEL_QUALITY == 1 */
+
 /*!
  * \brief Secures the current processed frame ( TxMsg )
  * \param [in]    txDr      Data rate used for the transmission
@@ -820,8 +955,15 @@ static bool StopRetransmission( void );
 
 /*!
  * \brief Calls the MacProcessNotify callback to indicate that a LoRaMacProcess call is pending
+ *
+ * \param [in] events LORAMAC_EVENT_* bits to be handled by the call
+ */
+static void OnMacProcessNotify( uint32_t events );
+
+/*!
+ * \brief MacProcessNotify callback of the Class B module
  */
-static void OnMacProcessNotify( void );
+static void OnClassBProcessNotify( void );
 
 /*!
  * \brief Calls the callback to indicate that a context changed
@@ -962,18 +1104,20 @@ static RxDoneParams_t RxDoneParams;
 
 static void OnRadioTxDone( void )
 {
-    TxDoneParams.CurTime = TimerGetCurrentTime( );
-    MacCtx.LastTxSysTime = SysTimeGet( );
+    // End of Tx as timestamped by the radio at interrupt entry, so that interrupt
+    // and processing latency does not shift the Rx windows nor the DeviceTimeAns reference
+    TxDoneParams.CurTime = Radio.GetIrqTime( );
+    MacCtx.LastTxSysTime = SysTimeSub( SysTimeGet( ), SysTimeFromMs( TimerGetElapsedTime( TxDoneParams.CurTime ) ) );
 
     LoRaMacRadioEvents.Events.TxDone = 1;
 
-    OnMacProcessNotify( );
+    OnMacProcessNotify( LORAMAC_EVENT_RADIO );
     MW_LOG(TS_ON, VLEVEL_M, "MAC txDone\r\n" );
 }
 
 static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr )
 {
-    RxDoneParams.LastRxDone = TimerGetCurrentTime( );
+    RxDoneParams.LastRxDone = Radio.GetIrqTime( );
     RxDoneParams.Payload = payload;
     RxDoneParams.Size = size;
     RxDoneParams.Rssi = rssi;
@@ -984,7 +1128,7 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
     LoRaMacRadioEvents.Events.RxProcessPending = 1;
 #endif /* LORAMAC_VERSION */
 
-    OnMacProcessNotify( );
+    OnMacProcessNotify( LORAMAC_EVENT_RADIO );
     MW_LOG(TS_ON, VLEVEL_M, "MAC rxDone\r\n" );
 }
 
@@ -992,7 +1136,7 @@ static void OnRadioTxTimeout( void )
 {
     LoRaMacRadioEvents.Events.TxTimeout = 1;
 
-    OnMacProcessNotify( );
+    OnMacProcessNotify( LORAMAC_EVENT_RADIO );
     MW_LOG(TS_ON, VLEVEL_M, "MAC txTimeOut\r\n" );
 }
 
@@ -1000,14 +1144,14 @@ static void OnRadioRxError( void )
 {
     LoRaMacRadioEvents.Events.RxError = 1;
 
-    OnMacProcessNotify( );
+    OnMacProcessNotify( LORAMAC_EVENT_RADIO );
 }
 
 static void OnRadioRxTimeout( void )
 {
     LoRaMacRadioEvents.Events.RxTimeout = 1;
 
-    OnMacProcessNotify( );
+    OnMacProcessNotify( LORAMAC_EVENT_RADIO );
     MW_LOG(TS_ON, VLEVEL_M, "MAC rxTimeOut\r\n" );
 }
 
@@ -1120,6 +1264,11 @@ static void PrepareRxDoneAbort( void )
         OnRetransmitTimeoutTimerEvent( NULL );
 #endif /* LORAMAC_VERSION */
     }
+    else if( LoRaMacConfirmQueueIsCmdActive( MLME_JOIN ) == true )
+    {
+        // The frame is not the join accept, and no window follows it: the join failed
+        LoRaMacConfirmQueueSetStatus( LORAMAC_EVENT_INFO_STATUS_JOIN_FAIL, MLME_JOIN );
+    }
 
     MacCtx.MacFlags.Bits.McpsInd = 1;
     MacCtx.MacFlags.Bits.MacDone = 1;
@@ -1315,6 +1464,8 @@ static void ProcessRadioRxDone( void )
             if( ( LORAMAC_CRYPTO_SUCCESS == macCryptoStatus ) && ( rxDrValid == true ) )
             {
 #endif
+                UpdateRxTimingError( );
+                UpdateChannelQuality( true );
 
                 // Network ID
                 Nvm.MacGroup2.NetID = ( uint32_t ) macMsgJoinAccept.NetID[0];
@@ -1625,6 +1776,9 @@ static void ProcessRadioRxDone( void )
             MacCtx.McpsConfirm.Status = LORAMAC_EVENT_INFO_STATUS_OK;
             MacCtx.McpsConfirm.AckReceived = macMsgData.FHDR.FCtrl.Bits.Ack;
 
+            UpdateRxTimingError( );
+            UpdateChannelQuality( true );
+
             // Reset ADR ACK Counter only, when RX1 or RX2 slot
             if( ( MacCtx.RxStatus.RxSlot == RX_SLOT_WIN_1 ) ||
                 ( MacCtx.RxStatus.RxSlot == RX_SLOT_WIN_2 ) )
@@ -1914,6 +2068,14 @@ static void HandleRadioRxErrorTimeout( LoRaMacEventInfoStatus_t rx1EventInfoStat
             }
             LoRaMacConfirmQueueSetStatusCmn( rx2EventInfoStatus );
 
+            if( ( MacCtx.RxSlot == RX_SLOT_WIN_2 ) &&
+                ( ( MacCtx.NodeAckRequested == true ) || ( MacCtx.TxMsg.Type != LORAMAC_MSG_TYPE_DATA ) ) )
+            {
+                // The expected answer was missed in both windows
+                ResetRxTimingError( );
+                UpdateChannelQuality( false );
+            }
+
 #if (defined( LORAMAC_VERSION ) && ( LORAMAC_VERSION == 0x01000300 ))
             if( Nvm.MacGroup2.DeviceClass != CLASS_C )
             {
@@ -2345,9 +2507,23 @@ static bool LoRaMacHandleResponseTimeout( TimerTime_t timeoutInMs, TimerTime_t s
 void LoRaMacProcess( void )
 {
     uint8_t noTx = false;
+    uint32_t events;
 
-    LoRaMacHandleIrqEvents( );
-    LoRaMacClassBProcess( );
+    CRITICAL_SECTION_BEGIN( );
+    events = MacCtx.PendingEvents;
+    MacCtx.PendingEvents = 0;
+    CRITICAL_SECTION_END( );
+
+    // The radio IRQ and Class B handlers only run on their events, the flag
+    // driven handlers below check their own flags
+    if( ( events & LORAMAC_EVENT_RADIO ) != 0 )
+    {
+        LoRaMacHandleIrqEvents( );
+    }
+    if( ( events & LORAMAC_EVENT_CLASSB ) != 0 )
+    {
+        LoRaMacClassBProcess( );
+    }
 
     // MAC proceeded a state and is ready to check
     if( MacCtx.MacFlags.Bits.MacDone == 1 )
@@ -2472,7 +2648,7 @@ static void OnAckTimeoutTimerEvent( void* context )
     {
         MacCtx.MacFlags.Bits.MacDone = 1;
     }
-    OnMacProcessNotify( );
+    OnMacProcessNotify( LORAMAC_EVENT_MAC );
 }
 
 static LoRaMacCryptoStatus_t GetFCntDown( AddressIdentifier_t addrID, FType_t fType, LoRaMacMessageData_t* macMsg, Version_t lrWanVersion,
@@ -2539,7 +2715,7 @@ static void OnRetransmitTimeoutTimerEvent( void* context )
     {
         MacCtx.RetransmitTimeoutRetry = true;
     }
-    OnMacProcessNotify( );
+    OnMacProcessNotify( LORAMAC_EVENT_MAC );
 }
 
 static LoRaMacCryptoStatus_t GetFCntDown( AddressIdentifier_t addrID, FType_t fType, LoRaMacMessageData_t* macMsg, Version_t lrWanVersion,
@@ -2999,6 +3175,11 @@ static void ProcessMacCommands( uint8_t *payload, uint8_t macIndex, uint8_t comm
 
                 if( ( int8_t )status >= 0 )
                 {
+                    if( ( status & 0x03 ) == 0x03 )
+                    {
+                        // The channel was redefined
+                        ResetChannelQuality( newChannelReq.ChannelId );
+                    }
                     macCmdPayload[0] = status;
                     LoRaMacCommandsAddCmd( MOTE_MAC_NEW_CHANNEL_ANS, macCmdPayload, 1 );
                 }
@@ -3087,6 +3268,11 @@ static void ProcessMacCommands( uint8_t *payload, uint8_t macIndex, uint8_t comm
 
                 if( ( int8_t )status >= 0 )
                 {
+                    if( ( status & 0x03 ) == 0x03 )
+                    {
+                        // The downlink of the channel was redefined
+                        ResetChannelQuality( dlChannelReq.ChannelId );
+                    }
                     macCmdPayload[0] = status;
                     LoRaMacCommandsAddCmd( MOTE_MAC_DL_CHANNEL_ANS, macCmdPayload, 1 );
                 }
@@ -3521,23 +3707,214 @@ static LoRaMacStatus_t CheckForClassBCollision( void )
     return LORAMAC_STATUS_OK;
 }
 
+static uint32_t GetRxTimingError( LoRaMacRxSlot_t rxSlot, int8_t datarate, int32_t* windowOffset )
+{
+    *windowOffset = 0;
+#if ( defined( LORAMAC_RX_TIMING_LEARNING ) && ( LORAMAC_RX_TIMING_LEARNING == 1 ) )
+    if( ( datarate >= 0 ) && ( datarate < RX_TIMING_NB_DATARATES ) )
+    {
+        RxTimingError_t* timing = &MacCtx.RxTimingError[( rxSlot == RX_SLOT_WIN_1 ) ? 0 : 1][datarate];
+
+        if( timing->NbDownlinks >= RX_TIMING_MIN_DOWNLINKS )
+        {
+            // Center the window on the measured start times, and cover all of them
+            int32_t spread = ( int32_t )timing->MaxOffset - timing->MinOffset;
+
+            *windowOffset = timing->MinOffset + ( spread / 2 );
+            return MIN( ( uint32_t )( spread - ( spread / 2 ) ) + RX_TIMING_ERROR_MARGIN,
+                        Nvm.MacGroup2.MacParams.SystemMaxRxError );
+        }
+    }
+#endif /* LORAMAC_RX_TIMING_LEARNING == 1 */
+    return Nvm.MacGroup2.MacParams.SystemMaxRxError;
+}
+
+#if ( ( defined( LORAMAC_RX_TIMING_LEARNING ) && ( LORAMAC_RX_TIMING_LEARNING == 1 ) ) || \
+      ( defined( LORAMAC_CHANNEL_QUALITY ) && ( LORAMAC_CHANNEL_QUALITY == 1 ) ) )
+static bool IsUplinkRxWindow( void )
+{
+    if( ( MacCtx.RxStatus.RxSlot != RX_SLOT_WIN_1 ) && ( MacCtx.RxStatus.RxSlot != RX_SLOT_WIN_2 ) )
+    {
+        return false;
+    }
+    if( ( MacCtx.RxStatus.RxSlot == RX_SLOT_WIN_2 ) && ( Nvm.MacGroup2.DeviceClass == CLASS_C ) )
+    {
+        return false;
+    }
+    return ( MacCtx.McpsIndication.Multicast == 0 );
+}
+#endif
+
+static void UpdateRxTimingError( void )
+{
+#if ( defined( LORAMAC_RX_TIMING_LEARNING ) && ( LORAMAC_RX_TIMING_LEARNING == 1 ) )
+    RxConfigParams_t* rxConfig = &MacCtx.RxWindow1Config;
+    RxTimingError_t* timing;
+    uint32_t rxDelay;
+    int32_t error;
+
+    if( IsUplinkRxWindow( ) == false )
+    {
+        return;
+    }
+    if( MacCtx.RxStatus.RxSlot == RX_SLOT_WIN_1 )
+    {
+        rxDelay = ( MacCtx.TxMsg.Type == LORAMAC_MSG_TYPE_DATA ) ? Nvm.MacGroup2.MacParams.ReceiveDelay1 :
+                                                                   Nvm.MacGroup2.MacParams.JoinAcceptDelay1;
+    }
+    else if( MacCtx.RxStatus.RxSlot == RX_SLOT_WIN_2 )
+    {
+        rxConfig = &MacCtx.RxWindow2Config;
+        rxDelay = ( MacCtx.TxMsg.Type == LORAMAC_MSG_TYPE_DATA ) ? Nvm.MacGroup2.MacParams.ReceiveDelay2 :
+                                                                   Nvm.MacGroup2.MacParams.JoinAcceptDelay2;
+    }
+    else
+    {
+        return;
+    }
+    if( ( rxConfig->Datarate < 0 ) || ( rxConfig->Datarate >= RX_TIMING_NB_DATARATES ) )
+    {
+        return;
+    }
+    timing = &MacCtx.RxTimingError[( MacCtx.RxStatus.RxSlot == RX_SLOT_WIN_1 ) ? 0 : 1][rxConfig->Datarate];
+
+    // The network starts the downlink exactly rxDelay after the end of the uplink
+    error = ( int32_t )( Radio.GetRxPacketStartTime( ) - TxDoneParams.CurTime - rxDelay );
+    error = MAX( MIN( error, INT8_MAX ), INT8_MIN );
+
+    // The window never gets shorter than the spread of the start times measured since the last miss
+    if( ( timing->NbDownlinks == 0 ) || ( error < timing->MinOffset ) )
+    {
+        timing->MinOffset = ( int8_t )error;
+    }
+    if( ( timing->NbDownlinks == 0 ) || ( error > timing->MaxOffset ) )
+    {
+        timing->MaxOffset = ( int8_t )error;
+    }
+    if( timing->NbDownlinks < UINT8_MAX )
+    {
+        timing->NbDownlinks++;
+    }
+#endif /* LORAMAC_RX_TIMING_LEARNING == 1 */
+}
+
+static void ResetRxTimingError( void )
+{
+#if ( defined( LORAMAC_RX_TIMING_LEARNING ) && ( LORAMAC_RX_TIMING_LEARNING == 1 ) )
+    if( ( MacCtx.RxWindow1Config.Datarate >= 0 ) && ( MacCtx.RxWindow1Config.Datarate < RX_TIMING_NB_DATARATES ) )
+    {
+        MacCtx.RxTimingError[0][MacCtx.RxWindow1Config.Datarate].NbDownlinks = 0;
+    }
+    if( ( MacCtx.RxWindow2Config.Datarate >= 0 ) && ( MacCtx.RxWindow2Config.Datarate < RX_TIMING_NB_DATARATES ) )
+    {
+        MacCtx.RxTimingError[1][MacCtx.RxWindow2Config.Datarate].NbDownlinks = 0;
+    }
+#endif /* LORAMAC_RX_TIMING_LEARNING == 1 */
+}
+
+static void UpdateChannelQuality( bool received )
+{
+#if ( defined( LORAMAC_CHANNEL_QUALITY ) && ( LORAMAC_CHANNEL_QUALITY == 1 ) )
+    LoRaMacChannelQuality_t* quality;
+
+    if( ( MacCtx.Channel >= REGION_NVM_MAX_NB_CHANNELS ) ||
+        ( ( received == true ) && ( IsUplinkRxWindow( ) == false ) ) )
+    {
+        return;
+    }
+    quality = &MacCtx.ChannelsQuality[MacCtx.Channel];
+
+    // Exponential decay, the last uplinks weighting a quarter
+    if( received == true )
+    {
+        if( quality->NbReceived == 0 )
+        {
+            quality->Rssi = MacCtx.RxStatus.Rssi;
+            quality->Snr = MacCtx.RxStatus.Snr;
+        }
+        else
+        {
+            quality->Rssi = ( int16_t )( quality->Rssi + ( MacCtx.RxStatus.Rssi - quality->Rssi ) / 4 );
+            quality->Snr = ( int8_t )( quality->Snr + ( MacCtx.RxStatus.Snr - quality->Snr ) / 4 );
+        }
+        quality->Weight = ( uint8_t )( quality->Weight + ( UINT8_MAX - quality->Weight + 3 ) / 4 );
+        if( quality->NbReceived < UINT16_MAX )
+        {
+            quality->NbReceived++;
+        }
+    }
+    else
+    {
+        quality->Weight = ( uint8_t )( quality->Weight - quality->Weight / 4 );
+        if( quality->NbMissed < UINT16_MAX )
+        {
+            quality->NbMissed++;
+        }
+    }
+#endif /* LORAMAC_CHANNEL_QUALITY == 1 */
+}
+
+static void ResetChannelQuality( uint8_t channel )
+{
+#if ( defined( LORAMAC_CHANNEL_QUALITY ) && ( LORAMAC_CHANNEL_QUALITY == 1 ) )
+    if( channel < REGION_NVM_MAX_NB_CHANNELS )
+    {
+        memset1( ( uint8_t* )&MacCtx.ChannelsQuality[channel], 0, sizeof( LoRaMacChannelQuality_t ) );
+        // Until proven otherwise, the channel is good
+        MacCtx.ChannelsQuality[channel].Weight = UINT8_MAX;
+    }
+#endif /* LORAMAC_CHANNEL_QUALITY == 1 */
+}
+
+#if ( defined( LORAMAC_CHANNEL_QUALITY ) && ( LORAMAC_CHANNEL_QUALITY == 1 ) )
+static void SyncChannelsQualityMask( void )
+{
+    GetPhyParams_t getPhy;
+    PhyParam_t phyParam;
+    uint16_t changed;
+
+    getPhy.Attribute = PHY_CHANNELS_MASK;
+    phyParam = RegionGetPhyParam( Nvm.MacGroup2.Region, &getPhy );
+
+    for( uint8_t i = 0; i < REGION_NVM_CHANNELS_MASK_SIZE; i++ )
+    {
+        changed = phyParam.ChannelsMask[i] ^ MacCtx.ChannelsQualityMask[i];
+        for( uint8_t j = 0; j < 16; j++ )
+        {
+            if( ( changed & ( 1 << j ) ) != 0 )
+            {
+                ResetChannelQuality( ( i * 16 ) + j );
+            }
+        }
+        MacCtx.ChannelsQualityMask[i] = phyParam.ChannelsMask[i];
+    }
+}
+#endif /* LORAMAC_CHANNEL_QUALITY == 1 */
+
 static void ComputeRxWindowParameters( void )
 {
+    int8_t rx1Datarate = RegionApplyDrOffset( Nvm.MacGroup2.Region,
+                                              Nvm.MacGroup2.MacParams.DownlinkDwellTime,
+                                              Nvm.MacGroup1.ChannelsDatarate,
+                                              Nvm.MacGroup2.MacParams.Rx1DrOffset );
+    int32_t rx1Offset = 0;
+    int32_t rx2Offset = 0;
+
     // Compute Rx1 windows parameters
     RegionComputeRxWindowParameters( Nvm.MacGroup2.Region,
-                                     RegionApplyDrOffset( Nvm.MacGroup2.Region,
-                                                          Nvm.MacGroup2.MacParams.DownlinkDwellTime,
-                                                          Nvm.MacGroup1.ChannelsDatarate,
-                                                          Nvm.MacGroup2.MacParams.Rx1DrOffset ),
+                                     rx1Datarate,
                                      Nvm.MacGroup2.MacParams.MinRxSymbols,
-                                     Nvm.MacGroup2.MacParams.SystemMaxRxError,
+                                     GetRxTimingError( RX_SLOT_WIN_1, rx1Datarate, &rx1Offset ),
                                      &MacCtx.RxWindow1Config );
     // Compute Rx2 windows parameters
     RegionComputeRxWindowParameters( Nvm.MacGroup2.Region,
                                      Nvm.MacGroup2.MacParams.Rx2Channel.Datarate,
                                      Nvm.MacGroup2.MacParams.MinRxSymbols,
-                                     Nvm.MacGroup2.MacParams.SystemMaxRxError,
+                                     GetRxTimingError( RX_SLOT_WIN_2, Nvm.MacGroup2.MacParams.Rx2Channel.Datarate, &rx2Offset ),
                                      &MacCtx.RxWindow2Config );
+    // Center the windows on the learned downlinks start
+    MacCtx.RxWindow1Config.WindowOffset += rx1Offset;
+    MacCtx.RxWindow2Config.WindowOffset += rx2Offset;
 
     // Default setup, in case the device joined
     MacCtx.RxWindow1Delay = Nvm.MacGroup2.MacParams.ReceiveDelay1 + MacCtx.RxWindow1Config.WindowOffset;
@@ -3647,6 +4024,13 @@ static LoRaMacStatus_t ScheduleTx( bool allowDelayedTx )
     nextChan.LastTxIsJoinRequest = false;
     nextChan.Joined = true;
     nextChan.PktLen = MacCtx.PktBufferLen;
+#if ( defined( LORAMAC_CHANNEL_QUALITY ) && ( LORAMAC_CHANNEL_QUALITY == 1 ) )
+    // A channel enabled or disabled by a channel mask (LinkAdrReq, CFList, MIB) starts afresh
+    SyncChannelsQualityMask( );
+    nextChan.ChannelsQuality = MacCtx.ChannelsQuality;
+#else
+    nextChan.ChannelsQuality = NULL;
+#endif /* LORAMAC_CHANNEL_QUALITY == 1 */
 
     // Setup the parameters based on the join status
     if( Nvm.MacGroup2.NetworkActivation == ACTIVATION_TYPE_NONE )
@@ -3884,7 +4268,7 @@ static void ResetMacParameters( bool isRejoin )
     if( MacCtx.MacCallbacks != NULL )
     {
         classBCallbacks.GetTemperatureLevel = MacCtx.MacCallbacks->GetTemperatureLevel;
-        classBCallbacks.MacProcessNotify = MacCtx.MacCallbacks->MacProcessNotify;
+        classBCallbacks.MacProcessNotify = OnClassBProcessNotify;
     }
 
     // Must all be static. Don't use local references.
@@ -3960,7 +4344,11 @@ static void OpenContinuousRxCWindow( void )
     if( RegionRxConfig( Nvm.MacGroup2.Region, &MacCtx.RxWindowCConfig, ( int8_t* )&MacCtx.McpsIndication.RxDatarate ) == true )
     {
         MacCtx.MlmeIndication.RxDatarate = MacCtx.McpsIndication.RxDatarate;
+#if ( defined( LORAMAC_CLASSC_RX_SNIFF ) && ( LORAMAC_CLASSC_RX_SNIFF == 1 ) )
+        Radio.RxSniff( ); // Continuous mode, duty cycled on the downlink preamble
+#else
         Radio.Rx( 0 ); // Continuous mode
+#endif /* LORAMAC_CLASSC_RX_SNIFF == 1 */
         MacCtx.RxSlot = MacCtx.RxWindowCConfig.RxSlot;
     }
 }
@@ -3978,7 +4366,12 @@ static LoRaMacStatus_t PrepareFrame( LoRaMacHeader_t* macHdr, LoRaMacFrameCtrl_t
         fBufferSize = 0;
     }
 
-    memcpy1( MacCtx.AppData, ( uint8_t* ) fBuffer, fBufferSize );
+    // The payload may have been serialized in place (LoRaMacGetTxPayloadBuffer)
+    if( fBuffer != MacCtx.AppData )
+    {
+        memcpy1( MacCtx.AppData, ( uint8_t* ) fBuffer, fBufferSize );
+        MacCtx.AppDataGeneration++;
+    }
     MacCtx.AppDataSize = fBufferSize;
     MacCtx.PktBuffer[0] = macHdr->Value;
 
@@ -4096,6 +4489,7 @@ static LoRaMacStatus_t SendFrameOnChannel( uint8_t channel )
     MacCtx.McpsConfirm.Datarate = Nvm.MacGroup1.ChannelsDatarate;
     MacCtx.McpsConfirm.TxPower = txPower;
     MacCtx.McpsConfirm.Channel = channel;
+    MacCtx.MlmeConfirm.Channel = channel;
 
     // Store the time on air
     MacCtx.McpsConfirm.TxTimeOnAir = MacCtx.TxTimeOnAir;
@@ -4484,14 +4878,23 @@ static bool StopRetransmission( void )
     return true;
 }
 
-static void OnMacProcessNotify( void )
+static void OnMacProcessNotify( uint32_t events )
 {
+    CRITICAL_SECTION_BEGIN( );
+    MacCtx.PendingEvents |= events;
+    CRITICAL_SECTION_END( );
+
     if( ( MacCtx.MacCallbacks != NULL ) && ( MacCtx.MacCallbacks->MacProcessNotify != NULL ) )
     {
         MacCtx.MacCallbacks->MacProcessNotify( );
     }
 }
 
+static void OnClassBProcessNotify( void )
+{
+    OnMacProcessNotify( LORAMAC_EVENT_CLASSB );
+}
+
 static void CallNvmDataChangeCallback( uint16_t notifyFlags )
 {
     if( ( MacCtx.MacCallbacks != NULL ) && ( MacCtx.MacCallbacks->NvmDataChange  != NULL ) )
@@ -4586,6 +4989,10 @@ LoRaMacStatus_t LoRaMacInitialization( LoRaMacPrimitives_t* primitives, LoRaMacC
     Nvm.MacGroup2.Region = region;
     Nvm.MacGroup2.DeviceClass = CLASS_A;
     Nvm.MacGroup2.MacParams.RepeaterSupport = false;
+    for( uint8_t i = 0; i < REGION_NVM_MAX_NB_CHANNELS; i++ )
+    {
+        ResetChannelQuality( i );
+    }
 
     // Setup version
     Nvm.MacGroup2.Version.Value = LORAMAC_VERSION;
@@ -4777,6 +5184,11 @@ LoRaMacStatus_t LoRaMacStart( void )
 {
     MacCtx.MacState = LORAMAC_IDLE;
     UpdateRxSlotIdleState();
+    if( MacCtx.RxSlot == RX_SLOT_WIN_CLASS_C )
+    {
+        // The continuous RxC window is opened by LoRaMacProcess
+        OnMacProcessNotify( LORAMAC_EVENT_MAC );
+    }
     return LORAMAC_STATUS_OK;
 }
 
@@ -4900,6 +5312,34 @@ LoRaMacStatus_t LoRaMacQueryTxPossible( uint8_t size, LoRaMacTxInfo_t* txInfo )
     }
 }
 
+uint8_t* LoRaMacGetTxPayloadBuffer( void )
+{
+    if( LoRaMacIsBusy( ) == true )
+    {
+        return NULL;
+    }
+    return MacCtx.AppData;
+}
+
+uint32_t LoRaMacGetTxPayloadGeneration( void )
+{
+    return MacCtx.AppDataGeneration;
+}
+
+LoRaMacStatus_t LoRaMacGetChannelQuality( uint8_t channel, LoRaMacChannelQuality_t* quality )
+{
+#if ( defined( LORAMAC_CHANNEL_QUALITY ) && ( LORAMAC_CHANNEL_QUALITY == 1 ) )
+    if( ( quality == NULL ) || ( channel >= REGION_NVM_MAX_NB_CHANNELS ) )
+    {
+        return LORAMAC_STATUS_PARAMETER_INVALID;
+    }
+    *quality = MacCtx.ChannelsQuality[channel];
+    return LORAMAC_STATUS_OK;
+#else
+    return LORAMAC_STATUS_SERVICE_UNKNOWN;
+#endif /* LORAMAC_CHANNEL_QUALITY == 1 */
+}
+
 LoRaMacStatus_t LoRaMacMibGetRequestConfirm( MibRequestConfirm_t* mibGet )
 {
     LoRaMacStatus_t status = LORAMAC_STATUS_OK;
@@ -5984,6 +6424,7 @@ LoRaMacStatus_t LoRaMacMibSetRequestConfirm( MibRequestConfirm_t* mibSet )
 LoRaMacStatus_t LoRaMacChannelAdd( uint8_t id, ChannelParams_t params )
 {
     ChannelAddParams_t channelAdd;
+    LoRaMacStatus_t status;
 
     // Validate if the MAC is in a correct state
     if( ( MacCtx.MacState & LORAMAC_TX_RUNNING ) == LORAMAC_TX_RUNNING )
@@ -5996,7 +6437,12 @@ LoRaMacStatus_t LoRaMacChannelAdd( uint8_t id, ChannelParams_t params )
 
     channelAdd.NewChannel = &params;
     channelAdd.ChannelId = id;
-    return RegionChannelAdd( Nvm.MacGroup2.Region, &channelAdd );
+    status = RegionChannelAdd( Nvm.MacGroup2.Region, &channelAdd );
+    if( status == LORAMAC_STATUS_OK )
+    {
+        ResetChannelQuality( id );
+    }
+    return status;
 }
 
 LoRaMacStatus_t LoRaMacChannelRemove( uint8_t id )
@@ -6017,6 +6463,7 @@ LoRaMacStatus_t LoRaMacChannelRemove( uint8_t id )
     {
         return LORAMAC_STATUS_PARAMETER_INVALID;
     }
+    ResetChannelQuality( id );
     return LORAMAC_STATUS_OK;
 }
 
@@ -6178,7 +6625,7 @@ static void OnAbpJoinPendingTimerEvent( void *context )
 {
     MacCtx.MacState &= ~LORAMAC_ABP_JOIN_PENDING;
     MacCtx.MacFlags.Bits.MacDone = 1;
-    OnMacProcessNotify( );
+    OnMacProcessNotify( LORAMAC_EVENT_MAC );
 }
 
 /*!
@@ -6312,7 +6759,7 @@ LoRaMacStatus_t LoRaMacMlmeRequest( MlmeReq_t* mlmeRequest )
                 Nvm.MacGroup2.NetworkActivation = mlmeRequest->Req.Join.NetworkActivation;
                 queueElement.Status = LORAMAC_EVENT_INFO_STATUS_OK;
                 queueElement.ReadyToHandle = true;
-                OnMacProcessNotify( );
+                OnMacProcessNotify( LORAMAC_EVENT_MAC );
                 MacCtx.MacFlags.Bits.MacDone = 1;
 #if (defined( LORAMAC_VERSION ) && (( LORAMAC_VERSION == 0x01000400 ) || ( LORAMAC_VERSION == 0x01010100 )))
                 isAbpJoinPending = true;
@@ -6720,7 +7167,7 @@ static void OnRejoin0CycleTimerEvent( void* context )
     TimerStop( &MacCtx.Rejoin0CycleTimer );
     ConvertRejoinCycleTime( Nvm.MacGroup2.Rejoin0CycleInSec, &MacCtx.Rejoin0CycleTime );
 
-    OnMacProcessNotify( );
+    OnMacProcessNotify( LORAMAC_EVENT_MAC );
 
     Nvm.MacGroup2.IsRejoin0RequestQueued = true;
 
@@ -6733,7 +7180,7 @@ static void OnRejoin1CycleTimerEvent( void* context )
     TimerStop( &MacCtx.Rejoin1CycleTimer );
     ConvertRejoinCycleTime( Nvm.MacGroup2.Rejoin1CycleInSec, &MacCtx.Rejoin1CycleTime );
 
-    OnMacProcessNotify( );
+    OnMacProcessNotify( LORAMAC_EVENT_MAC );
 
     Nvm.MacGroup2.IsRejoin1RequestQueued = true;
 
@@ -6764,7 +7211,7 @@ static void OnForceRejoinReqCycleTimerEvent( void* context )
         TimerStart( &MacCtx.ForceRejoinReqCycleTimer );
     }
 
-    OnMacProcessNotify( );
+    OnMacProcessNotify( LORAMAC_EVENT_MAC );
 }
 #endif /* LORAMAC_VERSION */
 
@@ -6828,7 +7275,7 @@ void LoRaMacReset( void )
     MacCtx.ChannelsNbTransCounter = Nvm.MacGroup2.MacParams.ChannelsNbTrans;
 
     // Inform application layer
-    OnMacProcessNotify( );
+    OnMacProcessNotify( LORAMAC_EVENT_MAC );
 }
 
 #pragma GCC diagnostic pop
@@ -216,7 +216,9 @@ bool LoRaMacIsStopped( void );
 /*!
  * Processes the LoRaMac events.
  *
- * \remark This function must be called in the main loop.
+ * \remark This function must be called in the main loop. The radio IRQ and
+ *         Class B handlers only run when their events were notified through
+ *         MacProcessNotify since the previous call.
  */
 void LoRaMacProcess( void );
 
@@ -247,6 +249,49 @@ void LoRaMacProcess( void );
  */
 LoRaMacStatus_t LoRaMacQueryTxPossible( uint8_t size, LoRaMacTxInfo_t* txInfo );
 
+/*!
+ * \brief   Gets the buffer holding the application payload of the uplinks.
+ *
+ * \details The application may serialize the payload of the next uplink
+ *          directly into this buffer, and pass it as fBuffer to
+ *          \ref LoRaMacMcpsRequest, which then does not copy it. The buffer
+ *          is used by the MAC until the uplink is complete, so it is only
+ *          available while the MAC is not busy.
+ *
+ * \retval  Pointer to a buffer of LORAMAC_PHY_MAXPAYLOAD bytes, or NULL when
+ *          the MAC is busy.
+ */
+uint8_t* LoRaMacGetTxPayloadBuffer( void );
+
+/*!
+ * \brief   Gets the generation of the buffer returned by \ref LoRaMacGetTxPayloadBuffer.
+ *
+ * \details The generation changes each time an uplink copies its payload into
+ *          the buffer, so a payload serialized in place is known to be intact
+ *          while the generation is unchanged.
+ *
+ * \retval  Current generation of the buffer.
+ */
+uint32_t LoRaMacGetTxPayloadGeneration( void );
+
+/*!
+ * \brief   Gets the link quality tracked for an uplink channel.
+ *
+ * \details The quality is derived from the downlinks received or missed
+ *          after the uplinks on the channel, and weights the selection of
+ *          the uplink channels. Requires LORAMAC_CHANNEL_QUALITY.
+ *
+ * \param   [in] channel  - Channel index.
+ *
+ * \param   [out] quality - Link quality of the channel.
+ *
+ * \retval  LoRaMacStatus_t Status of the operation. Possible returns are:
+ *          \ref LORAMAC_STATUS_OK,
+ *          \ref LORAMAC_STATUS_PARAMETER_INVALID,
+ *          \ref LORAMAC_STATUS_SERVICE_UNKNOWN.
+ */
+LoRaMacStatus_t LoRaMacGetChannelQuality( uint8_t channel, LoRaMacChannelQuality_t* quality );
+
 /*!
  * \brief   LoRaMAC channel add service
  *
@@ -1799,6 +1799,10 @@ typedef struct sMlmeConfirm
      * The transmission time on air of the frame
      */
     TimerTime_t TxTimeOnAir;
+    /*!
+     * The uplink channel related to the frame
+     */
+    uint32_t Channel;
     /*!
      * Demodulation margin. Contains the link margin [dB] of the last
      * successfully received LinkCheckReq
@@ -2959,6 +2963,35 @@ typedef struct sLoRaMacTxInfo
     uint8_t CurrentPossiblePayloadSize;
 }LoRaMacTxInfo_t;
 
+/*!
+ * LoRaMAC link quality of an uplink channel
+ */
+typedef struct sLoRaMacChannelQuality
+{
+    /*!
+     * Selection weight of the channel, raised towards 255 when the downlinks
+     * following its uplinks are received, and lowered towards 0 when the
+     * expected ones are missed
+     */
+    uint8_t Weight;
+    /*!
+     * SNR of the downlinks received after uplinks on the channel, exponentially decayed
+     */
+    int8_t Snr;
+    /*!
+     * RSSI of the downlinks received after uplinks on the channel, exponentially decayed
+     */
+    int16_t Rssi;
+    /*!
+     * Number of downlinks received after uplinks on the channel
+     */
+    uint16_t NbReceived;
+    /*!
+     * Number of expected downlinks (acknowledgements, JoinAccepts) missed after uplinks on the channel
+     */
+    uint16_t NbMissed;
+}LoRaMacChannelQuality_t;
+
 /*!
  * LoRaMAC Status
  */
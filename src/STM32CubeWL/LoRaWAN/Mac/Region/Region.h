@@ -823,6 +823,10 @@ typedef struct sNextChanParams
      * Payload length of the next frame
      */
     uint16_t PktLen;
+    /*!
+     * Link quality of the channels, weighting their selection, or NULL for a uniform selection
+     */
+    const LoRaMacChannelQuality_t* ChannelsQuality;
 }NextChanParams_t;
 
 /*!
@@ -290,11 +290,11 @@ static TimerTime_t GetTimeOnAir( int8_t datarate, uint16_t pktLen )
 
     if( datarate == DR_7 )
     { // High Speed FSK channel
-        timeOnAir = Radio.TimeOnAir( MODEM_FSK, bandwidth, phyDr * 1000, 0, 5, false, pktLen, true );
+        timeOnAir = RegionCommonGetTimeOnAir( MODEM_FSK, bandwidth, phyDr * 1000, pktLen );
     }
     else
     {
-        timeOnAir = Radio.TimeOnAir( MODEM_LORA, bandwidth, phyDr, 1, 8, false, pktLen, true );
+        timeOnAir = RegionCommonGetTimeOnAir( MODEM_LORA, bandwidth, phyDr, pktLen );
     }
     return timeOnAir;
 }
@@ -1186,28 +1186,34 @@ LoRaMacStatus_t RegionAS923NextChannel( NextChanParams_t* nextChanParams, uint8_
 	( REGION_AS923_DEFAULT_CHANNEL_PLAN == CHANNEL_PLAN_GROUP_AS923_1_JP_CH24_CH38_LBT ) || \
       ( REGION_AS923_DEFAULT_CHANNEL_PLAN == CHANNEL_PLAN_GROUP_AS923_1_JP_CH33_CH61_LBT_DC ) )
         // Executes the LBT algorithm when operating in Japan
-        uint8_t channelNext = 0;
+        uint32_t lbtFrequencies[AS923_MAX_NB_CHANNELS];
+        uint8_t lbtChannels[AS923_MAX_NB_CHANNELS];
+        int32_t freeChannel = 0;
 
-        for( uint8_t  i = 0, j = randr( 0, nbEnabledChannels - 1 ); i < AS923_MAX_NB_CHANNELS; i++ )
+        // Enabled channels are sensed once each, in turn, starting from a randomly selected one
+        for( uint8_t  i = 0, j = RegionCommonSelectChannel( enabledChannels, nbEnabledChannels, nextChanParams->ChannelsQuality ); i < nbEnabledChannels; i++ )
         {
-            channelNext = enabledChannels[j];
+            lbtChannels[i] = enabledChannels[j];
+            lbtFrequencies[i] = RegionNvmGroup2->Channels[lbtChannels[i]].Frequency;
             j = ( j + 1 ) % nbEnabledChannels;
+        }
 
-            // Perform carrier sense for AS923_CARRIER_SENSE_TIME
-            // If the channel is free, we can stop the LBT mechanism
-            if( Radio.IsChannelFree( RegionNvmGroup2->Channels[channelNext].Frequency, AS923_LBT_RX_BANDWIDTH, RegionNvmGroup2->RssiFreeThreshold, RegionNvmGroup2->CarrierSenseTime ) == true )
-            {
-                // Free channel found
-                *channel = channelNext;
-                return LORAMAC_STATUS_OK;
-            }
+        // Perform carrier sense for AS923_CARRIER_SENSE_TIME on each channel, the radio being configured only once
+        // If a channel is free, we can stop the LBT mechanism
+        freeChannel = Radio.ScanChannels( lbtFrequencies, nbEnabledChannels, AS923_LBT_RX_BANDWIDTH,
+                                          RegionNvmGroup2->RssiFreeThreshold, RegionNvmGroup2->CarrierSenseTime, NULL );
+        if( freeChannel >= 0 )
+        {
+            // Free channel found
+            *channel = lbtChannels[freeChannel];
+            return LORAMAC_STATUS_OK;
         }
         // Even if one or more channels are available according to the channel plan, no free channel
         // was found during the LBT procedure.
         status = LORAMAC_STATUS_NO_FREE_CHANNEL_FOUND;
 #else
         // We found a valid channel
-        *channel = enabledChannels[randr( 0, nbEnabledChannels - 1 )];
+        *channel = enabledChannels[RegionCommonSelectChannel( enabledChannels, nbEnabledChannels, nextChanParams->ChannelsQuality )];
 #endif
     }
     else if( status == LORAMAC_STATUS_NO_CHANNEL_FOUND )
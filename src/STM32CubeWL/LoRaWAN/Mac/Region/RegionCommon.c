@@ -97,6 +97,29 @@
         ( ( N ) / ( D ) )                                                      \
     )
 
+#ifndef REGION_COMMON_TIME_ON_AIR_CACHE_SIZE
+/*!
+ * Number of uplink configurations whose time on air is kept by RegionCommonGetTimeOnAir
+ */
+#define REGION_COMMON_TIME_ON_AIR_CACHE_SIZE    4
+#endif
+
+/*!
+ * Time on air of an uplink configuration, as returned by Radio.TimeOnAir
+ */
+typedef struct sTimeOnAirCacheEntry
+{
+    uint32_t Bandwidth;
+    uint32_t Datarate;
+    TimerTime_t TimeOnAir;
+    uint16_t PktLen;
+    RadioModems_t Modem;
+    bool Valid;
+}TimeOnAirCacheEntry_t;
+
+static TimeOnAirCacheEntry_t TimeOnAirCache[REGION_COMMON_TIME_ON_AIR_CACHE_SIZE];
+static uint8_t TimeOnAirCacheNextEntry = 0;
+
 #ifdef MW_LOG_ENABLED
 static const char *EventRXSlotStrings[] = { "1", "2", "C", "Multi_C", "P", "Multi_P" };
 #endif
@@ -292,18 +315,39 @@ static uint16_t UpdateTimeCredits( Band_t* band, bool joined, bool dutyCycleEnab
 }
 #endif
 
-static uint8_t CountChannels( uint16_t mask, uint8_t nbBits )
+static uint8_t CountChannels( uint16_t mask )
 {
+#if defined( __GNUC__ )
+    return ( uint8_t )__builtin_popcount( mask );
+#else
     uint8_t nbActiveBits = 0;
 
-    for( uint8_t j = 0; j < nbBits; j++ )
+    for( ; mask != 0; mask &= mask - 1 )
     {
-        if( ( mask & ( 1 << j ) ) == ( 1 << j ) )
-        {
-            nbActiveBits++;
-        }
+        nbActiveBits++;
     }
     return nbActiveBits;
+#endif /* __GNUC__ */
+}
+
+/*!
+ * \brief Gets the index of the first enabled channel of a non zero channels mask word.
+ *
+ * \remark Used with mask &= mask - 1 to visit the enabled channels only.
+ */
+static uint8_t FirstChannel( uint16_t mask )
+{
+#if defined( __GNUC__ )
+    return ( uint8_t )__builtin_ctz( mask );
+#else
+    uint8_t j = 0;
+
+    while( ( mask & ( 1 << j ) ) == 0 )
+    {
+        j++;
+    }
+    return j;
+#endif /* __GNUC__ */
 }
 
 bool RegionCommonChanVerifyDr( uint8_t nbChannels, uint16_t* channelsMask, int8_t dr, int8_t minDr, int8_t maxDr, ChannelParams_t* channels )
@@ -315,16 +359,16 @@ bool RegionCommonChanVerifyDr( uint8_t nbChannels, uint16_t* channelsMask, int8_
 
     for( uint8_t i = 0, k = 0; i < nbChannels; i += 16, k++ )
     {
-        for( uint8_t j = 0; j < 16; j++ )
+        for( uint16_t mask = channelsMask[k]; mask != 0; mask &= mask - 1 )
         {
-            if( ( ( channelsMask[k] & ( 1 << j ) ) != 0 ) )
-            {// Check datarate validity for enabled channels
-                if( RegionCommonValueInRange( dr, ( channels[i + j].DrRange.Fields.Min & 0x0F ),
-                                                  ( channels[i + j].DrRange.Fields.Max & 0x0F ) ) == 1 )
-                {
-                    // At least 1 channel has been found we can return OK.
-                    return true;
-                }
+            uint8_t j = FirstChannel( mask );
+
+            // Check datarate validity for enabled channels
+            if( RegionCommonValueInRange( dr, ( channels[i + j].DrRange.Fields.Min & 0x0F ),
+                                              ( channels[i + j].DrRange.Fields.Max & 0x0F ) ) == 1 )
+            {
+                // At least 1 channel has been found we can return OK.
+                return true;
             }
         }
     }
@@ -366,7 +410,7 @@ uint8_t RegionCommonCountChannels( uint16_t* channelsMask, uint8_t startIdx, uin
 
     for( uint8_t i = startIdx; i < stopIdx; i++ )
     {
-        nbChannels += CountChannels( channelsMask[i], 16 );
+        nbChannels += CountChannels( channelsMask[i] );
     }
 
     return nbChannels;
@@ -616,6 +660,40 @@ uint32_t RegionCommonComputeSymbolTimeFsk( uint8_t phyDrInKbps )
     return 8000 / ( uint32_t )phyDrInKbps; // 1 symbol equals 1 byte
 }
 
+TimerTime_t RegionCommonGetTimeOnAir( RadioModems_t modem, uint32_t bandwidth, uint32_t datarate, uint16_t pktLen )
+{
+    TimeOnAirCacheEntry_t* entry;
+
+    for( uint8_t i = 0; i < REGION_COMMON_TIME_ON_AIR_CACHE_SIZE; i++ )
+    {
+        entry = &TimeOnAirCache[i];
+        if( ( entry->PktLen == pktLen ) && ( entry->Datarate == datarate ) &&
+            ( entry->Bandwidth == bandwidth ) && ( entry->Modem == modem ) && ( entry->Valid == true ) )
+        {
+            return entry->TimeOnAir;
+        }
+    }
+
+    // Not computed recently, replace the oldest entry
+    entry = &TimeOnAirCache[TimeOnAirCacheNextEntry];
+    TimeOnAirCacheNextEntry = ( TimeOnAirCacheNextEntry + 1 ) % REGION_COMMON_TIME_ON_AIR_CACHE_SIZE;
+
+    if( modem == MODEM_FSK )
+    {
+        entry->TimeOnAir = Radio.TimeOnAir( MODEM_FSK, bandwidth, datarate, 0, 5, false, pktLen, true );
+    }
+    else
+    {
+        entry->TimeOnAir = Radio.TimeOnAir( MODEM_LORA, bandwidth, datarate, 1, 8, false, pktLen, true );
+    }
+    entry->Modem = modem;
+    entry->Bandwidth = bandwidth;
+    entry->Datarate = datarate;
+    entry->PktLen = pktLen;
+    entry->Valid = true;
+    return entry->TimeOnAir;
+}
+
 void RegionCommonComputeRxWindowParameters( uint32_t tSymbolInUs, uint8_t minRxSymbols, uint32_t rxErrorInMs, uint32_t wakeUpTimeInMs, uint32_t* windowTimeoutInSymbols, int32_t* windowOffsetInMs )
 {
     *windowTimeoutInSymbols = MAX( DIV_CEIL( ( ( 2 * minRxSymbols - 8 ) * tSymbolInUs + 2 * ( rxErrorInMs * 1000 ) ),  tSymbolInUs ), minRxSymbols ); // Computed number of symbols
@@ -670,35 +748,35 @@ void RegionCommonCountNbOfEnabledChannels( RegionCommonCountNbOfEnabledChannelsP
 
     for( uint8_t i = 0, k = 0; i < countNbOfEnabledChannelsParams->MaxNbChannels; i += 16, k++ )
     {
-        for( uint8_t j = 0; j < 16; j++ )
+        uint16_t mask = countNbOfEnabledChannelsParams->ChannelsMask[k];
+
+        if( ( countNbOfEnabledChannelsParams->Joined == false ) &&
+            ( countNbOfEnabledChannelsParams->JoinChannels != NULL ) )
         {
-            if( ( countNbOfEnabledChannelsParams->ChannelsMask[k] & ( 1 << j ) ) != 0 )
-            {
-                if( countNbOfEnabledChannelsParams->Channels[i + j].Frequency == 0 )
-                { // Check if the channel is enabled
-                    continue;
-                }
-                if( ( countNbOfEnabledChannelsParams->Joined == false ) &&
-                    ( countNbOfEnabledChannelsParams->JoinChannels != NULL ) )
-                {
-                    if( ( countNbOfEnabledChannelsParams->JoinChannels[k] & ( 1 << j ) ) == 0 )
-                    {
-                        continue;
-                    }
-                }
-                if( RegionCommonValueInRange( countNbOfEnabledChannelsParams->Datarate,
-                                              countNbOfEnabledChannelsParams->Channels[i + j].DrRange.Fields.Min,
-                                              countNbOfEnabledChannelsParams->Channels[i + j].DrRange.Fields.Max ) == false )
-                { // Check if the current channel selection supports the given datarate
-                    continue;
-                }
-                if( countNbOfEnabledChannelsParams->Bands[countNbOfEnabledChannelsParams->Channels[i + j].Band].ReadyForTransmission == false )
-                { // Check if the band is available for transmission
-                    nbRestrictedChannelsCount++;
-                    continue;
-                }
-                enabledChannels[nbChannelCount++] = i + j;
+            mask &= countNbOfEnabledChannelsParams->JoinChannels[k];
+        }
+
+        // Visit the enabled channels only, most of the channels being disabled in the large channel plans
+        for( ; mask != 0; mask &= mask - 1 )
+        {
+            uint8_t j = FirstChannel( mask );
+
+            if( countNbOfEnabledChannelsParams->Channels[i + j].Frequency == 0 )
+            { // Check if the channel is enabled
+                continue;
+            }
+            if( RegionCommonValueInRange( countNbOfEnabledChannelsParams->Datarate,
+                                          countNbOfEnabledChannelsParams->Channels[i + j].DrRange.Fields.Min,
+                                          countNbOfEnabledChannelsParams->Channels[i + j].DrRange.Fields.Max ) == false )
+            { // Check if the current channel selection supports the given datarate
+                continue;
+            }
+            if( countNbOfEnabledChannelsParams->Bands[countNbOfEnabledChannelsParams->Channels[i + j].Band].ReadyForTransmission == false )
+            { // Check if the band is available for transmission
+                nbRestrictedChannelsCount++;
+                continue;
             }
+            enabledChannels[nbChannelCount++] = i + j;
         }
     }
     *nbEnabledChannels = nbChannelCount;
@@ -749,6 +827,35 @@ LoRaMacStatus_t RegionCommonIdentifyChannels( RegionCommonIdentifyChannelsParam_
     }
 }
 
+uint8_t RegionCommonSelectChannel( uint8_t* enabledChannels, uint8_t nbEnabledChannels,
+                                   const LoRaMacChannelQuality_t* channelsQuality )
+{
+    uint32_t totalWeight = 0;
+    int32_t weight;
+
+    if( channelsQuality == NULL )
+    {
+        return randr( 0, nbEnabledChannels - 1 );
+    }
+
+    for( uint8_t i = 0; i < nbEnabledChannels; i++ )
+    {
+        totalWeight += MAX( channelsQuality[enabledChannels[i]].Weight, REGION_COMMON_MIN_CHANNEL_WEIGHT );
+    }
+
+    // Draw a channel with a probability proportional to its weight
+    weight = randr( 0, totalWeight - 1 );
+    for( uint8_t i = 0; i < nbEnabledChannels; i++ )
+    {
+        weight -= MAX( channelsQuality[enabledChannels[i]].Weight, REGION_COMMON_MIN_CHANNEL_WEIGHT );
+        if( weight < 0 )
+        {
+            return i;
+        }
+    }
+    return nbEnabledChannels - 1;
+}
+
 int8_t RegionCommonGetNextLowerTxDr( RegionCommonGetNextLowerTxDrParams_t *params )
 {
     int8_t drLocal = params->CurrentDr;
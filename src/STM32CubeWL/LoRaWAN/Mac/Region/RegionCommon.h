@@ -52,6 +52,7 @@ extern "C"
 {
 #endif
 
+#include "../../../SubGHz_Phy/radio.h"
 #include "../LoRaMacInterfaces.h"
 #include "../LoRaMacHeaderTypes.h"
 #include "RegionNvm.h"
@@ -128,6 +129,12 @@ extern "C"
  */
 #define REGION_COMMON_DEFAULT_DOWNLINK_DWELL_TIME       0
 
+/*!
+ * Minimum selection weight of a channel, so that a channel with a poor link
+ * quality is still used from time to time, and its quality reevaluated
+ */
+#define REGION_COMMON_MIN_CHANNEL_WEIGHT                16
+
 typedef struct sRegionCommonLinkAdrParams
 {
     /*!
@@ -512,6 +519,27 @@ uint32_t RegionCommonComputeSymbolTimeLoRa( uint8_t phyDr, uint32_t bandwidthInH
  */
 uint32_t RegionCommonComputeSymbolTimeFsk( uint8_t phyDrInKbps );
 
+/*!
+ * \brief Gets the time on air of an uplink from Radio.TimeOnAir, with the uplink
+ *        configuration of the regions (LoRa: CR 4/5, 8 symbols preamble, explicit
+ *        header and CRC on; FSK: 5 bytes preamble, variable length and CRC on).
+ *
+ * \remark The last few results are kept, since the same uplink is usually
+ *         computed several times: to select the channel, to send it and for the
+ *         duty cycle.
+ *
+ * \param [in] modem Radio modem, MODEM_LORA or MODEM_FSK.
+ *
+ * \param [in] bandwidth Bandwidth as for Radio.TimeOnAir.
+ *
+ * \param [in] datarate Spreading factor for LoRa, bitrate in bit/s for FSK.
+ *
+ * \param [in] pktLen Packet length in bytes.
+ *
+ * \retval Returns the time on air in milliseconds.
+ */
+TimerTime_t RegionCommonGetTimeOnAir( RadioModems_t modem, uint32_t bandwidth, uint32_t datarate, uint16_t pktLen );
+
 /*!
  * \brief Computes the RX window timeout and the RX window offset.
  *
@@ -596,6 +624,20 @@ LoRaMacStatus_t RegionCommonIdentifyChannels( RegionCommonIdentifyChannelsParam_
                                               uint8_t* nbEnabledChannels, uint8_t* nbRestrictedChannels,
                                               TimerTime_t* nextTxDelay );
 
+/*!
+ * \brief Randomly selects one of the available channels, weighted by their link quality.
+ *
+ * \param [in] enabledChannels The available channels, as found by \ref RegionCommonIdentifyChannels.
+ *
+ * \param [in] nbEnabledChannels The number of available channels, at least one.
+ *
+ * \param [in] channelsQuality The link quality of all channels, or NULL for a uniform selection.
+ *
+ * \retval Index of the selected channel in enabledChannels.
+ */
+uint8_t RegionCommonSelectChannel( uint8_t* enabledChannels, uint8_t nbEnabledChannels,
+                                   const LoRaMacChannelQuality_t* channelsQuality );
+
 /*!
  * \brief Selects the next lower datarate.
  *
@@ -116,7 +116,7 @@ static TimerTime_t GetTimeOnAir( int8_t datarate, uint16_t pktLen )
     int8_t phyDr = DataratesKR920[datarate];
     uint32_t bandwidth = RegionCommonGetBandwidth( datarate, BandwidthsKR920 );
 
-    return Radio.TimeOnAir( MODEM_LORA, bandwidth, phyDr, 1, 8, false, pktLen, true );
+    return RegionCommonGetTimeOnAir( MODEM_LORA, bandwidth, phyDr, pktLen );
 }
 #endif /* REGION_KR920 */
 
@@ -889,7 +889,6 @@ int8_t RegionKR920AlternateDr( int8_t currentDr, AlternateDrType_t type )
 LoRaMacStatus_t RegionKR920NextChannel( NextChanParams_t* nextChanParams, uint8_t* channel, TimerTime_t* time, TimerTime_t* aggregatedTimeOff )
 {
 #if defined( REGION_KR920 )
-    uint8_t channelNext = 0;
     uint8_t nbEnabledChannels = 0;
     uint8_t nbRestrictedChannels = 0;
     uint8_t enabledChannels[KR920_MAX_NB_CHANNELS] = { 0 };
@@ -932,19 +931,27 @@ LoRaMacStatus_t RegionKR920NextChannel( NextChanParams_t* nextChanParams, uint8_
 
     if( status == LORAMAC_STATUS_OK )
     {
-        for( uint8_t  i = 0, j = randr( 0, nbEnabledChannels - 1 ); i < KR920_MAX_NB_CHANNELS; i++ )
+        uint32_t lbtFrequencies[KR920_MAX_NB_CHANNELS];
+        uint8_t lbtChannels[KR920_MAX_NB_CHANNELS];
+        int32_t freeChannel = 0;
+
+        // Enabled channels are sensed once each, in turn, starting from a randomly selected one
+        for( uint8_t  i = 0, j = RegionCommonSelectChannel( enabledChannels, nbEnabledChannels, nextChanParams->ChannelsQuality ); i < nbEnabledChannels; i++ )
         {
-            channelNext = enabledChannels[j];
+            lbtChannels[i] = enabledChannels[j];
+            lbtFrequencies[i] = RegionNvmGroup2->Channels[lbtChannels[i]].Frequency;
             j = ( j + 1 ) % nbEnabledChannels;
+        }
 
-            // Perform carrier sense for KR920_CARRIER_SENSE_TIME
-            // If the channel is free, we can stop the LBT mechanism
-            if( Radio.IsChannelFree( RegionNvmGroup2->Channels[channelNext].Frequency, KR920_LBT_RX_BANDWIDTH, RegionNvmGroup2->RssiFreeThreshold, RegionNvmGroup2->CarrierSenseTime ) == true )
-            {
-                // Free channel found
-                *channel = channelNext;
-                return LORAMAC_STATUS_OK;
-            }
+        // Perform carrier sense for KR920_CARRIER_SENSE_TIME on each channel, the radio being configured only once
+        // If a channel is free, we can stop the LBT mechanism
+        freeChannel = Radio.ScanChannels( lbtFrequencies, nbEnabledChannels, KR920_LBT_RX_BANDWIDTH,
+                                          RegionNvmGroup2->RssiFreeThreshold, RegionNvmGroup2->CarrierSenseTime, NULL );
+        if( freeChannel >= 0 )
+        {
+            // Free channel found
+            *channel = lbtChannels[freeChannel];
+            return LORAMAC_STATUS_OK;
         }
         // Even if one or more channels are available according to the channel plan, no free channel
         // was found during the LBT procedure.
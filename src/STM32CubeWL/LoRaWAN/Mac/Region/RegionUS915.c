@@ -129,7 +129,7 @@ static TimerTime_t GetTimeOnAir( int8_t datarate, uint16_t pktLen )
     int8_t phyDr = DataratesUS915[datarate];
     uint32_t bandwidth = RegionCommonGetBandwidth( datarate, BandwidthsUS915 );
 
-    return Radio.TimeOnAir( MODEM_LORA, bandwidth, phyDr, 1, 8, false, pktLen, true );
+    return RegionCommonGetTimeOnAir( MODEM_LORA, bandwidth, phyDr, pktLen );
 }
 #endif /* REGION_US915 */
 
@@ -1011,7 +1011,8 @@ LoRaMacStatus_t RegionUS915NextChannel( NextChanParams_t* nextChanParams, uint8_
     {
         if( nextChanParams->Joined == true )
         {
-            // Choose randomly on of the remaining channels
+            // Choose randomly on of the remaining channels. Not weighted by the link quality,
+            // since frequency hopping systems must use their channels equally on average.
             *channel = enabledChannels[randr( 0, nbEnabledChannels - 1 )];
         }
         else
@@ -457,6 +457,62 @@ struct Radio_s
      * \returns Time-on-air value in ms for LR-FHSS packet LrFhssGetTimeOnAirInMs
      */
     radio_status_t ( *LrFhssGetTimeOnAirInMs)( const radio_lr_fhss_time_on_air_params_t *params, uint32_t  *time_on_air_in_ms );
+    /*!
+     * \brief Checks a list of channels for the given time each, in a single pass
+     *
+     * \remark The FSK modem is configured once for all the channels, which are
+     *         then only retuned. Same measurement as IsChannelFree otherwise.
+     *
+     * \param [in]  freqs               Channels RF frequency in Hertz, in scan order
+     * \param [in]  nbFreqs             Number of channels in freqs
+     * \param [in]  rxBandwidth         Rx bandwidth in Hertz
+     * \param [in]  rssiThresh          RSSI threshold in dBm
+     * \param [in]  maxCarrierSenseTime Max time in milliseconds while the RSSI is measured on each channel
+     * \param [out] rssiResults         Highest RSSI measured on each channel in dBm, each channel
+     *                                  being measured for maxCarrierSenseTime. NULL to stop at the
+     *                                  first free channel, a channel being found busy at the first
+     *                                  sample above rssiThresh
+     *
+     * \retval index of the first free channel in freqs, -1 if no channel is free
+     */
+    int32_t ( *ScanChannels )( const uint32_t *freqs, uint8_t nbFreqs, uint32_t rxBandwidth, int16_t rssiThresh,
+                               uint32_t maxCarrierSenseTime, int16_t *rssiResults );
+    /*!
+     * \brief Gets the time of the last radio IRQ
+     *
+     * \remark The time is taken when the radio interrupt is entered, before the
+     *         IRQ is processed and the RadioEvents_t callbacks are called. When
+     *         called from TxDone or RxDone, it is the time of the end of the
+     *         transmission or reception, free of interrupt and scheduling latency.
+     *         Resolution is the one of the RTC timer.
+     *
+     * \retval time Time of the last radio IRQ [ms]
+     */
+    uint32_t ( *GetIrqTime )( void );
+    /*!
+     * \brief Gets the time at which the last received packet started
+     *
+     * \remark Rx done IRQ time minus the time on air of the packet computed
+     *         with the Rx configuration, i.e. the time of the start of its preamble.
+     *         Valid from the RxDone callback.
+     *
+     * \retval time Time of the start of the last received packet [ms]
+     */
+    uint32_t ( *GetRxPacketStartTime )( void );
+    /*!
+     * \brief Sets the radio in continuous reception at reduced power
+     *
+     * \remark The receiver is duty cycled with preamble detection. The listen
+     *         and sleep periods are derived from the preamble length of the Rx
+     *         configuration, so that any preamble is detected and the reception
+     *         latency is bounded by it. Falls back to Rx( 0 ) when the preamble is
+     *         too short to sleep, or for FSK.
+     *         The radio listens RADIO_SNIFF_DETECT_SYMBOLS symbols plus its wakeup
+     *         time in every preamble length minus RADIO_SNIFF_DETECT_SYMBOLS: about a
+     *         third of the time with an 8 symbols preamble at SF12.
+     *         The duty cycle stops on any reception or error event.
+     */
+    void    ( *RxSniff )( void );
 };
 
 /*!
@@ -65,6 +65,16 @@
  * --- PRIVATE TYPES -----------------------------------------------------------
  */
 
+/*!
+ * Sequential writer of bits into an array of bytes, collecting up to 32 bits before storing them
+ */
+typedef struct lr_fhss_bit_writer_s
+{
+    uint8_t *next;    /**< Next byte to be stored */
+    uint32_t word;    /**< Bits collected so far, last one in LSB */
+    uint8_t  nb_bits; /**< Number of bits in word */
+} lr_fhss_bit_writer_t;
+
 /*
  * -----------------------------------------------------------------------------
  * --- PRIVATE VARIABLES -------------------------------------------------------
@@ -82,23 +92,42 @@ STATIC const uint8_t lr_fhss_lfsr_poly2[] = { 65, 68, 71, 72 };
 /** @brief Generating polynomial as function of polynomial index, n_grid in { 185, 198 } */
 STATIC const uint8_t lr_fhss_lfsr_poly3[] = { 142, 149 };
 
-/** @brief used for 1/3 rate viterbi encoding */
-STATIC const uint8_t lr_fhss_viterbi_1_3_table[64][2] =
+/**
+ * @brief used for 1/3 rate viterbi encoding, 4 input bits at a time
+ *
+ * The code is linear, so the 12 output bits for a nibble are the zero-input response of the encoder state
+ * (lr_fhss_viterbi_1_3_state_table) xored with the zero-state response of the nibble
+ * (lr_fhss_viterbi_1_3_nibble_table). After a nibble, the new state is ( ( state << 4 ) | nibble ) % 64.
+ */
+STATIC const uint16_t lr_fhss_viterbi_1_3_state_table[64] =
+{
+    0,    2033, 3980, 2173, 3175, 2966, 1003, 1050, 824,  1225, 3252, 2885, 3935, 2222, 211,  1826,  //
+    2496, 3633, 1612, 445,  1447, 598,  2603, 3546, 2808, 3337, 1396, 645,  1695, 366,  2323, 3810,  //
+    3584, 2545, 396,  1661, 615,  1430, 3563, 2586, 3384, 2761, 692,  1349, 351,  1710, 3795, 2338,  //
+    1984, 49,   2124, 4029, 2983, 3158, 1067, 986,  1272, 777,  2932, 3205, 2207, 3950, 1811, 226    //
+};
+
+/** @brief used for 1/3 rate viterbi encoding, see lr_fhss_viterbi_1_3_state_table */
+STATIC const uint16_t lr_fhss_viterbi_1_3_nibble_table[16] =
 {
-    { 0, 7 }, { 3, 4 }, { 7, 0 }, { 4, 3 }, { 6, 1 }, { 5, 2 }, { 1, 6 }, { 2, 5 }, { 1, 6 }, { 2, 5 }, { 6, 1 },
-    { 5, 2 }, { 7, 0 }, { 4, 3 }, { 0, 7 }, { 3, 4 }, { 4, 3 }, { 7, 0 }, { 3, 4 }, { 0, 7 }, { 2, 5 }, { 1, 6 },
-    { 5, 2 }, { 6, 1 }, { 5, 2 }, { 6, 1 }, { 2, 5 }, { 1, 6 }, { 3, 4 }, { 0, 7 }, { 4, 3 }, { 7, 0 }, { 7, 0 },
-    { 4, 3 }, { 0, 7 }, { 3, 4 }, { 1, 6 }, { 2, 5 }, { 6, 1 }, { 5, 2 }, { 6, 1 }, { 5, 2 }, { 1, 6 }, { 2, 5 },
-    { 0, 7 }, { 3, 4 }, { 7, 0 }, { 4, 3 }, { 3, 4 }, { 0, 7 }, { 4, 3 }, { 7, 0 }, { 5, 2 }, { 6, 1 }, { 2, 5 },
-    { 1, 6 }, { 2, 5 }, { 1, 6 }, { 5, 2 }, { 6, 1 }, { 4, 3 }, { 7, 0 }, { 3, 4 }, { 0, 7 }
+    0, 7, 59, 60, 479, 472, 484, 483, 3838, 3833, 3781, 3778, 3873, 3878, 3866, 3869
 };
 
-/** @brief used for 1/2 rate viterbi encoding */
-STATIC const uint8_t lr_fhss_viterbi_1_2_table[16][2] =
+/**
+ * @brief used for 1/2 rate viterbi encoding, 4 input bits at a time
+ *
+ * Same principle as lr_fhss_viterbi_1_3_state_table, with 8 output bits per nibble. As the state is 4 bits wide,
+ * the new state after a nibble is the nibble itself.
+ */
+STATIC const uint8_t lr_fhss_viterbi_1_2_state_table[16] =
+{
+    0, 107, 172, 199, 176, 219, 28, 119, 192, 171, 108, 7, 112, 27, 220, 183
+};
+
+/** @brief used for 1/2 rate viterbi encoding, see lr_fhss_viterbi_1_2_state_table */
+STATIC const uint8_t lr_fhss_viterbi_1_2_nibble_table[16] =
 {
-    { 0, 3 }, { 1, 2 }, { 2, 1 }, { 3, 0 }, { 2, 1 }, { 3, 0 },
-    { 0, 3 }, { 1, 2 }, { 3, 0 }, { 2, 1 }, { 1, 2 }, { 0, 3 },
-    { 1, 2 }, { 0, 3 }, { 3, 0 }, { 2, 1 }
+    0, 3, 13, 14, 54, 53, 59, 56, 218, 217, 215, 212, 236, 239, 225, 226
 };
 
 /** @brief used header interleaving */
@@ -222,6 +251,34 @@ STATIC uint8_t lr_fhss_extract_bit_in_byte_vector( const uint8_t *data_in, uint3
  */
 STATIC void lr_fhss_set_bit_in_byte_vector( uint8_t *vector, uint32_t bit_number, uint8_t bit_value );
 
+/*!
+ * @brief Start writing bits sequentially into array of bytes
+ *
+ * @param [out] writer     Bit writer to initialize
+ * @param  [in] vector     Array of bytes
+ * @param  [in] bit_number Index of first bit to write in array
+ *
+ * @remark Bits preceding bit_number in the same byte are preserved
+ */
+STATIC void lr_fhss_bit_writer_init( lr_fhss_bit_writer_t *writer, uint8_t *vector, uint32_t bit_number );
+
+/*!
+ * @brief Append a bit using a bit writer
+ *
+ * @param [in,out] writer    Bit writer
+ * @param     [in] bit_value Value to be appended, 0 or 1
+ */
+static inline void lr_fhss_bit_writer_push( lr_fhss_bit_writer_t *writer, uint8_t bit_value );
+
+/*!
+ * @brief Store all bits still pending in a bit writer
+ *
+ * @param [in,out] writer Bit writer
+ *
+ * @remark Bits following the last written bit in the same byte are preserved
+ */
+STATIC void lr_fhss_bit_writer_flush( lr_fhss_bit_writer_t *writer );
+
 /*!
  * @brief Compute 1/2 rate Viterbi encoding
  *
@@ -521,18 +578,22 @@ uint16_t lr_fhss_build_frame( const lr_fhss_v1_params_t *params, uint16_t hop_se
             break;
         }
 
-        uint32_t j = 0;
+        uint32_t             j = 0;
+        lr_fhss_bit_writer_t writer;
+        lr_fhss_bit_writer_init( &writer, data_out, 0 );
         for( uint32_t i = 0; i < nb_bits; i++ )
         {
             if( matrix[matrix_index] )
             {
-                lr_fhss_set_bit_in_byte_vector( data_out, j++, lr_fhss_extract_bit_in_byte_vector( data_out_tmp, i ) );
+                lr_fhss_bit_writer_push( &writer, lr_fhss_extract_bit_in_byte_vector( data_out_tmp, i ) );
+                j++;
             }
             if( ++matrix_index == matrix_len )
             {
                 matrix_index = 0;
             }
         }
+        lr_fhss_bit_writer_flush( &writer );
         nb_bits = j;
 
         memcpy( data_out_tmp, data_out, ( nb_bits + 7 ) / 8 );
@@ -658,37 +719,77 @@ STATIC void lr_fhss_set_bit_in_byte_vector( uint8_t *vector, uint32_t bit_number
     vector[index] = ( vector[index] & ( 0xff - ( 1 << bit_pos ) ) ) | ( bit_value << bit_pos );
 }
 
+STATIC void lr_fhss_bit_writer_init( lr_fhss_bit_writer_t *writer, uint8_t *vector, uint32_t bit_number )
+{
+    writer->next    = &vector[bit_number >> 3];
+    writer->nb_bits = bit_number % 8;
+    writer->word    = *writer->next >> ( 8 - writer->nb_bits );
+}
+
+static inline void lr_fhss_bit_writer_push( lr_fhss_bit_writer_t *writer, uint8_t bit_value )
+{
+    writer->word = ( writer->word << 1 ) | bit_value;
+    if( ++writer->nb_bits == 32 )
+    {
+        *writer->next++ = ( uint8_t )( writer->word >> 24 );
+        *writer->next++ = ( uint8_t )( writer->word >> 16 );
+        *writer->next++ = ( uint8_t )( writer->word >> 8 );
+        *writer->next++ = ( uint8_t ) writer->word;
+        writer->nb_bits = 0;
+    }
+}
+
+STATIC void lr_fhss_bit_writer_flush( lr_fhss_bit_writer_t *writer )
+{
+    while( writer->nb_bits >= 8 )
+    {
+        writer->nb_bits -= 8;
+        *writer->next++ = ( uint8_t )( writer->word >> writer->nb_bits );
+    }
+    if( writer->nb_bits > 0 )
+    {
+        const uint8_t shift = 8 - writer->nb_bits;
+        *writer->next = ( uint8_t )( writer->word << shift ) | ( *writer->next & ( 0xFF >> writer->nb_bits ) );
+    }
+    writer->nb_bits = 0;
+}
+
 STATIC uint16_t lr_fhss_convolution_encode_viterbi_1_2_base( uint8_t *encod_state, const uint8_t *data_in,
                                                              uint16_t data_in_bitcount, uint8_t *data_out )
 {
     uint8_t  g1g0;
     uint8_t  cur_bit;
     uint16_t ind_bit;
-    uint16_t data_out_bitcount = 0;
-    uint16_t bin_out_16        = 0;
+    uint16_t bin_out_16 = 0;
+    uint8_t  state      = *encod_state;
+
+    // Full bytes, one nibble at a time
+    for( ind_bit = 0; ind_bit + 8 <= data_in_bitcount; ind_bit += 8 )
+    {
+        const uint8_t nibble_high = data_in[ind_bit >> 3] >> 4;
+        const uint8_t nibble_low  = data_in[ind_bit >> 3] & 0x0F;
 
-    for( ind_bit = 0; ind_bit < data_in_bitcount; ind_bit++ )
+        *data_out++ = lr_fhss_viterbi_1_2_state_table[state] ^ lr_fhss_viterbi_1_2_nibble_table[nibble_high];
+        *data_out++ = lr_fhss_viterbi_1_2_state_table[nibble_high] ^ lr_fhss_viterbi_1_2_nibble_table[nibble_low];
+        state       = nibble_low;
+    }
+
+    // Remaining bits, the first output symbol of a nibble being in its 2 MSBs
+    for( ; ind_bit < data_in_bitcount; ind_bit++ )
     {
-        cur_bit      = lr_fhss_extract_bit_in_byte_vector( data_in, ind_bit );
-        g1g0         = lr_fhss_viterbi_1_2_table[*encod_state][cur_bit];
-        *encod_state = ( *encod_state * 2 + cur_bit ) % 16;
+        cur_bit = lr_fhss_extract_bit_in_byte_vector( data_in, ind_bit );
+        g1g0 = ( lr_fhss_viterbi_1_2_state_table[state] ^ lr_fhss_viterbi_1_2_nibble_table[cur_bit << 3] ) >> 6;
+        state = ( state * 2 + cur_bit ) % 16;
         bin_out_16 |= ( g1g0 << ( ( 7 - ( ind_bit % 8 ) ) << 1 ) );
-        if( ind_bit % 8 == 7 )
-        {
-            *data_out++ = ( uint8_t )( bin_out_16 >> 8 );
-            *data_out++ = ( uint8_t ) bin_out_16;
-            bin_out_16  = 0;
-        }
-        data_out_bitcount += 2;
     }
     if( ind_bit % 8 )
     {
         *data_out++ = ( uint8_t )( bin_out_16 >> 8 );
         *data_out++ = ( uint8_t ) bin_out_16;
-        bin_out_16  = 0;
     }
 
-    return data_out_bitcount;
+    *encod_state = state;
+    return data_in_bitcount * 2;
 }
 
 STATIC uint16_t lr_fhss_convolution_encode_viterbi_1_3_base( uint8_t *encod_state, const uint8_t *data_in,
@@ -697,33 +798,44 @@ STATIC uint16_t lr_fhss_convolution_encode_viterbi_1_3_base( uint8_t *encod_stat
     uint8_t  g1g0;
     uint8_t  cur_bit;
     uint16_t ind_bit;
-    uint16_t data_out_bitcount = 0;
-    uint32_t bin_out_32        = 0;
+    uint32_t bin_out_32 = 0;
+    uint8_t  state      = *encod_state;
 
-    for( ind_bit = 0; ind_bit < data_in_bitcount; ind_bit++ )
+    // Full bytes, one nibble at a time
+    for( ind_bit = 0; ind_bit + 8 <= data_in_bitcount; ind_bit += 8 )
     {
-        cur_bit      = lr_fhss_extract_bit_in_byte_vector( data_in, ind_bit );
-        g1g0         = lr_fhss_viterbi_1_3_table[*encod_state][cur_bit];
-        *encod_state = ( *encod_state * 2 + cur_bit ) % 64;
+        const uint8_t nibble_high = data_in[ind_bit >> 3] >> 4;
+        const uint8_t nibble_low  = data_in[ind_bit >> 3] & 0x0F;
+
+        bin_out_32 = lr_fhss_viterbi_1_3_state_table[state] ^ lr_fhss_viterbi_1_3_nibble_table[nibble_high];
+        state      = ( ( state << 4 ) | nibble_high ) % 64;
+        bin_out_32 = ( bin_out_32 << 12 ) |
+                     ( lr_fhss_viterbi_1_3_state_table[state] ^ lr_fhss_viterbi_1_3_nibble_table[nibble_low] );
+        state = ( ( state << 4 ) | nibble_low ) % 64;
+
+        *data_out++ = ( uint8_t )( bin_out_32 >> 16 );
+        *data_out++ = ( uint8_t )( bin_out_32 >> 8 );
+        *data_out++ = ( uint8_t ) bin_out_32;
+    }
+
+    // Remaining bits, the first output symbol of a nibble being in its 3 MSBs
+    bin_out_32 = 0;
+    for( ; ind_bit < data_in_bitcount; ind_bit++ )
+    {
+        cur_bit = lr_fhss_extract_bit_in_byte_vector( data_in, ind_bit );
+        g1g0 = ( lr_fhss_viterbi_1_3_state_table[state] ^ lr_fhss_viterbi_1_3_nibble_table[cur_bit << 3] ) >> 9;
+        state = ( state * 2 + cur_bit ) % 64;
         bin_out_32 |= ( g1g0 << ( ( 7 - ( ind_bit % 8 ) ) * 3 ) );
-        if( ind_bit % 8 == 7 )
-        {
-            *data_out++ = ( uint8_t )( bin_out_32 >> 16 );
-            *data_out++ = ( uint8_t )( bin_out_32 >> 8 );
-            *data_out++ = ( uint8_t ) bin_out_32;
-            bin_out_32  = 0;
-        }
-        data_out_bitcount += 3;
     }
     if( ind_bit % 8 )
     {
         *data_out++ = ( uint8_t )( bin_out_32 >> 16 );
         *data_out++ = ( uint8_t )( bin_out_32 >> 8 );
         *data_out++ = ( uint8_t ) bin_out_32;
-        bin_out_32  = 0;
     }
 
-    return data_out_bitcount;
+    *encod_state = state;
+    return data_in_bitcount * 3;
 }
 
 STATIC uint16_t lr_fhss_convolution_encode_viterbi_1_2( const uint8_t *data_in, uint16_t data_in_bitcount,
@@ -751,9 +863,30 @@ STATIC uint16_t lr_fhss_convolution_encode_viterbi_1_3( const uint8_t *data_in,
 
 STATIC uint16_t sqrt_uint16( uint16_t x )
 {
-    uint16_t y = 0;
+    uint32_t remainder = x;
+    uint32_t y         = 0;
+    uint32_t bit       = 1UL << 14;
 
-    while( y * y < x )
+    // Bit-by-bit computation of the square root, rounded down
+    while( bit > remainder )
+    {
+        bit >>= 2;
+    }
+    while( bit != 0 )
+    {
+        if( remainder >= y + bit )
+        {
+            remainder -= y + bit;
+            y = ( y >> 1 ) + bit;
+        }
+        else
+        {
+            y >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    if( remainder != 0 )
     {
         y += 1;
     }
@@ -774,6 +907,9 @@ STATIC uint16_t lr_fhss_payload_interleaving( const uint8_t *data_in, uint16_t d
     int16_t  bits_left     = data_in_bitcount;
     uint16_t out_row_index = output_offset;
 
+    lr_fhss_bit_writer_t writer;
+    lr_fhss_bit_writer_init( &writer, data_out, output_offset );
+
     while( bits_left > 0 )
     {
         int16_t in_row_width = bits_left;
@@ -782,12 +918,11 @@ STATIC uint16_t lr_fhss_payload_interleaving( const uint8_t *data_in, uint16_t d
             in_row_width = LR_FHSS_FRAG_BITS;
         }
 
-        lr_fhss_set_bit_in_byte_vector( data_out, 0 + out_row_index, 0 );  // guard bits
-        lr_fhss_set_bit_in_byte_vector( data_out, 1 + out_row_index, 0 );  // guard bits
+        lr_fhss_bit_writer_push( &writer, 0 );  // guard bits
+        lr_fhss_bit_writer_push( &writer, 0 );  // guard bits
         for( int32_t j = 0; j < in_row_width; j++ )
         {
-            lr_fhss_set_bit_in_byte_vector( data_out, j + 2 + out_row_index,
-                                            lr_fhss_extract_bit_in_byte_vector( data_in, pos ) );  // guard bit
+            lr_fhss_bit_writer_push( &writer, ( data_in[pos >> 3] >> ( 7 - ( pos % 8 ) ) ) & 1 );
 
             pos += step;
             if( pos >= data_in_bitcount )
@@ -805,6 +940,7 @@ STATIC uint16_t lr_fhss_payload_interleaving( const uint8_t *data_in, uint16_t d
         bits_left -= LR_FHSS_FRAG_BITS;
         out_row_index += 2 + in_row_width;
     }
+    lr_fhss_bit_writer_flush( &writer );
 
     return out_row_index - output_offset;
 }
@@ -43,6 +43,10 @@
 #include "../../../BSP/radio_conf.h"
 #include "../../../BSP/mw_log_conf.h"
 
+#if( ( RADIO_LR_FHSS_IS_ON == 1 ) && ( WL_LR_FHSS_HOP_CACHE_SIZE == 1 ) )
+#error "WL_LR_FHSS_HOP_CACHE_SIZE must be 0 or at least 2: one entry is refilled while another one is on air"
+#endif
+
 /* Private typedef -----------------------------------------------------------*/
 /*!
  * Radio hardware and global parameters
@@ -62,6 +66,8 @@ typedef struct SubgRf_s
     PacketStatus_t PacketStatus;
     ModulationParams_t ModulationParams;
     RadioIrqMasks_t RadioIrq;
+    TimerTime_t IrqTime;                /* time of the last radio IRQ, taken at interrupt entry*/
+    TimerTime_t RxPacketStartTime;      /* time the last received packet started, IrqTime of Rx done minus time on air*/
     uint8_t AntSwitchPaSelect;
     uint32_t RxDcPreambleDetectTimeout; /* 0:RxDutyCycle is off, otherwise on with  2*rxTime + sleepTime (See STM32WL Errata: RadioSetRxDutyCycle)*/
 #if( RADIO_LR_FHSS_IS_ON == 1 )
@@ -73,6 +79,10 @@ typedef struct SubgRf_s
         uint16_t             hop_sequence_id;
         wl_lr_fhss_params_t lr_fhss_params;
         wl_lr_fhss_state_t lr_fhss_state;
+#if( WL_LR_FHSS_HOP_CACHE_SIZE > 0 )
+        uint16_t             next_hop_sequence_ids[WL_LR_FHSS_HOP_CACHE_SIZE - 1]; /* drawn in advance, present in the hop cache */
+        uint8_t              next_hop_sequence_index;                              /* entry of next_hop_sequence_ids to use next */
+#endif /* WL_LR_FHSS_HOP_CACHE_SIZE > 0 */
     } lr_fhss;
 
 #endif /* RADIO_LR_FHSS_IS_ON == 1 */
@@ -158,6 +168,16 @@ typedef struct SubgRf_s
 
 #define RADIO_BUF_SIZE 255
 
+/*!
+ * Time for the RSSI to settle after retuning from Rx to Rx on another channel, the oscillator being kept on [ms]
+ */
+#define RADIO_SCAN_RETUNE_TIME 1
+
+/*!
+ * Number of LoRa symbols the receiver listens to in each Rx duty cycle period to detect a preamble
+ */
+#define RADIO_SNIFF_DETECT_SYMBOLS 2
+
 /* Private function prototypes -----------------------------------------------*/
 /*!
  * \brief Initializes the radio
@@ -201,6 +221,49 @@ static void RadioSetChannel( uint32_t freq );
  */
 static bool RadioIsChannelFree( uint32_t freq, uint32_t rxBandwidth, int16_t rssiThresh, uint32_t maxCarrierSenseTime );
 
+/*!
+ * \brief Checks a list of channels in a row, the radio being configured only once
+ *
+ * \param [in]  freqs               Channels RF frequency in Hertz, in scan order
+ * \param [in]  nbFreqs             Number of channels in freqs
+ * \param [in]  rxBandwidth         Rx bandwidth in Hertz
+ * \param [in]  rssiThresh          RSSI threshold in dBm
+ * \param [in]  maxCarrierSenseTime Max time in milliseconds while the RSSI is measured on each channel
+ * \param [out] rssiResults         Highest RSSI measured on each channel in dBm, NULL to stop at the first free channel
+ *
+ * \retval index of the first free channel in freqs, -1 if no channel is free
+ */
+static int32_t RadioScanChannels( const uint32_t *freqs, uint8_t nbFreqs, uint32_t rxBandwidth, int16_t rssiThresh,
+                                  uint32_t maxCarrierSenseTime, int16_t *rssiResults );
+
+/*!
+ * \brief Gets the time of the last radio IRQ
+ *
+ * \retval time Time taken at interrupt entry, before any radio IRQ processing
+ */
+static uint32_t RadioGetIrqTime( void );
+
+/*!
+ * \brief Gets the time at which the last received packet started
+ *
+ * \retval time Time of the start of the preamble
+ */
+static uint32_t RadioGetRxPacketStartTime( void );
+
+/*!
+ * \brief Sets the radio in reception, duty cycled on the configured preamble length
+ */
+static void RadioRxSniff( void );
+
+/*!
+ * \brief Computes the time on air of a received packet with the current Rx configuration
+ *
+ * \param [in] payloadLen Received payload length
+ *
+ * \retval airTime Computed airTime (ms)
+ */
+static uint32_t RadioGetRxTimeOnAir( uint8_t payloadLen );
+
 /*!
  * \brief Generates a 32 bits random value based on the RSSI readings
  *
@@ -503,6 +566,30 @@ static uint32_t prbs31_val =  0xAA;
 #endif /* RADIO_LR_FHSS_IS_ON == 1 */
 
 #if (RADIO_SIGFOX_ENABLE == 1)
+/*!
+ * D-BPSK integration of an input byte: bit n is the XOR of the inverted bits 7 down to n,
+ * for a previous integration state of 0 (XOR the result with 0xFF otherwise)
+ */
+static const uint8_t IntegrationTable[256] =
+{
+    0xAA, 0xAB, 0xA9, 0xA8, 0xAD, 0xAC, 0xAE, 0xAF, 0xA5, 0xA4, 0xA6, 0xA7, 0xA2, 0xA3, 0xA1, 0xA0,
+    0xB5, 0xB4, 0xB6, 0xB7, 0xB2, 0xB3, 0xB1, 0xB0, 0xBA, 0xBB, 0xB9, 0xB8, 0xBD, 0xBC, 0xBE, 0xBF,
+    0x95, 0x94, 0x96, 0x97, 0x92, 0x93, 0x91, 0x90, 0x9A, 0x9B, 0x99, 0x98, 0x9D, 0x9C, 0x9E, 0x9F,
+    0x8A, 0x8B, 0x89, 0x88, 0x8D, 0x8C, 0x8E, 0x8F, 0x85, 0x84, 0x86, 0x87, 0x82, 0x83, 0x81, 0x80,
+    0xD5, 0xD4, 0xD6, 0xD7, 0xD2, 0xD3, 0xD1, 0xD0, 0xDA, 0xDB, 0xD9, 0xD8, 0xDD, 0xDC, 0xDE, 0xDF,
+    0xCA, 0xCB, 0xC9, 0xC8, 0xCD, 0xCC, 0xCE, 0xCF, 0xC5, 0xC4, 0xC6, 0xC7, 0xC2, 0xC3, 0xC1, 0xC0,
+    0xEA, 0xEB, 0xE9, 0xE8, 0xED, 0xEC, 0xEE, 0xEF, 0xE5, 0xE4, 0xE6, 0xE7, 0xE2, 0xE3, 0xE1, 0xE0,
+    0xF5, 0xF4, 0xF6, 0xF7, 0xF2, 0xF3, 0xF1, 0xF0, 0xFA, 0xFB, 0xF9, 0xF8, 0xFD, 0xFC, 0xFE, 0xFF,
+    0x55, 0x54, 0x56, 0x57, 0x52, 0x53, 0x51, 0x50, 0x5A, 0x5B, 0x59, 0x58, 0x5D, 0x5C, 0x5E, 0x5F,
+    0x4A, 0x4B, 0x49, 0x48, 0x4D, 0x4C, 0x4E, 0x4F, 0x45, 0x44, 0x46, 0x47, 0x42, 0x43, 0x41, 0x40,
+    0x6A, 0x6B, 0x69, 0x68, 0x6D, 0x6C, 0x6E, 0x6F, 0x65, 0x64, 0x66, 0x67, 0x62, 0x63, 0x61, 0x60,
+    0x75, 0x74, 0x76, 0x77, 0x72, 0x73, 0x71, 0x70, 0x7A, 0x7B, 0x79, 0x78, 0x7D, 0x7C, 0x7E, 0x7F,
+    0x2A, 0x2B, 0x29, 0x28, 0x2D, 0x2C, 0x2E, 0x2F, 0x25, 0x24, 0x26, 0x27, 0x22, 0x23, 0x21, 0x20,
+    0x35, 0x34, 0x36, 0x37, 0x32, 0x33, 0x31, 0x30, 0x3A, 0x3B, 0x39, 0x38, 0x3D, 0x3C, 0x3E, 0x3F,
+    0x15, 0x14, 0x16, 0x17, 0x12, 0x13, 0x11, 0x10, 0x1A, 0x1B, 0x19, 0x18, 0x1D, 0x1C, 0x1E, 0x1F,
+    0x0A, 0x0B, 0x09, 0x08, 0x0D, 0x0C, 0x0E, 0x0F, 0x05, 0x04, 0x06, 0x07, 0x02, 0x03, 0x01, 0x00
+};
+
 /*!
  * @brief D-BPSK to BPSK
  *
@@ -510,7 +597,7 @@ static uint32_t prbs31_val =  0xAA;
  * @param [in]  inBuffer      buffer with frame to encode
  * @param [in]  size          size of the payload to encode
  */
-static void payload_integration( uint8_t *outBuffer, uint8_t *inBuffer, uint8_t size );
+static void payload_integration( uint8_t *outBuffer, const uint8_t *inBuffer, uint8_t size );
 #endif /*RADIO_SIGFOX_ENABLE == 1*/
 /*!
  * \brief Sets the Transmitter in continuous PRBS mode
@@ -634,6 +721,17 @@ static uint32_t RadioGetLoRaTimeOnAirNumerator( uint32_t bandwidth,
 
 #if( RADIO_LR_FHSS_IS_ON == 1 )
 static uint32_t GetNextFreqIdx( uint32_t max );
+
+#if( WL_LR_FHSS_HOP_CACHE_SIZE > 0 )
+/*!
+ * \brief Draw a new hop sequence ID to replace the one just used by an LrFhss transmission, and precompute its
+ *        hop sequence
+ *
+ * \remark The hop cache entry replaced is the one of the transmission before, so this can be called while the
+ *         radio is transmitting with the hop sequence just used.
+ */
+static void RadioLrFhssRefillHopCache( void );
+#endif /* WL_LR_FHSS_HOP_CACHE_SIZE > 0 */
 #endif /* RADIO_LR_FHSS_IS_ON == 1 */
 
 /* Private variables ---------------------------------------------------------*/
@@ -677,7 +775,11 @@ const struct Radio_s Radio =
     RFW_ReceiveLongPacket,
     /* LrFhss extended radio functions */
     RadioLrFhssSetCfg,
-    RadioLrFhssGetTimeOnAirInMs
+    RadioLrFhssGetTimeOnAirInMs,
+    RadioScanChannels,
+    RadioGetIrqTime,
+    RadioGetRxPacketStartTime,
+    RadioRxSniff
 };
 
 const RadioLoRaBandwidths_t Bandwidths[] = { LORA_BW_125, LORA_BW_250, LORA_BW_500 };
@@ -744,6 +846,7 @@ static RadioState_t RadioGetStatus( void )
         case MODE_TX:
             return RF_TX_RUNNING;
         case MODE_RX:
+        case MODE_RX_DC:
             return RF_RX_RUNNING;
         case MODE_CAD:
             return RF_CAD;
@@ -845,6 +948,120 @@ static bool RadioIsChannelFree( uint32_t freq, uint32_t rxBandwidth, int16_t rss
     return status;
 }
 
+static int32_t RadioScanChannels( const uint32_t *freqs, uint8_t nbFreqs, uint32_t rxBandwidth, int16_t rssiThresh,
+                                  uint32_t maxCarrierSenseTime, int16_t *rssiResults )
+{
+    int32_t freeChannel = -1;
+    int16_t rssi = 0;
+    int16_t rssiMax = 0;
+    uint32_t carrierSenseTime = 0;
+
+    if( ( freqs == NULL ) || ( nbFreqs == 0 ) )
+    {
+        return -1;
+    }
+
+    RadioStandby( );
+
+    RadioSetModem( MODEM_FSK );
+
+    RadioSetChannel( freqs[0] );
+
+    // Set Rx bandwidth once for all the channels. Other parameters are not used.
+    RadioSetRxConfig( MODEM_FSK, rxBandwidth, 600, 0, rxBandwidth, 3, 0, false,
+                      0, false, 0, 0, false, true );
+    RadioRx( 0 );
+
+    RADIO_DELAY_MS( RadioGetWakeupTime( ) );
+
+    for( uint8_t i = 0; i < nbFreqs; i++ )
+    {
+        if( i != 0 )
+        {
+            // Retune only, keeping the oscillator on: no reconfiguration nor wakeup time
+            SUBGRF_SetStandby( STDBY_XOSC );
+            RadioSetChannel( freqs[i] );
+            SUBGRF_SetRx( 0xFFFFFF ); // Rx Continuous
+            RADIO_DELAY_MS( RADIO_SCAN_RETUNE_TIME );
+        }
+
+        rssiMax = INT16_MIN;
+        carrierSenseTime = TimerGetCurrentTime( );
+
+        // Perform carrier sense for maxCarrierSenseTime
+        while( TimerGetElapsedTime( carrierSenseTime ) < maxCarrierSenseTime )
+        {
+            rssi = RadioRssi( MODEM_FSK );
+            if( rssi > rssiMax )
+            {
+                rssiMax = rssi;
+            }
+            // A busy channel is known once a sample is above the threshold, unless its highest RSSI is reported
+            if( ( rssi > rssiThresh ) && ( rssiResults == NULL ) )
+            {
+                break;
+            }
+        }
+
+        if( rssiResults != NULL )
+        {
+            rssiResults[i] = rssiMax;
+        }
+        if( ( rssiMax <= rssiThresh ) && ( freeChannel < 0 ) )
+        {
+            freeChannel = i;
+            if( rssiResults == NULL )
+            {
+                break;
+            }
+        }
+    }
+    RadioStandby( );
+
+    return freeChannel;
+}
+
+static uint32_t RadioGetIrqTime( void )
+{
+    return SubgRf.IrqTime;
+}
+
+static uint32_t RadioGetRxPacketStartTime( void )
+{
+    return SubgRf.RxPacketStartTime;
+}
+
+static void RadioRxSniff( void )
+{
+    uint32_t symbolTime = 0;
+    uint32_t preambleTime = 0;
+    uint32_t rxTime = 0;
+    uint32_t wakeupTime = RadioGetWakeupTime( ) * 1000;
+
+    if( ( SubgRf.Modem != MODEM_LORA ) || ( 1UL == RFW_Is_Init( ) ) )
+    {
+        RadioRx( 0 );
+        return;
+    }
+    /* Symbol time in us */
+    symbolTime = ( ( 1UL << SubgRf.ModulationParams.Params.LoRa.SpreadingFactor ) * 1000UL ) /
+                 ( RadioGetLoRaBandwidthInHz( SubgRf.ModulationParams.Params.LoRa.Bandwidth ) / 1000UL );
+    preambleTime = SubgRf.PacketParams.Params.LoRa.PreambleLength * symbolTime;
+    rxTime = RADIO_SNIFF_DETECT_SYMBOLS * symbolTime;
+
+    /* A preamble starting right after a listen period must still be detected by the next one:
+       rxTime + sleepTime + wakeupTime + rxTime <= preambleTime */
+    if( preambleTime <= ( 2 * rxTime + wakeupTime ) )
+    {
+        /* Too short to sleep, listen continuously */
+        RadioRx( 0 );
+        return;
+    }
+    DBG_GPIO_RADIO_RX( SET );
+    /* Periods are in radio RTC steps of 15.625 us */
+    RadioSetRxDutyCycle( ( rxTime << 6 ) / 1000, ( ( preambleTime - 2 * rxTime - wakeupTime ) << 6 ) / 1000 );
+}
+
 static uint32_t RadioRandom( void )
 {
     uint32_t rnd = 0;
@@ -1332,6 +1549,41 @@ static uint32_t RadioTimeOnAir( RadioModems_t modem, uint32_t bandwidth,
     return DIVC( numerator, denominator );
 }
 
+static uint32_t RadioGetRxTimeOnAir( uint8_t payloadLen )
+{
+    uint32_t numerator = 0;
+    uint32_t denominator = 1;
+
+    if( SubgRf.PacketParams.PacketType == PACKET_TYPE_LORA )
+    {
+        uint32_t bandwidth = 0;
+
+        // Bandwidth index, as expected by RadioGetLoRaTimeOnAirNumerator
+        while( ( bandwidth < 3 ) && ( Bandwidths[bandwidth] != SubgRf.ModulationParams.Params.LoRa.Bandwidth ) )
+        {
+            bandwidth++;
+        }
+        numerator   = 1000U * RadioGetLoRaTimeOnAirNumerator( bandwidth, SubgRf.ModulationParams.Params.LoRa.SpreadingFactor,
+                                                              SubgRf.ModulationParams.Params.LoRa.CodingRate,
+                                                              SubgRf.PacketParams.Params.LoRa.PreambleLength,
+                                                              SubgRf.PacketParams.Params.LoRa.HeaderType == LORA_PACKET_FIXED_LENGTH,
+                                                              payloadLen,
+                                                              SubgRf.PacketParams.Params.LoRa.CrcMode == LORA_CRC_ON );
+        denominator = RadioGetLoRaBandwidthInHz( SubgRf.ModulationParams.Params.LoRa.Bandwidth );
+    }
+    else if( SubgRf.ModulationParams.Params.Gfsk.BitRate != 0 )
+    {
+        numerator   = 1000U * RadioGetGfskTimeOnAirNumerator( SubgRf.ModulationParams.Params.Gfsk.BitRate, 0,
+                                                              SubgRf.PacketParams.Params.Gfsk.PreambleLength >> 3,
+                                                              SubgRf.PacketParams.Params.Gfsk.HeaderType == RADIO_PACKET_FIXED_LENGTH,
+                                                              payloadLen,
+                                                              SubgRf.PacketParams.Params.Gfsk.CrcLength != RADIO_CRC_OFF );
+        denominator = SubgRf.ModulationParams.Params.Gfsk.BitRate;
+    }
+    // Perform integral ceil()
+    return DIVC( numerator, denominator );
+}
+
 static radio_status_t RadioSend( uint8_t *buffer, uint8_t size )
 {
     SUBGRF_SetDioIrqParams( IRQ_TX_DONE | IRQ_RX_TX_TIMEOUT | IRQ_TX_DBG,
@@ -1364,12 +1616,20 @@ static radio_status_t RadioSend( uint8_t *buffer, uint8_t size )
 
     if( SubgRf.lr_fhss.is_lr_fhss_on == true )
     {
+#if( WL_LR_FHSS_HOP_CACHE_SIZE > 0 )
+        SubgRf.lr_fhss.hop_sequence_id = SubgRf.lr_fhss.next_hop_sequence_ids[SubgRf.lr_fhss.next_hop_sequence_index];
+#else
         uint32_t hop_sequence_count = lr_fhss_get_hop_sequence_count( &SubgRf.lr_fhss.lr_fhss_params.lr_fhss_params );
         SubgRf.lr_fhss.hop_sequence_id = GetNextFreqIdx( hop_sequence_count );
+#endif /* WL_LR_FHSS_HOP_CACHE_SIZE > 0 */
         MW_LOG( TS_ON, VLEVEL_M, "LRFHSS HOPSEQ %d\r\n", SubgRf.lr_fhss.hop_sequence_id );
         if( RADIO_STATUS_OK != wl_lr_fhss_build_frame( &SubgRf.lr_fhss.lr_fhss_params, &SubgRf.lr_fhss.lr_fhss_state,
                                                        SubgRf.lr_fhss.hop_sequence_id, buffer, size, NULL ) )
         {
+#if( WL_LR_FHSS_HOP_CACHE_SIZE > 0 )
+            /* Keep the hop cache replacement order in step with the IDs */
+            RadioLrFhssRefillHopCache( );
+#endif /* WL_LR_FHSS_HOP_CACHE_SIZE > 0 */
             return RADIO_STATUS_ERROR;
         }
 
@@ -1379,6 +1639,10 @@ static radio_status_t RadioSend( uint8_t *buffer, uint8_t size )
                                 IRQ_RADIO_NONE );
 
         SUBGRF_SetTx( SubgRf.TxTimeout << 6 );
+#if( WL_LR_FHSS_HOP_CACHE_SIZE > 0 )
+        /* Precompute the hops of a later transmission while this one is on air */
+        RadioLrFhssRefillHopCache( );
+#endif /* WL_LR_FHSS_HOP_CACHE_SIZE > 0 */
     }
     else
 #endif /* RADIO_LR_FHSS_IS_ON == 1 */
@@ -1717,6 +1981,8 @@ static void RadioOnRxTimeoutProcess( void )
 
 static void RadioOnDioIrq( RadioIrqMasks_t radioIrq )
 {
+    /* timestamp first, RADIO_IRQ_PROCESS may be deferred to background */
+    SubgRf.IrqTime = TimerGetCurrentTime( );
     SubgRf.RadioIrq = radioIrq;
 
     RADIO_IRQ_PROCESS();
@@ -1758,7 +2024,8 @@ static void RadioIrqProcess( void )
         DBG_GPIO_RADIO_RX( RST );
 
         TimerStop( &RxTimeoutTimer );
-        if( SubgRf.RxContinuous == false )
+        /* Rx duty cycle stops on a packet, it is restarted by the upper layer */
+        if( ( SubgRf.RxContinuous == false ) || ( SUBGRF_GetOperatingMode( ) == MODE_RX_DC ) )
         {
             //!< Update operating mode state to a value lower than \ref MODE_STDBY_XOSC
             SUBGRF_SetStandby( STDBY_RC );
@@ -1770,6 +2037,7 @@ static void RadioIrqProcess( void )
         }
         SUBGRF_GetPayload( RadioBuffer, &size, 255 );
         SUBGRF_GetPacketStatus( &( SubgRf.PacketStatus ) );
+        SubgRf.RxPacketStartTime = SubgRf.IrqTime - RadioGetRxTimeOnAir( size );
         if( ( RadioEvents != NULL ) && ( RadioEvents->RxDone != NULL ) )
         {
             switch( SubgRf.PacketStatus.packetType )
@@ -1817,7 +2085,7 @@ static void RadioIrqProcess( void )
                 RadioEvents->TxTimeout( );
             }
         }
-        else if( SUBGRF_GetOperatingMode( ) == MODE_RX )
+        else if( ( SUBGRF_GetOperatingMode( ) == MODE_RX ) || ( SUBGRF_GetOperatingMode( ) == MODE_RX_DC ) )
         {
             DBG_GPIO_RADIO_RX( RST );
 
@@ -1864,7 +2132,7 @@ static void RadioIrqProcess( void )
 
     case IRQ_HEADER_ERROR:
         TimerStop( &RxTimeoutTimer );
-        if( SubgRf.RxContinuous == false )
+        if( ( SubgRf.RxContinuous == false ) || ( SUBGRF_GetOperatingMode( ) == MODE_RX_DC ) )
         {
             //!< Update operating mode state to a value lower than \ref MODE_STDBY_XOSC
             SUBGRF_SetStandby( STDBY_RC );
@@ -1879,7 +2147,7 @@ static void RadioIrqProcess( void )
     case IRQ_CRC_ERROR:
         MW_LOG( TS_ON, VLEVEL_M,  "IRQ_CRC_ERROR\r\n" );
 
-        if( SubgRf.RxContinuous == false )
+        if( ( SubgRf.RxContinuous == false ) || ( SUBGRF_GetOperatingMode( ) == MODE_RX_DC ) )
         {
             //!< Update operating mode state to a value lower than \ref MODE_STDBY_XOSC
             SUBGRF_SetStandby( STDBY_RC );
@@ -1920,38 +2188,19 @@ static void RadioTxCw( int8_t power )
 }
 
 #if (RADIO_SIGFOX_ENABLE == 1)
-static void payload_integration( uint8_t *outBuffer, uint8_t *inBuffer, uint8_t size )
+static void payload_integration( uint8_t *outBuffer, const uint8_t *inBuffer, uint8_t size )
 {
     uint8_t prevInt = 0;
-    uint8_t currBit;
-    uint8_t index_bit;
-    uint8_t index_byte;
-    uint8_t index_bit_out;
-    uint8_t index_byte_out;
-    int32_t i = 0;
+    uint8_t currInt;
+    uint8_t i;
 
     for( i = 0; i < size; i++ )
     {
-        /* reverse all inputs */
-        inBuffer[i] = ~inBuffer[i];
-        /* init outBuffer */
-        outBuffer[i] = 0;
-    }
-
-    for( i = 0; i < ( size * 8 ); i++ )
-    {
-        /* index to take bit in inBuffer */
-        index_bit = 7 - ( i % 8 );
-        index_byte = i / 8;
-        /* index to place bit in outBuffer is shifted 1 bit right */
-        index_bit_out = 7 - ( ( i + 1 ) % 8 );
-        index_byte_out = ( i + 1 ) / 8;
-        /* extract current bit from input */
-        currBit = ( inBuffer[index_byte] >> index_bit ) & 0x01;
-        /* integration */
-        prevInt ^= currBit;
-        /* write result integration in output */
-        outBuffer[index_byte_out] |= ( prevInt << index_bit_out );
+        /* integration of the inverted byte, continued from the last bit of the previous one */
+        currInt = IntegrationTable[inBuffer[i]] ^ ( uint8_t )( -prevInt );
+        /* result integration is shifted 1 bit right in output */
+        outBuffer[i] = ( uint8_t )( ( prevInt << 7 ) | ( currInt >> 1 ) );
+        prevInt = currInt & 0x01;
     }
 
     outBuffer[size] = ( prevInt << 7 ) | ( prevInt << 6 ) | ( ( ( !prevInt ) & 0x01 ) << 5 ) ;
@@ -2372,6 +2621,19 @@ static uint32_t GetNextFreqIdx( uint32_t max )
     prbs31_val = ( ( prbs31_val << 1 ) | newbit );
     return ( prbs31_val - 1 ) % ( max );
 }
+
+#if( WL_LR_FHSS_HOP_CACHE_SIZE > 0 )
+static void RadioLrFhssRefillHopCache( void )
+{
+    const lr_fhss_v1_params_t *params = &SubgRf.lr_fhss.lr_fhss_params.lr_fhss_params;
+    uint8_t index = SubgRf.lr_fhss.next_hop_sequence_index;
+
+    /* The ID just used becomes the last one in the order of use */
+    SubgRf.lr_fhss.next_hop_sequence_ids[index] = GetNextFreqIdx( lr_fhss_get_hop_sequence_count( params ) );
+    ( void ) wl_lr_fhss_hop_cache_fill( params, SubgRf.lr_fhss.next_hop_sequence_ids[index] );
+    SubgRf.lr_fhss.next_hop_sequence_index = ( index + 1 ) % ( WL_LR_FHSS_HOP_CACHE_SIZE - 1 );
+}
+#endif /* WL_LR_FHSS_HOP_CACHE_SIZE > 0 */
 #endif /* RADIO_LR_FHSS_IS_ON == 1 */
 
 static radio_status_t RadioLrFhssSetCfg( const radio_lr_fhss_cfg_params_t *cfg_params )
@@ -2400,6 +2662,18 @@ static radio_status_t RadioLrFhssSetCfg( const radio_lr_fhss_cfg_params_t *cfg_p
     {
         return status;
     }
+#if( WL_LR_FHSS_HOP_CACHE_SIZE > 0 )
+    /* Draw the hop sequence IDs of the next transmissions and precompute their hops, leaving one cache entry for
+     * the refill done while transmitting */
+    wl_lr_fhss_hop_cache_clear( );
+    for( uint8_t i = 0; i < WL_LR_FHSS_HOP_CACHE_SIZE - 1; i++ )
+    {
+        SubgRf.lr_fhss.next_hop_sequence_ids[i] = GetNextFreqIdx( lr_fhss_get_hop_sequence_count( &SubgRf.lr_fhss.lr_fhss_params.lr_fhss_params ) );
+        ( void ) wl_lr_fhss_hop_cache_fill( &SubgRf.lr_fhss.lr_fhss_params.lr_fhss_params,
+                                            SubgRf.lr_fhss.next_hop_sequence_ids[i] );
+    }
+    SubgRf.lr_fhss.next_hop_sequence_index = 0;
+#endif /* WL_LR_FHSS_HOP_CACHE_SIZE > 0 */
     SubgRf.lr_fhss.is_lr_fhss_on = true;
 #endif /* RADIO_LR_FHSS_IS_ON == 1 */
     return  status;
@@ -52,6 +52,26 @@ typedef struct FskBandwidth_s
     uint32_t bandwidth;
     uint8_t  RegValue;
 } FskBandwidth_t;
+
+/*!
+ * Last parameters written with a radio command
+ */
+typedef struct RadioShadowCmd_s
+{
+    SUBGHZ_RadioSetCmd_t Command;
+    uint8_t Size;       // 0 when the content of the radio is unknown
+    uint8_t Buffer[9];
+} RadioShadowCmd_t;
+
+/*!
+ * Last value written to or read from a radio register
+ */
+typedef struct RadioShadowReg_s
+{
+    uint16_t Address;
+    bool     Valid;
+    uint8_t  Value;
+} RadioShadowReg_t;
 /* Private define ------------------------------------------------------------*/
 /**
   * @brief drive value used anytime radio is NOT in TX low power mode
@@ -113,6 +133,14 @@ typedef struct FskBandwidth_s
 #define DCDC_ENABLE                 ( 1UL )
 #endif /* DCDC_ENABLE */
 
+/**
+  * @brief Skip radio commands and register writes that do not change the radio configuration
+  * @note RADIO_SHADOW_ENABLE can be redefined in radio_conf.h
+  */
+#ifndef RADIO_SHADOW_ENABLE
+#define RADIO_SHADOW_ENABLE         ( 1UL )
+#endif /* RADIO_SHADOW_ENABLE */
+
 /* Private macro -------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
 /*!
@@ -169,6 +197,52 @@ static const FskBandwidth_t FskBandwidths[] =
     { 500000, 0x00 }, // Invalid Bandwidth
 };
 
+#if( RADIO_SHADOW_ENABLE == 1 )
+/*!
+ * \brief Index of the commands in ShadowCmds
+ */
+enum
+{
+    SHADOW_CMD_PACKETTYPE,
+    SHADOW_CMD_MODULATIONPARAMS,
+    SHADOW_CMD_PACKETPARAMS,
+    SHADOW_CMD_RFFREQUENCY,
+    SHADOW_CMD_DIOIRQ,
+    SHADOW_CMD_COUNT
+};
+
+/*!
+ * \brief Configuration commands whose last parameters are kept
+ *
+ * Only commands that configure the radio are listed, the radio keeps their
+ * parameters until reset or cold sleep (see SUBGRF_InvalidateShadow)
+ */
+static RadioShadowCmd_t ShadowCmds[SHADOW_CMD_COUNT] =
+{
+    [SHADOW_CMD_PACKETTYPE]       = { RADIO_SET_PACKETTYPE, 0, { 0 } },
+    [SHADOW_CMD_MODULATIONPARAMS] = { RADIO_SET_MODULATIONPARAMS, 0, { 0 } },
+    [SHADOW_CMD_PACKETPARAMS]     = { RADIO_SET_PACKETPARAMS, 0, { 0 } },
+    [SHADOW_CMD_RFFREQUENCY]      = { RADIO_SET_RFFREQUENCY, 0, { 0 } },
+    [SHADOW_CMD_DIOIRQ]           = { RADIO_CFG_DIOIRQ, 0, { 0 } },
+};
+
+/*!
+ * \brief Registers whose last value is kept
+ *
+ * Registers are only retained in warm start sleep when part of the retention
+ * list, so these are invalidated on any sleep
+ */
+static RadioShadowReg_t ShadowRegs[] =
+{
+    { SUBGHZ_SDCFG0R, false, 0 },
+};
+
+/*!
+ * \brief SUBGHZ SPI transfers saved by the shadow
+ */
+static RadioShadowStats_t ShadowStats;
+#endif /* RADIO_SHADOW_ENABLE */
+
 /* Private function prototypes -----------------------------------------------*/
 
 /*!
@@ -183,6 +257,36 @@ static void Radio_SMPS_Set( uint8_t level );
  */
 static DioIrqHandler RadioOnDioIrqCb;
 
+#if( RADIO_SHADOW_ENABLE == 1 )
+/*!
+ * \brief Checks a radio command against the shadow and updates the shadow
+ *
+ * \remark Also forgets the settings the command makes the radio lose or change
+ *
+ * \param [in]  command     Radio command about to be sent
+ * \param [in]  buffer      Command parameters
+ * \param [in]  size        Number of parameters
+ * \retval      true if the command does not change the radio configuration and can be skipped
+ */
+static bool Radio_ShadowCmd( SUBGHZ_RadioSetCmd_t command, uint8_t *buffer, uint16_t size );
+
+/*!
+ * \brief Forgets the value of the shadowed registers in [address, address + size[
+ *
+ * \param [in]  address     First register address
+ * \param [in]  size        Number of registers
+ */
+static void Radio_ShadowInvalidateRegs( uint16_t address, uint32_t size );
+
+/*!
+ * \brief Returns the shadow entry of a register
+ *
+ * \param [in]  address     Register address
+ * \retval      shadow entry, NULL if the register is not shadowed
+ */
+static RadioShadowReg_t *Radio_ShadowReg( uint16_t address );
+#endif /* RADIO_SHADOW_ENABLE */
+
 /* Exported functions ---------------------------------------------------------*/
 void SUBGRF_Init( DioIrqHandler dioIrq )
 {
@@ -193,6 +297,8 @@ void SUBGRF_Init( DioIrqHandler dioIrq )
 
     RADIO_INIT();
 
+    SUBGRF_InvalidateShadow( );
+
     /* set default SMPS current drive to default*/
     Radio_SMPS_Set(SMPS_DRIVE_SETTING_DEFAULT);
 
@@ -955,7 +1061,27 @@ void SUBGRF_ClearIrqStatus( uint16_t irq )
 void SUBGRF_WriteRegister( uint16_t addr, uint8_t data )
 {
     CRITICAL_SECTION_BEGIN();
+#if( RADIO_SHADOW_ENABLE == 1 )
+    RadioShadowReg_t *reg = Radio_ShadowReg( addr );
+
+    if( ( reg != NULL ) && ( reg->Valid == true ) && ( reg->Value == data ) )
+    {
+        // opcode, address and data
+        ShadowStats.SkippedRegisterAccesses++;
+        ShadowStats.SkippedBytes += 4;
+        CRITICAL_SECTION_END();
+        return;
+    }
+    Radio_ShadowInvalidateRegs( addr, 1 );
+#endif /* RADIO_SHADOW_ENABLE */
     HAL_SUBGHZ_WriteRegisters( &hsubghz, addr, (uint8_t*)&data, 1 );
+#if( RADIO_SHADOW_ENABLE == 1 )
+    if( reg != NULL )
+    {
+        reg->Value = data;
+        reg->Valid = true;
+    }
+#endif /* RADIO_SHADOW_ENABLE */
     CRITICAL_SECTION_END();
 }
 
@@ -963,7 +1089,27 @@ uint8_t SUBGRF_ReadRegister( uint16_t addr )
 {
     uint8_t data;
     CRITICAL_SECTION_BEGIN();
+#if( RADIO_SHADOW_ENABLE == 1 )
+    RadioShadowReg_t *reg = Radio_ShadowReg( addr );
+
+    if( ( reg != NULL ) && ( reg->Valid == true ) )
+    {
+        // opcode, address, status and data
+        ShadowStats.SkippedRegisterAccesses++;
+        ShadowStats.SkippedBytes += 5;
+        data = reg->Value;
+        CRITICAL_SECTION_END();
+        return data;
+    }
+#endif /* RADIO_SHADOW_ENABLE */
     HAL_SUBGHZ_ReadRegisters( &hsubghz, addr, &data, 1 );
+#if( RADIO_SHADOW_ENABLE == 1 )
+    if( reg != NULL )
+    {
+        reg->Value = data;
+        reg->Valid = true;
+    }
+#endif /* RADIO_SHADOW_ENABLE */
     CRITICAL_SECTION_END();
     return data;
 }
@@ -971,6 +1117,9 @@ uint8_t SUBGRF_ReadRegister( uint16_t addr )
 void SUBGRF_WriteRegisters( uint16_t address, uint8_t *buffer, uint16_t size )
 {
     CRITICAL_SECTION_BEGIN();
+#if( RADIO_SHADOW_ENABLE == 1 )
+    Radio_ShadowInvalidateRegs( address, size );
+#endif /* RADIO_SHADOW_ENABLE */
     HAL_SUBGHZ_WriteRegisters( &hsubghz, address, buffer, size );
     CRITICAL_SECTION_END();
 }
@@ -1000,6 +1149,16 @@ void SUBGRF_WriteCommand( SUBGHZ_RadioSetCmd_t Command, uint8_t *pBuffer,
                                         uint16_t Size )
 {
     CRITICAL_SECTION_BEGIN();
+#if( RADIO_SHADOW_ENABLE == 1 )
+    if( Radio_ShadowCmd( Command, pBuffer, Size ) == true )
+    {
+        CRITICAL_SECTION_END();
+        return;
+    }
+#endif /* RADIO_SHADOW_ENABLE */
+    /* One blocking transfer per command: the radio holds BUSY until it has
+     * processed a command, so commands cannot be chained into a single DMA
+     * transfer. Unchanged configuration commands are skipped above instead. */
     HAL_SUBGHZ_ExecSetCmd( &hsubghz, Command, pBuffer, Size );
     CRITICAL_SECTION_END();
 }
@@ -1082,6 +1241,43 @@ uint32_t SUBGRF_GetRadioWakeUpTime( void )
     return RF_WAKEUP_TIME;
 }
 
+void SUBGRF_InvalidateShadow( void )
+{
+#if( RADIO_SHADOW_ENABLE == 1 )
+    CRITICAL_SECTION_BEGIN();
+    for( uint8_t i = 0; i < SHADOW_CMD_COUNT; i++ )
+    {
+        ShadowCmds[i].Size = 0;
+    }
+    Radio_ShadowInvalidateRegs( 0x0000, 0x10000 );
+    CRITICAL_SECTION_END();
+#endif /* RADIO_SHADOW_ENABLE */
+}
+
+void SUBGRF_GetShadowStats( RadioShadowStats_t *stats )
+{
+#if( RADIO_SHADOW_ENABLE == 1 )
+    /* SUBGHZSPI runs at HCLK3 / ( 2 << BR ), only the time on the bus is accounted */
+    uint32_t spiFreq = HAL_RCC_GetHCLK3Freq( ) / ( 2UL << ( hsubghz.Init.BaudratePrescaler >> SPI_CR1_BR_Pos ) );
+
+    CRITICAL_SECTION_BEGIN();
+    *stats = ShadowStats;
+    CRITICAL_SECTION_END();
+    stats->SavedTimeUs = ( uint32_t )( ( ( uint64_t )stats->SkippedBytes * 8 * 1000000 ) / spiFreq );
+#else
+    RADIO_MEMSET8( stats, 0, sizeof( RadioShadowStats_t ) );
+#endif /* RADIO_SHADOW_ENABLE */
+}
+
+void SUBGRF_ResetShadowStats( void )
+{
+#if( RADIO_SHADOW_ENABLE == 1 )
+    CRITICAL_SECTION_BEGIN();
+    RADIO_MEMSET8( &ShadowStats, 0, sizeof( RadioShadowStats_t ) );
+    CRITICAL_SECTION_END();
+#endif /* RADIO_SHADOW_ENABLE */
+}
+
 /* HAL_SUBGHz Callbacks definitions */
 void HAL_SUBGHZ_TxCpltCallback(SUBGHZ_HandleTypeDef *hsubghz)
 {
@@ -1154,6 +1350,112 @@ static void Radio_SMPS_Set(uint8_t level)
   }
 }
 
+#if( RADIO_SHADOW_ENABLE == 1 )
+static bool Radio_ShadowCmd( SUBGHZ_RadioSetCmd_t command, uint8_t *buffer, uint16_t size )
+{
+    RadioShadowCmd_t *shadow = NULL;
+
+    for( uint8_t i = 0; i < SHADOW_CMD_COUNT; i++ )
+    {
+        if( ShadowCmds[i].Command == command )
+        {
+            shadow = &ShadowCmds[i];
+            break;
+        }
+    }
+
+    if( shadow != NULL )
+    {
+        if( ( shadow->Size == size ) && ( memcmp( shadow->Buffer, buffer, size ) == 0 ) )
+        {
+            // opcode and parameters
+            ShadowStats.SkippedCommands++;
+            ShadowStats.SkippedBytes += 1 + size;
+            return true;
+        }
+        if( size <= sizeof( shadow->Buffer ) )
+        {
+            RADIO_MEMCPY8( shadow->Buffer, buffer, size );
+            shadow->Size = size;
+        }
+        else
+        {
+            shadow->Size = 0;
+        }
+    }
+
+    switch( command )
+    {
+    case RADIO_SET_PACKETTYPE:
+        // The radio resets the modem parameters when changing packet type
+        ShadowCmds[SHADOW_CMD_MODULATIONPARAMS].Size = 0;
+        ShadowCmds[SHADOW_CMD_PACKETPARAMS].Size = 0;
+        Radio_ShadowInvalidateRegs( 0x0000, 0x10000 );
+        break;
+    case RADIO_SET_MODULATIONPARAMS:
+        // Also updates the modulation registers, SUBGHZ_SDCFG0R among others
+        Radio_ShadowInvalidateRegs( 0x0000, 0x10000 );
+        break;
+    case RADIO_SET_RX:
+    case RADIO_SET_RXDUTYCYCLE:
+        // A received header overwrites the payload length
+        ShadowCmds[SHADOW_CMD_PACKETPARAMS].Size = 0;
+        break;
+    case RADIO_SET_TX:
+        if( PacketType == PACKET_TYPE_LR_FHSS )
+        {
+            // Hopping reprograms the RF frequency
+            ShadowCmds[SHADOW_CMD_RFFREQUENCY].Size = 0;
+        }
+        break;
+    case RADIO_SET_SLEEP:
+        if( ( buffer[0] & ( 1 << 2 ) ) == 0 )
+        {
+            // Cold start, the whole configuration is lost
+            for( uint8_t i = 0; i < SHADOW_CMD_COUNT; i++ )
+            {
+                ShadowCmds[i].Size = 0;
+            }
+        }
+        Radio_ShadowInvalidateRegs( 0x0000, 0x10000 );
+        break;
+    default:
+        break;
+    }
+    return false;
+}
+
+static void Radio_ShadowInvalidateRegs( uint16_t address, uint32_t size )
+{
+    for( uint8_t i = 0; i < ( sizeof( ShadowRegs ) / sizeof( ShadowRegs[0] ) ); i++ )
+    {
+        if( ( ShadowRegs[i].Address >= address ) && ( ShadowRegs[i].Address < ( address + size ) ) )
+        {
+            ShadowRegs[i].Valid = false;
+        }
+    }
+
+    // The payload length registers are also set by RADIO_SET_PACKETPARAMS
+    if( ( ( SUBGHZ_GRTXPLDLEN >= address ) && ( SUBGHZ_GRTXPLDLEN < ( address + size ) ) ) ||
+        ( ( REG_LR_PAYLOADLENGTH >= address ) && ( REG_LR_PAYLOADLENGTH < ( address + size ) ) ) )
+    {
+        ShadowCmds[SHADOW_CMD_PACKETPARAMS].Size = 0;
+    }
+}
+
+static RadioShadowReg_t *Radio_ShadowReg( uint16_t address )
+{
+    for( uint8_t i = 0; i < ( sizeof( ShadowRegs ) / sizeof( ShadowRegs[0] ) ); i++ )
+    {
+        if( ShadowRegs[i].Address == address )
+        {
+            return &ShadowRegs[i];
+        }
+    }
+    return NULL;
+}
+#endif /* RADIO_SHADOW_ENABLE */
+
 uint8_t SUBGRF_GetFskBandwidthRegValue( uint32_t bandwidth )
 {
     uint8_t i;
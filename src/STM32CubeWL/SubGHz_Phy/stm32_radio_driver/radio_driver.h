@@ -823,6 +823,17 @@ typedef enum
     RFSWITCH_TX = 1    //!< The radio is in TX
 }RFState_t;
 
+/*!
+ * \brief SUBGHZ SPI transfers skipped because they would not change the radio configuration
+ */
+typedef struct
+{
+    uint32_t SkippedCommands;                               //!< Number of radio commands not sent
+    uint32_t SkippedRegisterAccesses;                       //!< Number of register reads and writes not done
+    uint32_t SkippedBytes;                                  //!< Number of SPI bytes saved
+    uint32_t SavedTimeUs;                                   //!< SPI transfer time saved [us], without the BUSY wait and NSS toggling
+}RadioShadowStats_t;
+
 /*!
  * Hardware IO IRQ callback function definition
  */
@@ -1285,6 +1296,26 @@ uint8_t SUBGRF_SetRfTxPower( int8_t power );
  */
 uint32_t SUBGRF_GetRadioWakeUpTime( void );
 
+/*!
+ * \brief Forgets the radio configuration kept by the driver, so that the next
+ *        commands and register writes are all sent to the radio
+ *
+ * \remark To be called after the radio is reset or configured without this driver
+ */
+void SUBGRF_InvalidateShadow( void );
+
+/*!
+ * \brief Gets the SUBGHZ SPI transfers saved since the last SUBGRF_ResetShadowStats
+ *
+ * \param [out] stats        Skipped transfers counters
+ */
+void SUBGRF_GetShadowStats( RadioShadowStats_t *stats );
+
+/*!
+ * \brief Resets the counters returned by SUBGRF_GetShadowStats
+ */
+void SUBGRF_ResetShadowStats( void );
+
 /*!
  * \brief Returns the known FSK bandwidth registers value
  *
@@ -42,6 +42,7 @@ typedef struct
     uint8_t CrcFieldSize;              /* size of the packet length Field*/
     uint16_t CrcPolynomial;            /* Init Crc polynomial, to set before running RFW_CrcRun*/
     uint16_t CrcSeed;                  /* Init Crc seed to set before running RFW_CrcRun*/
+    uint16_t CrcNibbleTable[16];       /* Crc of each nibble with CrcPolynomial, used by RFW_CrcRun*/
     RADIO_FSK_CrcTypes_t CrcType;      /* Init Crc types to set before running RFW_CrcRun*/
     uint16_t WhiteSeed;                /* Init whitening seed, to set before running Radio_FwWhiteRun*/
     uint16_t LongPacketMaxRxLength;    /* Maximum expected amount of bytes in payload*/
@@ -62,6 +63,8 @@ typedef struct
     uint16_t LongPacketRemainingBytes; /* Count remaining bytes to send receive (including crc)*/
     uint8_t RadioBufferOffset;         /* Radio buffer offset*/
     uint16_t RxPayloadOffset;          /* RxPayloadOffset buffer offset*/
+    uint8_t RxLengthPending;           /* set to one from sync word detection until the packet length field is received*/
+    uint32_t RxSyncTime;               /* time of the sync word detection, reference of the packet length field deadline*/
     void ( *RxLongPacketStoreChunkCb )( uint8_t *buffer, uint8_t buffer_size );
     void ( *TxLongPacketGetNextChunkCb )( uint8_t **buffer, uint8_t buffer_size );
     uint8_t AntSwitchPaSelect;
@@ -76,6 +79,8 @@ typedef struct
 
 #define LONGPACKET_CHUNK_LENGTH_BYTES ((int32_t) 128) /* bytes (half Radio fifo) */
 
+#define RX_LENGTH_FIELD_MARGIN_MS ((uint32_t) 2) /* ms, tolerance on the reception of the packet length field */
+
 /* Private macro -------------------------------------------------------------*/
 /*!
  * @brief Calculates ceiling division of ( X / N )
@@ -219,6 +224,13 @@ uint16_t RFW_CrcRun1Byte( uint16_t Crc, uint8_t DataByte, uint16_t Polynomial );
  */
 static int32_t RFW_GetPacketLength( uint16_t *PayloadLength );
 
+/*!
+ * @brief Get the packet length field once received and program the timer of the first payload chunk
+ * @Note  when the length field is not yet in the radio buffer, the timer is programmed at its expected
+ *        reception time instead of polling the radio
+ */
+static void RFW_ReceiveLength( void );
+
 /*!
  * @brief RFW_GetPayloadTimerEvent TimerEvent to get the payload data, de-whitening, and crc verification
  *
@@ -443,6 +455,7 @@ int32_t RFW_ReceiveLongPacket( uint8_t boosted_mode, uint32_t timeout,
         SUBGRF_SetSwitch( RFWPacket.AntSwitchPaSelect, RFSWITCH_RX );
         /*init radio buffer offset*/
         RFWPacket.RadioBufferOffset = 0;
+        RFWPacket.RxLengthPending = 0;
         /* Init whitening at beginning of the packet*/
         RFW_WhiteSetState( &RFWPacket );
         /* Set the state of the Crc to crc_seed*/
@@ -651,6 +664,7 @@ int32_t RFW_ReceiveInit( void )
     RFW_CrcSetState( &RFWPacket );
 
     RFWPacket.RxPayloadOffset = 0;
+    RFWPacket.RxLengthPending = 0;
 
     RFWPacket.LongPacketModeEnable = 0;
     return 0;
@@ -672,55 +686,10 @@ void RFW_DeInit_TxLongPacket( void )
 void RFW_ReceivePayload( void )
 {
 #if (RFW_ENABLE == 1 )
-    uint16_t PayloadLength = 0;
-    if( RFW_GetPacketLength( &PayloadLength ) == 0 )
-    {
-        uint32_t timeout;
-        uint32_t packet_length = PayloadLength + RFWPacket.Init.CrcFieldSize;
-        /*record payload length*/
-        RFWPacket.PayloadLength = PayloadLength;
-        /*record remaining payload length*/
-        RFWPacket.LongPacketRemainingBytes = ( uint16_t ) packet_length;
-        /*record rx buffer offset*/
-        RFWPacket.RadioBufferOffset = RFWPacket.Init.PayloadLengthFieldSize;
-        /*if decoded PayloadLength is longer than LongPacketMaxRxLength, reject packet*/
-        if( PayloadLength > RFWPacket.Init.LongPacketMaxRxLength )
-        {
-            SUBGRF_SetStandby( STDBY_RC );
-            RFWPacket.Init.RadioEvents->RxError( );
-            return;
-        }
-        if( packet_length < LONGPACKET_CHUNK_LENGTH_BYTES )
-        {
-            /* all in one chunks*/
-            /* calculate time to end of packet*/
-            timeout = DIVC( ( packet_length ) * 8 * 1000, RFWPacket.BitRate ) + 2;
-            /**/
-            /* start timer at the end of the packet*/
-            RFW_MW_LOG( TS_ON, VLEVEL_M,  "end packet in %dms\r\n", timeout );
-
-        }
-        else if( packet_length < ( 3 * LONGPACKET_CHUNK_LENGTH_BYTES / 2 ) )
-        {
-            /* packet contained in 2 chunks*/
-            /* make sure that crc not cut in chunk*/
-            timeout = DIVR( ( packet_length * 8 * 1000 ) / 2, RFWPacket.BitRate );
-        }
-        else
-        {
-            /* packet contained in multiple chunk*/
-            /* program radio timer for first chunk*/
-            timeout = DIVR( LONGPACKET_CHUNK_LENGTH_BYTES * 8 * 1000, RFWPacket.BitRate );
-        }
-        TimerSetValue( &RFWPacket.Timer, timeout );
-        TimerStart( &RFWPacket.Timer );
-    }
-    else
-    {
-        /*timeout*/
-        SUBGRF_SetStandby( STDBY_RC );
-        RFWPacket.Init.RadioEvents->RxTimeout( );
-    }
+    /*record sync time, the packet length field is expected right after the sync word*/
+    RFWPacket.RxSyncTime = TimerGetCurrentTime( );
+    RFWPacket.RxLengthPending = 1;
+    RFW_ReceiveLength( );
 #endif /* RFW_ENABLE == 1 */
 }
 
@@ -838,6 +807,16 @@ static void RFW_CrcInitState( RFwInit_t *Init, const uint16_t CrcPolynomial, con
     Init->CrcPolynomial = CrcPolynomial;
     Init->CrcSeed = CrcSeed;
     Init->CrcType = CrcType;
+    /*precompute the crc of each nibble so that RFW_CrcRun processes 4 bits per step*/
+    for( uint32_t nibble = 0; nibble < 16; nibble++ )
+    {
+        uint16_t crc = ( uint16_t )( nibble << 12 );
+        for( uint32_t i = 0; i < 4; i++ )
+        {
+            crc = ( ( crc & 0x8000 ) != 0 ) ? ( uint16_t )( ( crc << 1 ) ^ CrcPolynomial ) : ( uint16_t )( crc << 1 );
+        }
+        Init->CrcNibbleTable[nibble] = crc;
+    }
 }
 
 static void RFW_CrcSetState( RadioFw_t *RFWPacket )
@@ -852,11 +831,11 @@ static void RFW_WhiteRun( RadioFw_t *RFWPacket, uint8_t *Payload, uint32_t Size
     for( int32_t i = 0; i < Size; i++ )
     {
         Payload[i] ^= ibmwhite_state & 0xFF;
-        for( int32_t j = 0; j < 8; j++ )
-        {
-            uint8_t msb = ( ( ibmwhite_state >> 5 ) & 0x1 ) ^ ( ( ibmwhite_state >> 0 ) & 0x1 );
-            ibmwhite_state = ( ( msb << 8 ) | ( ibmwhite_state >> 1 ) );
-        }
+        /* shift the 9 bits LFSR (x^9 + x^5 + 1) by 8 bits at once:
+           the 4 first feedback bits only depend on the current state, the 4 next ones on the 4 first*/
+        uint8_t msb = ( ibmwhite_state ^ ( ibmwhite_state >> 5 ) ) & 0x0F;
+        msb |= ( ( ibmwhite_state >> 4 ) ^ msb ) << 4;
+        ibmwhite_state = ( ( ( uint16_t ) msb << 1 ) | ( ( ibmwhite_state >> 8 ) & 0x1 ) );
     }
     RFWPacket->WhiteLfsrState = ibmwhite_state;
 }
@@ -866,12 +845,14 @@ static int32_t RFW_CrcRun( RadioFw_t *const RFWPacket, const uint8_t *Payload, c
 {
     int32_t status = 0;
     int32_t i = 0;
-    uint16_t polynomial = RFWPacket->Init.CrcPolynomial;
+    const uint16_t *table = RFWPacket->Init.CrcNibbleTable;
     /* Restore state from previous chunk*/
     uint16_t crc = RFWPacket->CrcLfsrState;
     for( i = 0; i < Size; i++ )
     {
-        crc = RFW_CrcRun1Byte( crc, Payload[i], polynomial );
+        /*same result as RFW_CrcRun1Byte, one nibble at a time*/
+        crc = ( uint16_t )( crc << 4 ) ^ table[( crc >> 12 ) ^ ( Payload[i] >> 4 )];
+        crc = ( uint16_t )( crc << 4 ) ^ table[( ( crc >> 12 ) ^ Payload[i] ) & 0x0F];
     }
     /*Save state for next chunk*/
     RFWPacket->CrcLfsrState = crc;
@@ -909,30 +890,11 @@ uint16_t RFW_CrcRun1Byte( uint16_t Crc, uint8_t DataByte, uint16_t Polynomial )
     return Crc;
 }
 
-static int32_t RFW_PollRxBytes( uint32_t bytes )
-{
-    uint32_t now = TimerGetCurrentTime( );
-    uint8_t reg_buff_ptr_ref = SUBGRF_ReadRegister( SUBGHZ_RXADRPTR );
-    uint8_t reg_buff_ptr = reg_buff_ptr_ref;
-    uint32_t timeout = DIVC( bytes * 8 * 1000, RFWPacket.BitRate );
-    /* Wait that packet length is received */
-    while( ( reg_buff_ptr - reg_buff_ptr_ref ) < bytes )
-    {
-        /*reading rx address pointer*/
-        reg_buff_ptr = SUBGRF_ReadRegister( SUBGHZ_RXADRPTR );
-        if( TimerGetElapsedTime( now ) > timeout )
-        {
-            /*timeout*/
-            return -1;
-        }
-    }
-    return 0;
-}
-
 static int32_t RFW_GetPacketLength( uint16_t *PayloadLength )
 {
-    if( 0UL != RFW_PollRxBytes( RFWPacket.Init.PayloadLengthFieldSize ) )
+    if( SUBGRF_ReadRegister( SUBGHZ_RXADRPTR ) < RFWPacket.Init.PayloadLengthFieldSize )
     {
+        /*packet length field not yet received*/
         return -1;
     }
     /* Get buffer from Radio*/
@@ -959,6 +921,71 @@ static int32_t RFW_GetPacketLength( uint16_t *PayloadLength )
     return 0;
 }
 
+static void RFW_ReceiveLength( void )
+{
+    uint16_t PayloadLength = 0;
+    uint32_t timeout;
+    uint32_t packet_length;
+    if( RFW_GetPacketLength( &PayloadLength ) != 0 )
+    {
+        uint32_t elapsed = TimerGetElapsedTime( RFWPacket.RxSyncTime );
+        timeout = DIVC( RFWPacket.Init.PayloadLengthFieldSize * 8 * 1000, RFWPacket.BitRate );
+        if( elapsed > timeout + RX_LENGTH_FIELD_MARGIN_MS )
+        {
+            /*timeout*/
+            RFWPacket.RxLengthPending = 0;
+            SUBGRF_SetStandby( STDBY_RC );
+            RFWPacket.Init.RadioEvents->RxTimeout( );
+        }
+        else
+        {
+            /* sleep until the packet length field is expected, then check again*/
+            TimerSetValue( &RFWPacket.Timer, ( elapsed < timeout ) ? ( timeout - elapsed ) : 1 );
+            TimerStart( &RFWPacket.Timer );
+        }
+        return;
+    }
+    RFWPacket.RxLengthPending = 0;
+    packet_length = PayloadLength + RFWPacket.Init.CrcFieldSize;
+    /*record payload length*/
+    RFWPacket.PayloadLength = PayloadLength;
+    /*record remaining payload length*/
+    RFWPacket.LongPacketRemainingBytes = ( uint16_t ) packet_length;
+    /*record rx buffer offset*/
+    RFWPacket.RadioBufferOffset = RFWPacket.Init.PayloadLengthFieldSize;
+    /*if decoded PayloadLength is longer than LongPacketMaxRxLength, reject packet*/
+    if( PayloadLength > RFWPacket.Init.LongPacketMaxRxLength )
+    {
+        SUBGRF_SetStandby( STDBY_RC );
+        RFWPacket.Init.RadioEvents->RxError( );
+        return;
+    }
+    if( packet_length < LONGPACKET_CHUNK_LENGTH_BYTES )
+    {
+        /* all in one chunks*/
+        /* calculate time to end of packet*/
+        timeout = DIVC( ( packet_length ) * 8 * 1000, RFWPacket.BitRate ) + 2;
+        /**/
+        /* start timer at the end of the packet*/
+        RFW_MW_LOG( TS_ON, VLEVEL_M,  "end packet in %dms\r\n", timeout );
+
+    }
+    else if( packet_length < ( 3 * LONGPACKET_CHUNK_LENGTH_BYTES / 2 ) )
+    {
+        /* packet contained in 2 chunks*/
+        /* make sure that crc not cut in chunk*/
+        timeout = DIVR( ( packet_length * 8 * 1000 ) / 2, RFWPacket.BitRate );
+    }
+    else
+    {
+        /* packet contained in multiple chunk*/
+        /* program radio timer for first chunk*/
+        timeout = DIVR( LONGPACKET_CHUNK_LENGTH_BYTES * 8 * 1000, RFWPacket.BitRate );
+    }
+    TimerSetValue( &RFWPacket.Timer, timeout );
+    TimerStart( &RFWPacket.Timer );
+}
+
 static void RFW_GetPayloadTimerEvent( void *context )
 {
     RFW_GET_PAYLOAD_PROCESS();
@@ -966,6 +993,12 @@ static void RFW_GetPayloadTimerEvent( void *context )
 
 static void RFW_GetPayloadProcess( void )
 {
+    if( RFWPacket.RxLengthPending == 1 )
+    {
+        /*packet length field deadline*/
+        RFW_ReceiveLength( );
+        return;
+    }
     /*long packet mode*/
     uint8_t read_ptr = SUBGRF_ReadRegister( SUBGHZ_RXADRPTR );
     uint8_t size = read_ptr - RFWPacket.RadioBufferOffset;
@@ -1002,7 +1035,7 @@ static void RFW_GetPayloadProcess( void )
         }
         else
         {
-            if( RFWPacket.RxPayloadOffset += size < RADIO_BUF_SIZE )
+            if( RFWPacket.RxPayloadOffset + size < RADIO_BUF_SIZE )
             {
                 RADIO_MEMCPY8( &RxBuffer[RFWPacket.RxPayloadOffset], ChunkBuffer, size );
                 RFWPacket.RxPayloadOffset += size;
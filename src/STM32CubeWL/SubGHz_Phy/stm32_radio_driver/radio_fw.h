@@ -119,7 +119,7 @@ int32_t RFW_TransmitInit( uint8_t *inOutBuffer, uint8_t size, uint8_t *outSize )
 
 /*!
  * @brief Starts receiving payload. Called at Rx Sync IRQ
- *
+ * @note  does not wait for the packet length field: payload is then fetched chunk by chunk on timer events
  */
 void RFW_ReceivePayload( void );
 
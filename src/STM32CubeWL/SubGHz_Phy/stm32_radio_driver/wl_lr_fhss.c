@@ -80,6 +80,18 @@
  * --- PRIVATE VARIABLES -------------------------------------------------------
  */
 
+#if( WL_LR_FHSS_HOP_CACHE_SIZE > 0 )
+/*!
+ * @brief Precomputed hop sequences, replaced in round-robin order
+ */
+static wl_lr_fhss_hop_cache_entry_t wl_lr_fhss_hop_cache[WL_LR_FHSS_HOP_CACHE_SIZE];
+
+/*!
+ * @brief Index of the hop cache entry that will be replaced next
+ */
+static uint8_t wl_lr_fhss_hop_cache_next_entry;
+#endif
+
 /*
  * -----------------------------------------------------------------------------
  * --- PRIVATE FUNCTION DECLARATIONS -------------------------------------------
@@ -129,6 +141,19 @@ uint32_t wl_lr_fhss_get_next_freq_in_pll_steps( const wl_lr_fhss_params_t *param
  */
 static inline unsigned int wl_lr_fhss_get_grid_in_pll_steps( const wl_lr_fhss_params_t *params );
 
+#if( WL_LR_FHSS_HOP_CACHE_SIZE > 0 )
+/*!
+ * @brief Find a precomputed hop sequence in the hop cache
+ *
+ * @param [in]  params          LR-FHSS parameter structure
+ * @param [in]  hop_sequence_id Hop sequence to look up
+ *
+ * @returns Cache entry for this hop sequence, or NULL if it is not cached
+ */
+static const wl_lr_fhss_hop_cache_entry_t *wl_lr_fhss_hop_cache_lookup( const lr_fhss_v1_params_t *params,
+                                                                        uint16_t hop_sequence_id );
+#endif
+
 /*
  * -----------------------------------------------------------------------------
  * --- PUBLIC FUNCTIONS DEFINITION ---------------------------------------------
@@ -180,19 +205,32 @@ radio_status_t wl_lr_fhss_process_parameters( const wl_lr_fhss_params_t *params,
 
     // Initialize hop index and params
     state->current_hop = 0;
-    radio_status_t status =
-        lr_fhss_get_hop_params( &params->lr_fhss_params, &state->hop_params, &state->lfsr_state, hop_sequence_id );
-    if( status != RADIO_STATUS_OK )
+#if( WL_LR_FHSS_HOP_CACHE_SIZE > 0 )
+    state->hop_cache       = wl_lr_fhss_hop_cache_lookup( &params->lr_fhss_params, hop_sequence_id );
+    state->hop_cache_index = 0;
+    if( state->hop_cache != NULL )
     {
-        return ( radio_status_t ) status;
+        // Hop frequencies come from the cache, the LFSR state is only used past its end
+        state->hop_params = state->hop_cache->hop_params;
+        state->lfsr_state = state->hop_cache->lfsr_state;
     }
-
-    // Skip the hop frequencies inside the set [0, 4 - header_count):
-    if( params->lr_fhss_params.enable_hopping != 0 )
+    else
+#endif
     {
-        for( int i = 0; i < 4 - params->lr_fhss_params.header_count; ++i )
+        radio_status_t status = lr_fhss_get_hop_params( &params->lr_fhss_params, &state->hop_params,
+                                                        &state->lfsr_state, hop_sequence_id );
+        if( status != RADIO_STATUS_OK )
         {
-            lr_fhss_get_next_state( &state->lfsr_state, &state->hop_params );
+            return ( radio_status_t ) status;
+        }
+
+        // Skip the hop frequencies inside the set [0, 4 - header_count):
+        if( params->lr_fhss_params.enable_hopping != 0 )
+        {
+            for( int i = 0; i < 4 - params->lr_fhss_params.header_count; ++i )
+            {
+                lr_fhss_get_next_state( &state->lfsr_state, &state->hop_params );
+            }
         }
     }
 
@@ -352,6 +390,66 @@ radio_status_t wl_lr_fhss_handle_tx_done( const wl_lr_fhss_params_t *params,
     return RADIO_STATUS_OK;
 }
 
+radio_status_t wl_lr_fhss_hop_cache_fill( const lr_fhss_v1_params_t *params, uint16_t hop_sequence_id )
+{
+#if( WL_LR_FHSS_HOP_CACHE_SIZE > 0 )
+    if( params->enable_hopping == 0 )
+    {
+        return RADIO_STATUS_OK;
+    }
+
+    // The entry is replaced even when the sequence is already cached, so that the entries are replaced in the
+    // order the sequences are filled (i.e. used) by the caller
+    wl_lr_fhss_hop_cache_entry_t       *entry  = &wl_lr_fhss_hop_cache[wl_lr_fhss_hop_cache_next_entry];
+    const wl_lr_fhss_hop_cache_entry_t *cached = wl_lr_fhss_hop_cache_lookup( params, hop_sequence_id );
+    wl_lr_fhss_hop_cache_next_entry = ( wl_lr_fhss_hop_cache_next_entry + 1 ) % WL_LR_FHSS_HOP_CACHE_SIZE;
+
+    if( cached != NULL )
+    {
+        if( cached != entry )
+        {
+            *entry = *cached;
+        }
+        return RADIO_STATUS_OK;
+    }
+
+    // Invalidate the entry while it is being filled
+    entry->nb_hops = 0;
+
+    radio_status_t status = lr_fhss_get_hop_params( params, &entry->hop_params, &entry->lfsr_state, hop_sequence_id );
+    if( status != RADIO_STATUS_OK )
+    {
+        return status;
+    }
+
+    // Skip the hop frequencies inside the set [0, 4 - header_count), like wl_lr_fhss_process_parameters
+    for( int i = 0; i < 4 - params->header_count; ++i )
+    {
+        lr_fhss_get_next_state( &entry->lfsr_state, &entry->hop_params );
+    }
+
+    for( int i = 0; i < WL_LR_FHSS_HOP_CACHE_MAX_HOPS; ++i )
+    {
+        entry->freq_in_grid[i] = lr_fhss_get_next_freq_in_grid( &entry->lfsr_state, &entry->hop_params, params );
+    }
+
+    entry->lr_fhss_params = *params;
+    entry->nb_hops        = WL_LR_FHSS_HOP_CACHE_MAX_HOPS;
+#endif
+    return RADIO_STATUS_OK;
+}
+
+void wl_lr_fhss_hop_cache_clear( void )
+{
+#if( WL_LR_FHSS_HOP_CACHE_SIZE > 0 )
+    for( int i = 0; i < WL_LR_FHSS_HOP_CACHE_SIZE; ++i )
+    {
+        wl_lr_fhss_hop_cache[i].nb_hops = 0;
+    }
+    wl_lr_fhss_hop_cache_next_entry = 0;
+#endif
+}
+
 /*
  * -----------------------------------------------------------------------------
  * --- PRIVATE FUNCTIONS DEFINITION --------------------------------------------
@@ -395,8 +493,17 @@ uint32_t wl_lr_fhss_get_next_freq_in_pll_steps( const wl_lr_fhss_params_t *param
     const int16_t freq_table  = 0;
     uint32_t      grid_offset = 0;
 #else
-    const int16_t freq_table =
-        lr_fhss_get_next_freq_in_grid( &state->lfsr_state, &state->hop_params, &params->lr_fhss_params );
+    int16_t freq_table;
+#if( WL_LR_FHSS_HOP_CACHE_SIZE > 0 )
+    if( ( state->hop_cache != NULL ) && ( state->hop_cache_index < state->hop_cache->nb_hops ) )
+    {
+        freq_table = state->hop_cache->freq_in_grid[state->hop_cache_index++];
+    }
+    else
+#endif
+    {
+        freq_table = lr_fhss_get_next_freq_in_grid( &state->lfsr_state, &state->hop_params, &params->lr_fhss_params );
+    }
     uint32_t nb_channel_in_grid = params->lr_fhss_params.grid ? 8 : 52;
     uint32_t grid_offset        = ( 1 + ( state->hop_params.n_grid % 2 ) ) * ( nb_channel_in_grid / 2 );
 #endif
@@ -425,6 +532,31 @@ static inline unsigned int wl_lr_fhss_get_grid_in_pll_steps( const wl_lr_fhss_pa
     return ( params->lr_fhss_params.grid == LR_FHSS_V1_GRID_3906_HZ ) ? WL_LR_FHSS_GRID_3906_HZ_PLL_STEPS : WL_LR_FHSS_GRID_25391_HZ_PLL_STEPS;
 }
 
+#if( WL_LR_FHSS_HOP_CACHE_SIZE > 0 )
+static const wl_lr_fhss_hop_cache_entry_t *wl_lr_fhss_hop_cache_lookup( const lr_fhss_v1_params_t *params,
+                                                                        uint16_t hop_sequence_id )
+{
+    // Newest entry first: when a sequence is cached twice, the oldest copy is the next one to be replaced, possibly
+    // during the transmission that uses the sequence
+    for( int i = 1; i <= WL_LR_FHSS_HOP_CACHE_SIZE; ++i )
+    {
+        const wl_lr_fhss_hop_cache_entry_t *entry =
+            &wl_lr_fhss_hop_cache[( wl_lr_fhss_hop_cache_next_entry + WL_LR_FHSS_HOP_CACHE_SIZE - i ) %
+                                  WL_LR_FHSS_HOP_CACHE_SIZE];
+
+        // The hop sequence only depends on these parameters (and not on e.g. the coding rate or sync word)
+        if( ( entry->nb_hops != 0 ) && ( entry->hop_params.hop_sequence_id == hop_sequence_id ) &&
+            ( entry->lr_fhss_params.grid == params->grid ) && ( entry->lr_fhss_params.bw == params->bw ) &&
+            ( entry->lr_fhss_params.enable_hopping == params->enable_hopping ) &&
+            ( entry->lr_fhss_params.header_count == params->header_count ) )
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+#endif
+
 /* --- EOF ------------------------------------------------------------------ */
 
 #pragma GCC diagnostic pop
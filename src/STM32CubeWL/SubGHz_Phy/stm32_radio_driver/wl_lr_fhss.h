@@ -60,6 +60,23 @@
 #define WL_LR_FHSS_REG_NUM_SYMBOLS_0 ( 0x0388 )
 #define WL_LR_FHSS_REG_FREQ_0 ( 0x038A )
 
+/*!
+ * @brief Number of hop sequences kept in the hop cache, 0 to disable it
+ *
+ * @remark Can be overridden in radio_conf.h
+ */
+#ifndef WL_LR_FHSS_HOP_CACHE_SIZE
+#define WL_LR_FHSS_HOP_CACHE_SIZE ( 0 )
+#endif
+
+/*!
+ * @brief Number of hops stored per cached hop sequence
+ *
+ * @remark This covers the largest frame that fits in LR_FHSS_MAX_PHY_PAYLOAD_BYTES, further hops would be computed
+ * from the LFSR state stored with the sequence.
+ */
+#define WL_LR_FHSS_HOP_CACHE_MAX_HOPS ( 40 )
+
 /*
  * -----------------------------------------------------------------------------
  * --- PUBLIC TYPES ------------------------------------------------------------
@@ -77,6 +94,19 @@ typedef struct wl_lr_fhss_params_s
                                         //<! - if (lr_fhss_params.grid == LR_FHSS_V1_GRID_3906_HZ): [-4, 3]
 } wl_lr_fhss_params_t;
 
+/*!
+ * @brief STM32WL LR-FHSS precomputed hop sequence, see @ref wl_lr_fhss_hop_cache_fill
+ */
+typedef struct wl_lr_fhss_hop_cache_entry_s
+{
+    lr_fhss_v1_params_t  lr_fhss_params;  /**< Parameters the sequence was computed for, only grid, bw,
+                                               enable_hopping and header_count are relevant */
+    lr_fhss_hop_params_t hop_params;      /**< Hop parameters, including the hop sequence ID */
+    uint16_t             lfsr_state;      /**< LFSR state after the last cached hop */
+    uint8_t              nb_hops;         /**< Number of valid entries in freq_in_grid, 0 for an unused entry */
+    int16_t              freq_in_grid[WL_LR_FHSS_HOP_CACHE_MAX_HOPS]; /**< Hop frequencies, in grid units */
+} wl_lr_fhss_hop_cache_entry_t;
+
 /*!
  * @brief STM32WL LR-FHSS LR-FHSS state definition
  */
@@ -87,6 +117,10 @@ typedef struct wl_lr_fhss_state_s
     uint32_t             next_freq_in_pll_steps; /**< Frequency that will be used on next hop */
     uint16_t             lfsr_state;             /**< LFSR state for hop sequence generation */
     uint8_t              current_hop;            /**< Index of the current hop */
+#if( WL_LR_FHSS_HOP_CACHE_SIZE > 0 )
+    const wl_lr_fhss_hop_cache_entry_t *hop_cache;       /**< Cached hop sequence in use, or NULL */
+    uint8_t                             hop_cache_index; /**< Index of the next hop to take from hop_cache */
+#endif
 } wl_lr_fhss_state_t;
 
 /*
@@ -203,6 +237,28 @@ radio_status_t wl_lr_fhss_handle_hop( const wl_lr_fhss_params_t *params,
 radio_status_t wl_lr_fhss_handle_tx_done( const wl_lr_fhss_params_t *params,
                                           wl_lr_fhss_state_t *state );
 
+/*!
+ * @brief Precompute a hop sequence and store it in the hop cache
+ *
+ * @param [in]  params          LR-FHSS parameter structure
+ * @param [in]  hop_sequence_id Hop sequence to precompute
+ *
+ * @remark This is meant to be called for the hop sequence IDs that will be used by the next transmissions, e.g. right
+ * after starting a transmission so the computation is done while it is on air. @ref wl_lr_fhss_process_parameters then takes the hop frequencies from the cache instead of stepping
+ * the LFSR. The oldest entry is replaced, even when the sequence is already cached (it is then copied), so that
+ * the entries are replaced in the order they are filled. This must thus not be called for more than
+ * WL_LR_FHSS_HOP_CACHE_SIZE - 1 sequences during a transmission. This is a no-op when hopping is disabled, or
+ * when WL_LR_FHSS_HOP_CACHE_SIZE is 0.
+ *
+ * @returns Operation status
+ */
+radio_status_t wl_lr_fhss_hop_cache_fill( const lr_fhss_v1_params_t *params, uint16_t hop_sequence_id );
+
+/*!
+ * @brief Drop all entries from the hop cache
+ */
+void wl_lr_fhss_hop_cache_clear( void );
+
 /*!
  * @brief Get the time on air in ms for LR-FHSS transmission
  *
@@ -39,6 +39,7 @@
 
 #include "STM32LoRaWAN.h"
 #include "STM32CubeWL/LoRaWAN/Mac/LoRaMacTest.h"
+#include "STM32CubeWL/LoRaWAN/Mac/Region/Region.h"
 #include <core_debug.h>
 
 // The MKRWAN API has no constants for datarates, so just accepts 0 for
@@ -66,6 +67,12 @@ bool STM32LoRaWAN::begin(_lora_band band)
   }
   instance = this;
 
+#if STM32LORAWAN_REQUEST_QUEUE_SIZE > 0
+  for (uint32_t i = 0; i < STM32LORAWAN_REQUEST_QUEUE_SIZE; ++i) {
+    requests[i].seq.store(i, std::memory_order_relaxed);
+  }
+#endif
+
   /*
    * Init RTC as an object :
    * use the MIX mode = free running BCD calendar + binary mode for
@@ -79,6 +86,15 @@ bool STM32LoRaWAN::begin(_lora_band band)
   /* The subsecond alarm B is set during the StartTimerEvent */
 
   UTIL_TIMER_Init(_rtc.getHandle());
+#if STM32LORAWAN_TX_QUEUE_SIZE > 0
+  UTIL_TIMER_Create(&tx_queue_timer, 0, UTIL_TIMER_ONESHOT, TxQueueTimerCallback, NULL);
+#endif
+#if STM32LORAWAN_RECORD_BUFFER_SIZE > 0
+  UTIL_TIMER_Create(&agg_timer, 0, UTIL_TIMER_ONESHOT, AggregationTimerCallback, NULL);
+#endif
+  UTIL_TIMER_Create(&join_timer, 0, UTIL_TIMER_ONESHOT, JoinTimerCallback, NULL);
+
+  region = (LoRaMacRegion_t)band;
 
   LoRaMacStatus_t res = LoRaMacInitialization(&LoRaMacPrimitives, &LoRaMacCallbacks, (LoRaMacRegion_t)band);
   if (res != LORAMAC_STATUS_OK) {
@@ -141,21 +157,267 @@ uint8_t STM32LoRaWAN::GetBatteryLevel()
   return battery_level;
 }
 
+#if STM32LORAWAN_TX_QUEUE_SIZE > 0
+void STM32LoRaWAN::TxQueueTimerCallback(void * /* context */)
+{
+  // Called from an ISR when the duty cycle allows the next queued
+  // packet to be sent, so let maintain() process the queue
+  instance->tx_queue_waiting = false;
+  MacProcessNotify();
+}
+#endif
+
+#if STM32LORAWAN_RECORD_BUFFER_SIZE > 0
+void STM32LoRaWAN::AggregationTimerCallback(void * /* context */)
+{
+  // Called from an ISR when the pending packet of records must be sent
+  instance->agg_flush_pending = true;
+  MacProcessNotify();
+}
+#endif
+
 void STM32LoRaWAN::maintain()
 {
-  if (mac_process_pending) {
-    mac_process_pending = false;
+  if (mac_process_pending.exchange(false)) {
     LoRaMacProcess();
+    if (learned_sub_band >= 0) {
+      // A channel mask of the network (in the CFList of the
+      // JoinAccept) or of the sketch takes precedence
+      if (allSubBandsEnabled() && setSubBand(learned_sub_band)) {
+        sub_band_learned = true;
+      }
+      learned_sub_band = -1;
+    }
+    processCompletions();
+#if STM32LORAWAN_REQUEST_QUEUE_SIZE > 0
+    processRequests();
+#endif
+#if STM32LORAWAN_TX_QUEUE_SIZE > 0
+    // Process the uplink queue first, so it has room for the records
+    processTxQueue();
+#endif
+#if STM32LORAWAN_RECORD_BUFFER_SIZE > 0
+    if (agg_flush_pending) {
+      flushRecords();
+    }
+#endif
+  }
+  release_read_rx();
+}
+
+void STM32LoRaWAN::processCompletions()
+{
+  // Callbacks are cleared before calling them, so they can start a new
+  // operation with a new callback.
+  if (join_done) {
+    join_done = false;
+    CompletionCallback callback = join_callback;
+    join_callback = nullptr;
+    if (callback) {
+      callback(join_result);
+    }
+  }
+
+  if (tx_done) {
+    tx_done = false;
+    CompletionCallback callback = tx_callback;
+    tx_callback = nullptr;
+    if (callback) {
+      callback(tx_result);
+    }
+  }
+}
+
+#if STM32LORAWAN_REQUEST_QUEUE_SIZE > 0
+STM32LoRaWAN::Request *STM32LoRaWAN::reserveRequest(uint32_t *pos)
+{
+  static_assert((STM32LORAWAN_REQUEST_QUEUE_SIZE & (STM32LORAWAN_REQUEST_QUEUE_SIZE - 1)) == 0, "STM32LORAWAN_REQUEST_QUEUE_SIZE must be a power of two");
+
+  // Claim the entry at the enqueue position, unless another producer
+  // claimed it first (then retry at the new position) or the consumer
+  // did not free it yet (then the queue is full).
+  uint32_t cur = request_enqueue_pos.load(std::memory_order_relaxed);
+  while (true) {
+    Request *request = &requests[cur % STM32LORAWAN_REQUEST_QUEUE_SIZE];
+    int32_t diff = (int32_t)(request->seq.load(std::memory_order_acquire) - cur);
+    if (diff == 0) {
+      if (request_enqueue_pos.compare_exchange_weak(cur, cur + 1, std::memory_order_relaxed)) {
+        *pos = cur;
+        return request;
+      }
+    } else if (diff < 0) {
+      return nullptr;
+    } else {
+      cur = request_enqueue_pos.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void STM32LoRaWAN::commitRequest(Request *request, uint32_t pos)
+{
+  if (request->slot) {
+    request->slot->done.store(false, std::memory_order_relaxed);
+  }
+  request->seq.store(pos + 1, std::memory_order_release);
+  // Let the LoRa task call maintain(). This calls the maintain needed
+  // callback from the posting task rather than from an ISR, as
+  // documented for the post methods.
+  MacProcessNotify();
+}
+
+bool STM32LoRaWAN::postSend(uint8_t port, const uint8_t *payload, size_t size, bool confirmed, RequestSlot *slot)
+{
+  // No messages are printed here, since this may run in any task
+  if (size > sizeof(requests[0].payload)) {
+    return false;
+  }
+
+  uint32_t pos;
+  Request *request = reserveRequest(&pos);
+  if (!request) {
+    return false;
+  }
+
+  request->type = REQUEST_SEND;
+  request->port = port;
+  request->confirmed = confirmed;
+  request->len = size;
+  request->slot = slot;
+  memcpy(request->payload, payload, size);
+  commitRequest(request, pos);
+  return true;
+}
+
+bool STM32LoRaWAN::postJoin(RequestSlot *slot)
+{
+  uint32_t pos;
+  Request *request = reserveRequest(&pos);
+  if (!request) {
+    return false;
+  }
+
+  request->type = REQUEST_JOIN;
+  request->slot = slot;
+  commitRequest(request, pos);
+  return true;
+}
+
+bool STM32LoRaWAN::postMib(MibRequestConfirm_t *mibReq, bool set, RequestSlot *slot)
+{
+  uint32_t pos;
+  Request *request = reserveRequest(&pos);
+  if (!request) {
+    return false;
+  }
+
+  request->type = set ? REQUEST_MIB_SET : REQUEST_MIB_GET;
+  request->mib = mibReq;
+  request->slot = slot;
+  commitRequest(request, pos);
+  return true;
+}
+
+void STM32LoRaWAN::completeRequest(RequestSlot *slot, const Completion &result)
+{
+  if (slot) {
+    slot->result = result;
+    slot->done.store(true, std::memory_order_release);
   }
 }
 
+void STM32LoRaWAN::processRequests()
+{
+  // Requests are executed in the order they were posted, so one that
+  // must wait for the stack holds back the requests after it.
+  while (true) {
+    Request &request = requests[request_dequeue_pos % STM32LORAWAN_REQUEST_QUEUE_SIZE];
+    if (request.seq.load(std::memory_order_acquire) != request_dequeue_pos + 1) {
+      // Empty, or the producer did not finish filling this entry yet
+      // (it will notify again once it did)
+      return;
+    }
+
+    RequestSlot *slot = request.slot;
+    Completion result = {};
+    result.status = LORAMAC_EVENT_INFO_STATUS_ERROR;
+
+    switch (request.type) {
+      case REQUEST_SEND:
+      case REQUEST_JOIN:
+        if (busy() || reserved_tx_buf) {
+          // Retried when the stack notifies it is done, or when the
+          // reserved packet buffer is committed
+          return;
+        }
+        if (request.type == REQUEST_SEND) {
+          // The stack copies the payload, so the entry can be freed below
+          LoRaMacStatus_t res = requestUplink(request.port, request.payload, request.len, request.confirmed, /* allowDelayedTx */ true, nullptr);
+          if (res == LORAMAC_STATUS_BUSY) {
+            // The stack is flushing pending MAC commands first, retried
+            // when it notifies it is done
+            return;
+          }
+          if (res == LORAMAC_STATUS_OK) {
+            tx_callback = [slot](const Completion & c) { completeRequest(slot, c); };
+            slot = nullptr;
+          }
+        } else {
+          if (joinOTAAAsync([slot](const Completion & c) { completeRequest(slot, c); })) {
+            slot = nullptr;
+          }
+        }
+        break;
+      case REQUEST_MIB_GET:
+        if (LoRaMacMibGetRequestConfirm(request.mib) == LORAMAC_STATUS_OK) {
+          result.status = LORAMAC_EVENT_INFO_STATUS_OK;
+        }
+        break;
+      case REQUEST_MIB_SET:
+        if (LoRaMacMibSetRequestConfirm(request.mib) == LORAMAC_STATUS_OK) {
+          result.status = LORAMAC_EVENT_INFO_STATUS_OK;
+        }
+        break;
+    }
+
+    // Still set when the request completed (or failed) right away
+    completeRequest(slot, result);
+
+    request.seq.store(request_dequeue_pos + STM32LORAWAN_REQUEST_QUEUE_SIZE, std::memory_order_release);
+    request_dequeue_pos++;
+  }
+}
+#endif
+
 void STM32LoRaWAN::maintainUntilIdle()
 {
   do {
     maintain();
+    sleepUntilMaintainNeeded();
   } while (busy());
 }
 
+void STM32LoRaWAN::sleepUntilMaintainNeeded()
+{
+  // Everything the stack waits for (radio IRQ, RTC alarm for the RX
+  // windows and other MAC timers) arrives as an interrupt that ends up
+  // in MacProcessNotify(), so the core can be stopped until the next
+  // interrupt.
+  sleepWhile(&STM32LoRaWAN::busy);
+}
+
+void STM32LoRaWAN::sleepWhile(bool (STM32LoRaWAN::*condition)())
+{
+  // Interrupts are masked while checking, so one that fires just
+  // before the WFI is not lost: a pending interrupt still wakes up the
+  // core and is serviced once they are unmasked again.
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  if (!mac_process_pending && (this->*condition)()) {
+    __WFI();
+  }
+  __set_PRIMASK(primask);
+}
+
 bool STM32LoRaWAN::continuousWave(uint32_t frequency, int8_t powerdBm,
                                   uint16_t timeout)
 {
@@ -172,7 +434,13 @@ bool STM32LoRaWAN::continuousWave(uint32_t frequency, int8_t powerdBm,
   return true;
 }
 
-bool STM32LoRaWAN::joinOTAAAsync()
+bool STM32LoRaWAN::joinOTAAAsync(CompletionCallback callback)
+{
+  // Just use the most recently configured datarate for join
+  return requestJoin(getDataRate(), callback);
+}
+
+bool STM32LoRaWAN::requestJoin(int8_t dr, CompletionCallback callback)
 {
   clear_rx();
   this->fcnt_up = 0;
@@ -180,8 +448,7 @@ bool STM32LoRaWAN::joinOTAAAsync()
 
   MlmeReq_t mlmeReq;
   mlmeReq.Type = MLME_JOIN;
-  // Just use the most recently configured datarate for join
-  mlmeReq.Req.Join.Datarate = getDataRate();
+  mlmeReq.Req.Join.Datarate = dr;
   mlmeReq.Req.Join.NetworkActivation = ACTIVATION_TYPE_OTAA;
 
   // Starts the OTAA join procedure
@@ -190,42 +457,105 @@ bool STM32LoRaWAN::joinOTAAAsync()
     return failure("Join request failed: %s\r\n", toString(res));
   }
 
+  join_callback = callback;
+  join_stats.total_attempts++;
   return true;
 }
 
 bool STM32LoRaWAN::joinOTAA()
 {
   unsigned long start = millis();
+  uint32_t backoff = JOIN_BACKOFF_MIN;
+  uint16_t attempts = 0;
+
+  // The datarate that worked last time is the most likely to work
+  // again (e.g. when rejoining after losing the network). The join
+  // datarate is only passed with the join requests, but the stack
+  // also applies it to the uplinks, so the configured datarate is
+  // restored afterwards.
+  int user_dr = getDataRate();
+  int8_t dr = join_dr >= 0 ? join_dr : user_dr;
+
+  while (true) {
+    bool attempted = requestJoin(dr, nullptr);
+    if (attempted) {
+      attempts++;
+      // TODO: Should this cancel a pending join attempt if the timeout
+      // runs out?
+      maintainUntilIdle();
+    }
 
-  do {
-    // TODO: Should this decrease datarate after a few failed attempts?
-    // MKRWAN has an older version of LoRaMAC-node that handles this
-    // in a region-dependent way (usually decreasing datarate every
-    // 8 attempts). Our newer version of LoRaMAC-node just uses the
-    // configured datarate, except for some regions (US915/AU915/AS923)
-    // where the regional parameters prescribe what datarate to use for
-    // joins.
-    // See https://github.com/Lora-net/LoRaMac-node/commit/bec887dd2414b091fe62277ed57d0166f77a5055
-    // for the change in LoRaMAC-node.
-    //
-    // With a timeout of only 60s, increasing the DR only every
-    // 8 attempts is probably not helpful, so maybe more often? Or maybe
-    // leave it to the sketch to increase DR every batch of 60s? Note
-    // that we (or the sketch) can probably freely just increase the DR
-    // without worrying about region-specific limits, since if we go
-    // outside regional DR limits, the stack will just refuse to set the
-    // DR.
-    // Or maybe use PHY_NEXT_LOWER_TX_DR
-    joinOTAAAsync();
-
-    // TODO: Should this cancel a pending join attempt if the timeout
-    // runs out?
-    maintainUntilIdle();
-  } while (!connected() && (millis() - start < DEFAULT_JOIN_TIMEOUT));
+    unsigned long elapsed = millis() - start;
+    if (connected() || elapsed >= DEFAULT_JOIN_TIMEOUT) {
+      break;
+    }
+
+    if (attempted && sub_band_learned && attempts == JOIN_ATTEMPTS_PER_SUB_BAND) {
+      // The gateways that used to hear the learned sub-band seem to
+      // be gone, so probe all sub-bands again.
+      setSubBand(-1);
+    }
+
+    // Every few attempts, fall back to the next lower datarate (which
+    // has a longer range). The stack ignores this for regions where
+    // the regional parameters prescribe the join datarates
+    // (US915/AU915/AS923), and picks the join channels (cycling
+    // through the US915/AU915 sub-bands) itself.
+    if (attempted && attempts % JOIN_ATTEMPTS_PER_DR == 0) {
+      GetPhyParams_t getPhy = {};
+      getPhy.Attribute = PHY_NEXT_LOWER_TX_DR;
+      getPhy.Datarate = dr;
+      getPhy.UplinkDwellTime = 0;
+      PhyParam_t phyParam = RegionGetPhyParam(region, &getPhy);
+      dr = phyParam.Value;
+    }
+
+    // Randomize the delay, to prevent devices that were reset together
+    // (e.g. by a power outage) from keeping to collide, and back off
+    // exponentially. The stack enforces the join duty cycle itself on
+    // top of this. The delay never extends past the timeout.
+    uint32_t remaining = DEFAULT_JOIN_TIMEOUT - elapsed;
+    uint32_t wait = backoff / 2 + random(backoff / 2);
+    if (wait > remaining) {
+      wait = remaining;
+    }
+    joinBackoff(wait);
+    if (millis() - start >= DEFAULT_JOIN_TIMEOUT) {
+      // The delay used up the remaining time, do not start an attempt
+      // that would run past the timeout
+      break;
+    }
+    if (backoff < JOIN_BACKOFF_MAX) {
+      backoff *= 2;
+    }
+  }
 
+  if (user_dr >= 0) {
+    // Not through dataRate(), which would forget join_dr
+    mibSetInt8("dataRate", MIB_CHANNELS_DATARATE, user_dr);
+  }
+
+  join_stats.attempts = attempts;
+  join_stats.duration = millis() - start;
   return connected();
 }
 
+void STM32LoRaWAN::JoinTimerCallback(void * /* context */)
+{
+  // Called from an ISR, waking up joinBackoff()
+  instance->join_backoff_pending = false;
+}
+
+void STM32LoRaWAN::joinBackoff(uint32_t ms)
+{
+  join_backoff_pending = true;
+  UTIL_TIMER_StartWithPeriod(&join_timer, ms);
+  while (join_backoff_pending) {
+    maintain();
+    sleepWhile(&STM32LoRaWAN::joinBackoffPending);
+  }
+}
+
 
 bool STM32LoRaWAN::joinABP()
 {
@@ -241,6 +571,9 @@ bool STM32LoRaWAN::joinABP()
 
 bool STM32LoRaWAN::dataRate(uint8_t dr)
 {
+  // An explicitly configured datarate takes precedence over the one
+  // of the last successful join
+  join_dr = -1;
   return mibSetInt8("dataRate", MIB_CHANNELS_DATARATE, dr);
 }
 
@@ -272,6 +605,16 @@ bool STM32LoRaWAN::dutyCycle(bool on)
   return true;
 }
 
+bool STM32LoRaWAN::configureClass(_lora_class _class)
+{
+  if (_class == CLASS_B)
+    return failure("Class B is not supported\r\n");
+
+  MibRequestConfirm_t mibReq;
+  mibReq.Param.Class = _class;
+  return mibSet("Class", MIB_DEVICE_CLASS, mibReq);
+}
+
 bool STM32LoRaWAN::setPort(uint8_t port)
 {
   this->tx_port = port;
@@ -427,6 +770,73 @@ bool STM32LoRaWAN::modifyChannelEnabled(unsigned idx, bool value)
   return mibSetPtr("ChannelsMask", MIB_CHANNELS_MASK, (void *)new_mask);
 }
 
+bool STM32LoRaWAN::setSubBand(int8_t value)
+{
+  if (region != LORAMAC_REGION_US915 && region != LORAMAC_REGION_AU915) {
+    return failure("Sub-bands are only available in the US915 and AU915 regions\r\n");
+  }
+
+  if (value < -1 || value > 7) {
+    return failure("Invalid sub-band %d, must be 0-7 or -1\r\n", value);
+  }
+
+  // Both regions have 64 125 kHz channels (eight per sub-band, so two
+  // sub-bands per mask word), followed by eight 500 kHz channels (one
+  // per sub-band).
+  uint16_t mask[REGION_NVM_CHANNELS_MASK_SIZE] = {};
+  if (value < 0) {
+    mask[0] = mask[1] = mask[2] = mask[3] = 0xFFFF;
+    mask[4] = 0x00FF;
+  } else {
+    mask[value / 2] = 0x00FF << ((value % 2) * 8);
+    mask[4] = 1 << value;
+  }
+
+  // The default mask is what the stack goes back to when joining, so
+  // set that too for the sub-band to stick.
+  if (!mibSetPtr("ChannelsDefaultMask", MIB_CHANNELS_DEFAULT_MASK, mask)
+      || !mibSetPtr("ChannelsMask", MIB_CHANNELS_MASK, mask)) {
+    return false;
+  }
+
+  sub_band = value;
+  sub_band_learned = false;
+  return true;
+}
+
+bool STM32LoRaWAN::allSubBandsEnabled()
+{
+  // The 64 125 kHz and eight 500 kHz channels span five mask words
+  static const uint16_t all[5] = {0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0x00FF};
+  uint16_t *default_mask, *mask;
+  if (!mibGetPtr("ChannelsDefaultMask", MIB_CHANNELS_DEFAULT_MASK, (void **)&default_mask)
+      || !mibGetPtr("ChannelsMask", MIB_CHANNELS_MASK, (void **)&mask)) {
+    return false;
+  }
+
+  return memcmp(default_mask, all, sizeof(all)) == 0 && memcmp(mask, all, sizeof(all)) == 0;
+}
+
+bool STM32LoRaWAN::channelQuality(unsigned idx, ChannelQuality *quality)
+{
+  if (idx >= REGION_NVM_MAX_NB_CHANNELS) {
+    return failure("Invalid channel %u\r\n", idx);
+  }
+
+  LoRaMacChannelQuality_t q;
+  LoRaMacStatus_t res = LoRaMacGetChannelQuality(idx, &q);
+  if (res != LORAMAC_STATUS_OK) {
+    return failure("Failed to get channel quality: %s\r\n", toString(res));
+  }
+
+  quality->weight = q.Weight;
+  quality->rssi = q.Rssi;
+  quality->snr = q.Snr;
+  quality->received = q.NbReceived;
+  quality->missed = q.NbMissed;
+  return true;
+}
+
 bool STM32LoRaWAN::isChannelEnabled(unsigned idx)
 {
   if (idx >= REGION_NVM_MAX_NB_CHANNELS) {
@@ -457,6 +867,73 @@ bool STM32LoRaWAN::isChannelEnabled(unsigned idx)
 }
 
 bool STM32LoRaWAN::send(const uint8_t *payload, size_t size, bool confirmed)
+{
+  // TODO: Report the DutyCycleWaitTime somewhere?
+  return requestUplink(this->tx_port, payload, size, confirmed, /* allowDelayedTx */ true, nullptr) == LORAMAC_STATUS_OK;
+}
+
+bool STM32LoRaWAN::sendAsync(const uint8_t *payload, size_t size, bool confirmed, CompletionCallback callback)
+{
+  if (!send(payload, size, confirmed)) {
+    return false;
+  }
+
+  tx_callback = callback;
+  return true;
+}
+
+uint8_t *STM32LoRaWAN::reserveTx(size_t size)
+{
+  LoRaMacTxInfo_t txInfo;
+  LoRaMacQueryTxPossible(0, &txInfo);
+  if (size > txInfo.CurrentPossiblePayloadSize) {
+    failure("Packet too long, only %u bytes of payload supported at current datarate\r\n", txInfo.CurrentPossiblePayloadSize);
+    return nullptr;
+  }
+
+  if (!reservePayloadBuffer()) {
+    return nullptr;
+  }
+
+  reserved_tx_size = size;
+  return reserved_tx_buf;
+}
+
+uint8_t *STM32LoRaWAN::reservePayloadBuffer()
+{
+  // The stack keeps using this buffer until it is idle again (e.g.
+  // for retransmissions), so it is only handed out when idle.
+  reserved_tx_buf = LoRaMacGetTxPayloadBuffer();
+  if (!reserved_tx_buf) {
+    failure("Cannot reserve packet buffer, stack is busy\r\n");
+    return nullptr;
+  }
+
+  reserved_tx_generation = LoRaMacGetTxPayloadGeneration();
+  return reserved_tx_buf;
+}
+
+bool STM32LoRaWAN::commitTx(uint8_t port, bool confirmed)
+{
+  if (!reserved_tx_buf) {
+    return failure("No packet buffer reserved\r\n");
+  }
+
+  uint8_t *payload = reserved_tx_buf;
+  reserved_tx_buf = nullptr;
+  // Let maintain() resume the queued and posted packets held back
+  // while the buffer was reserved
+  MacProcessNotify();
+
+  // Those cannot have overwritten the buffer, but a send() call from
+  // the sketch could have
+  if (LoRaMacGetTxPayloadGeneration() != reserved_tx_generation) {
+    return failure("Reserved packet buffer was overwritten by another uplink\r\n");
+  }
+  return requestUplink(port, payload, reserved_tx_size, confirmed, /* allowDelayedTx */ true, nullptr) == LORAMAC_STATUS_OK;
+}
+
+LoRaMacStatus_t STM32LoRaWAN::requestUplink(uint8_t port, const uint8_t *payload, size_t size, bool confirmed, bool allowDelayedTx, TimerTime_t *waitTime)
 {
   McpsReq_t mcpsReq;
 
@@ -466,7 +943,7 @@ bool STM32LoRaWAN::send(const uint8_t *payload, size_t size, bool confirmed)
     // just pass the current rate, which should be the most recently
     // configured one..
     mcpsReq.Req.Confirmed.Datarate = getDataRate();
-    mcpsReq.Req.Confirmed.fPort = this->tx_port;
+    mcpsReq.Req.Confirmed.fPort = port;
     mcpsReq.Req.Confirmed.fBufferSize = size;
     mcpsReq.Req.Confirmed.fBuffer = const_cast<uint8_t *>(payload);
 #if (defined( LORAMAC_VERSION ) && ( LORAMAC_VERSION == 0x01000300 ))
@@ -478,7 +955,7 @@ bool STM32LoRaWAN::send(const uint8_t *payload, size_t size, bool confirmed)
     mcpsReq.Type = MCPS_UNCONFIRMED;
     // See comment about datarate above
     mcpsReq.Req.Unconfirmed.Datarate = getDataRate();
-    mcpsReq.Req.Unconfirmed.fPort = this->tx_port;
+    mcpsReq.Req.Unconfirmed.fPort = port;
     mcpsReq.Req.Unconfirmed.fBufferSize = size;
     mcpsReq.Req.Unconfirmed.fBuffer = const_cast<uint8_t *>(payload);
   }
@@ -486,7 +963,8 @@ bool STM32LoRaWAN::send(const uint8_t *payload, size_t size, bool confirmed)
   LoRaMacTxInfo_t txInfo;
   if (LoRaMacQueryTxPossible(size, &txInfo) == LORAMAC_STATUS_LENGTH_ERROR) {
     if (size > txInfo.CurrentPossiblePayloadSize) {
-      return failure("Packet too long, only %u bytes of payload supported at current datarate\r\n", txInfo.CurrentPossiblePayloadSize);
+      failure("Packet too long, only %u bytes of payload supported at current datarate\r\n", txInfo.CurrentPossiblePayloadSize);
+      return LORAMAC_STATUS_LENGTH_ERROR;
     }
 
     // If the packet would fit, but is still rejected, this means there
@@ -498,18 +976,145 @@ bool STM32LoRaWAN::send(const uint8_t *payload, size_t size, bool confirmed)
     mcpsReq.Req.Unconfirmed.fBufferSize = 0;
     LoRaMacMcpsRequest(&mcpsReq, /* allowDelayedTx */ true);
 
-    return failure("Cannot send packet, wait for pending MAC commands to be sent\r\n");
+    // The stack is now busy flushing the MAC commands, after which
+    // the packet can be sent.
+    failure("Cannot send packet, wait for pending MAC commands to be sent\r\n");
+    return LORAMAC_STATUS_BUSY;
   }
 
-  LoRaMacStatus_t res = LoRaMacMcpsRequest(&mcpsReq, /* allowDelayedTx */ true);
+  LoRaMacStatus_t res = LoRaMacMcpsRequest(&mcpsReq, allowDelayedTx);
+  if (res == LORAMAC_STATUS_OK) {
+    tx_requested = true;
+  }
+  if (waitTime) {
+    *waitTime = mcpsReq.ReqReturn.DutyCycleWaitTime;
+  }
+  if (res == LORAMAC_STATUS_DUTYCYCLE_RESTRICTED && !allowDelayedTx) {
+    return res;
+  }
   if (res != LORAMAC_STATUS_OK) {
-    return failure("Failed to send packet: %s\r\n", toString(res));
+    failure("Failed to send packet: %s\r\n", toString(res));
   }
 
-  // TODO: Report mcpsReq.ReqReturn.DutyCycleWaitTime somewhere?
+  return res;
+}
+
+#if STM32LORAWAN_TX_QUEUE_SIZE > 0
+bool STM32LoRaWAN::queuePacket(uint8_t port, const uint8_t *payload, size_t size, bool confirmed, uint8_t priority)
+{
+  return enqueuePacket(port, payload, size, confirmed, priority, /* records */ false);
+}
+
+bool STM32LoRaWAN::enqueuePacket(uint8_t port, const uint8_t *payload, size_t size, bool confirmed, uint8_t priority, bool records)
+{
+  if (tx_queue_len == STM32LORAWAN_TX_QUEUE_SIZE) {
+    return failure("Uplink queue full\r\n");
+  }
+
+  if (size > sizeof(tx_queue[0].payload)) {
+    return failure("Packet too long for the uplink queue\r\n");
+  }
+
+  // Find an entry that is not referenced by tx_queue_order
+  uint8_t slot;
+  for (slot = 0; slot < STM32LORAWAN_TX_QUEUE_SIZE; ++slot) {
+    bool used = false;
+    for (uint8_t i = 0; i < tx_queue_len; ++i) {
+      used |= (tx_queue_order[i] == slot);
+    }
+    if (!used) {
+      break;
+    }
+  }
+
+  TxQueueEntry &entry = tx_queue[slot];
+  entry.port = port;
+  entry.priority = priority;
+  entry.confirmed = confirmed;
+  entry.records = records;
+  entry.len = size;
+  memcpy(entry.payload, payload, size);
+
+  // Insert after all packets with the same or a higher priority
+  uint8_t pos = tx_queue_len;
+  while (pos > 0 && tx_queue[tx_queue_order[pos - 1]].priority < priority) {
+    tx_queue_order[pos] = tx_queue_order[pos - 1];
+    pos--;
+  }
+  tx_queue_order[pos] = slot;
+  tx_queue_len++;
+
+  processTxQueue();
   return true;
 }
 
+void STM32LoRaWAN::processTxQueue()
+{
+  // While a packet buffer is reserved, sending would overwrite it
+  if (tx_queue_len == 0 || tx_queue_waiting || busy() || reserved_tx_buf) {
+    return;
+  }
+
+  TxQueueEntry &entry = tx_queue[tx_queue_order[0]];
+  uint8_t len = entry.len;
+  if (entry.records) {
+    // ADR may have lowered the datarate since the records were
+    // aggregated, so only send the leading records that still fit and
+    // keep the others queued. A single record that does not fit is
+    // sent anyway, so it is rejected (and dropped) below.
+    size_t max_payload = maxPayload();
+    uint8_t fit = 0;
+    while (fit < entry.len && fit + 2U + entry.payload[fit + 1] <= max_payload) {
+      fit += 2 + entry.payload[fit + 1];
+    }
+    if (fit != 0) {
+      len = fit;
+    }
+  }
+
+  TimerTime_t wait = 0;
+  // Do not let the stack delay the transmission itself, so a packet
+  // with a higher priority queued in the meantime can still go first.
+  LoRaMacStatus_t res = requestUplink(entry.port, entry.payload, len, entry.confirmed, /* allowDelayedTx */ false, &wait);
+  switch (res) {
+    case LORAMAC_STATUS_DUTYCYCLE_RESTRICTED:
+      // The stack can report the restriction without a wait time (e.g.
+      // when the remaining time rounds down to zero), which no event
+      // would follow, so retry shortly in that case.
+      tx_queue_waiting = true;
+      UTIL_TIMER_StartWithPeriod(&tx_queue_timer, wait != 0 ? wait : TX_QUEUE_RETRY_DELAY);
+      return;
+    case LORAMAC_STATUS_BUSY:
+    case LORAMAC_STATUS_NO_NETWORK_JOINED:
+      // Keep the packet, it is retried when the stack notifies an event
+      // (e.g. it is done sending or joining).
+      return;
+    default:
+      // Sent, or rejected for good (message already printed)
+      break;
+  }
+
+  if (res == LORAMAC_STATUS_OK && len < entry.len) {
+    // The stack copied the payload, keep the remaining records
+    entry.len -= len;
+    memmove(entry.payload, &entry.payload[len], entry.len);
+    return;
+  }
+
+  tx_queue_len--;
+  memmove(&tx_queue_order[0], &tx_queue_order[1], tx_queue_len);
+}
+#endif
+
+size_t STM32LoRaWAN::maxPayload()
+{
+  LoRaMacTxInfo_t txInfo;
+  if (LoRaMacQueryTxPossible(0, &txInfo) == LORAMAC_STATUS_OK) {
+    return txInfo.MaxPossibleApplicationDataSize;
+  }
+  return txInfo.CurrentPossiblePayloadSize;
+}
+
 // All these MIB get and set functions have quite a bit of boilerplate,
 // but at least they make their callers a lot less verbose.
 bool STM32LoRaWAN::mibGet(const char *name, Mib_t type, MibRequestConfirm_t &mibReq)
@@ -1256,17 +1861,34 @@ bool STM32LoRaWAN::failure(const char *fmt, ...)
 
 void STM32LoRaWAN::beginPacket()
 {
-  tx_ptr = &tx_buf[0];
+  // The packet is written in place, so there is nothing to copy when
+  // sending it
+  tx_start = reservePayloadBuffer();
+  tx_ptr = tx_start;
+  tx_end = tx_start ? tx_start + TX_PAYLOAD_SIZE : nullptr;
 }
 
-int STM32LoRaWAN::endPacketAsync(bool confirmed)
+int STM32LoRaWAN::endPacketAsync(bool confirmed, CompletionCallback callback)
 {
-  size_t len = tx_ptr - tx_buf;
+  uint8_t *start = tx_start;
+  size_t len = tx_ptr - tx_start;
+  tx_start = tx_ptr = tx_end = nullptr;
+
   // MKRWAN has more error codes, but those are fairly
   // arbitrary and undocumented, so just return -1 for any error.
-  if (!send(tx_buf, len, confirmed)) {
+  if (!start || start != reserved_tx_buf) {
+    // beginPacket() found the stack busy, or the reservation was
+    // already committed by commitTx()
+    failure("No packet buffer reserved, call beginPacket() while the stack is idle\r\n");
     return -1;
   }
+
+  reserved_tx_size = len;
+  if (!commitTx(this->tx_port, confirmed)) {
+    return -1;
+  }
+
+  tx_callback = callback;
   return len;
 }
 
@@ -1283,9 +1905,120 @@ int STM32LoRaWAN::endPacket(bool confirmed)
   return res;
 }
 
+#if STM32LORAWAN_RECORD_BUFFER_SIZE > 0
+void STM32LoRaWAN::beginRecord(uint8_t type)
+{
+  // The record is written after the pending records, leaving room for
+  // its header, so it does not need to be copied when it is added
+  size_t start = agg_len + 2U;
+  if (start > sizeof(agg_buf)) {
+    start = sizeof(agg_buf);
+  }
+
+  record_type = type;
+  tx_start = &agg_buf[start];
+  tx_ptr = tx_start;
+  tx_end = &agg_buf[sizeof(agg_buf)];
+}
+
+bool STM32LoRaWAN::endRecord()
+{
+  uint8_t *start = tx_start;
+  size_t len = tx_ptr - tx_start;
+  tx_start = tx_ptr = tx_end = nullptr;
+
+  if (!start) {
+    // Dropped by txRoom(), or beginRecord() was not called
+    return failure("Record too long for the record buffer\r\n");
+  }
+  return addRecord(record_type, start, len);
+}
+
+bool STM32LoRaWAN::addRecord(uint8_t type, const uint8_t *data, size_t size)
+{
+  // Records are sized against the payload at the current datarate
+  size_t max_payload = maxPayload();
+  if (max_payload > sizeof(agg_buf)) {
+    max_payload = sizeof(agg_buf);
+  }
+
+  size_t record_len = 2 + size;
+  if (record_len > max_payload) {
+    return failure("Record too long, only %u bytes of payload supported at current datarate\r\n", (unsigned)max_payload);
+  }
+
+  if (agg_len + record_len > max_payload && !flushRecords()) {
+    return false;
+  }
+
+  if (agg_len == 0 && agg_max_delay != 0) {
+    UTIL_TIMER_StartWithPeriod(&agg_timer, agg_max_delay);
+  }
+
+  agg_buf[agg_len++] = type;
+  agg_buf[agg_len++] = size;
+  // A record written by beginRecord() is already in agg_buf
+  memmove(&agg_buf[agg_len], data, size);
+  agg_len += size;
+
+  // Do not wait for the next record when even an empty one would not fit
+  if (agg_len + 2U > max_payload) {
+    flushRecords();
+  }
+
+  return true;
+}
+
+bool STM32LoRaWAN::flushRecords()
+{
+  bool deadline = agg_flush_pending;
+  agg_flush_pending = false;
+  if (agg_len == 0) {
+    return true;
+  }
+
+  if (!enqueuePacket(agg_port, agg_buf, agg_len, /* confirmed */ false, /* priority */ 0, /* records */ true)) {
+    // Keep an expired deadline pending, so maintain() retries once the
+    // uplink queue has room again
+    agg_flush_pending = deadline;
+    return false;
+  }
+
+  UTIL_TIMER_Stop(&agg_timer);
+  agg_len = 0;
+  return true;
+}
+#endif
+
+size_t STM32LoRaWAN::txRoom(size_t size)
+{
+  size_t room = tx_end - tx_ptr;
+#if STM32LORAWAN_RECORD_BUFFER_SIZE > 0
+  if (size > room && tx_end == &agg_buf[sizeof(agg_buf)]) {
+    // A record that outgrows the pending packet of records starts the
+    // next one, as addRecord() would do. When that is not possible,
+    // the record is dropped, so endRecord() fails instead of adding
+    // a truncated record.
+    size_t written = tx_ptr - tx_start;
+    if (2 + written + size > sizeof(agg_buf) || (agg_len != 0 && !flushRecords())) {
+      tx_start = tx_ptr = tx_end = nullptr;
+      return 0;
+    }
+
+    memmove(&agg_buf[2], tx_start, written);
+    tx_start = &agg_buf[2];
+    tx_ptr = tx_start + written;
+    room = tx_end - tx_ptr;
+  }
+#else
+  (void)size;
+#endif
+  return room;
+}
+
 size_t STM32LoRaWAN::write(uint8_t c)
 {
-  if (tx_ptr == &tx_buf[sizeof(tx_buf)]) {
+  if (txRoom(1) == 0) {
     return 0;
   }
   *tx_ptr++ = c;
@@ -1294,12 +2027,14 @@ size_t STM32LoRaWAN::write(uint8_t c)
 
 size_t STM32LoRaWAN::write(const uint8_t *buffer, size_t size)
 {
-  size_t room = &tx_buf[sizeof(tx_buf)] - tx_ptr;
+  size_t room = txRoom(size);
   if (size > room) {
     size = room;
   }
-  memcpy(tx_ptr, buffer, size);
-  tx_ptr += size;
+  if (size != 0) {
+    memcpy(tx_ptr, buffer, size);
+    tx_ptr += size;
+  }
   return size;
 }
 
@@ -1309,10 +2044,17 @@ int STM32LoRaWAN::availableForWrite()
   size_t avail = 0;
 
   if (LoRaMacQueryTxPossible(0, &txInfo) == LORAMAC_STATUS_OK) {
-    size_t written = tx_ptr - tx_buf;
+    size_t written = tx_ptr - tx_start;
     size_t max_payload = txInfo.MaxPossibleApplicationDataSize;
-    if (max_payload > sizeof(tx_buf)) {
-      max_payload = sizeof(tx_buf);
+    size_t max_size = tx_end - tx_start;
+#if STM32LORAWAN_RECORD_BUFFER_SIZE > 0
+    if (tx_end == &agg_buf[sizeof(agg_buf)]) {
+      // A record that does not fit moves to the next packet, see txRoom()
+      max_size = sizeof(agg_buf) - 2;
+    }
+#endif
+    if (max_payload > max_size) {
+      max_payload = max_size;
     }
 
     if (max_payload > written) {
@@ -1329,62 +2071,147 @@ int STM32LoRaWAN::read(uint8_t *buf, size_t size)
     size = avail;
   }
 
-  memcpy(buf, rx_ptr, size);
-  rx_ptr += size;
+  memcpy(buf, &rx_buf[rx_frames[rx_head].offset + rx_pos], size);
+  rx_pos += size;
 
   return size;
 }
 
 int STM32LoRaWAN::available()
 {
-  return rx_buf + sizeof(rx_buf) - rx_ptr;
+  if (rx_count == 0) {
+    return 0;
+  }
+  return rx_frames[rx_head].len - rx_pos;
 }
 
 int STM32LoRaWAN::read()
 {
-  if (rx_ptr >= rx_buf + sizeof(rx_buf)) {
+  if (!available()) {
     return -1;
   }
-  return *rx_ptr++;
+  return rx_buf[rx_frames[rx_head].offset + rx_pos++];
 }
 
 int STM32LoRaWAN::peek()
 {
-  if (rx_ptr >= rx_buf + sizeof(rx_buf)) {
+  if (!available()) {
     return -1;
   }
-  return *rx_ptr;
+  return rx_buf[rx_frames[rx_head].offset + rx_pos];
 }
 
 int STM32LoRaWAN::parsePacket()
 {
-  // This is what MKRWAN and MKRWAN_v2 also do
+  // Partly read packets are kept, as before packets were queued
+  release_read_rx();
+  if (rx_count != 0 && rx_peeked) {
+    release_rx();
+  }
+
   return available();
 }
 
-void STM32LoRaWAN::add_rx(const uint8_t *buf, size_t len)
+bool STM32LoRaWAN::peekPacket(DownlinkPacket *packet)
 {
-  size_t room = rx_ptr - rx_buf;
-  if (len > room) {
-    failure("RX buffer overflow (%u > %u)", len, room);
-    len = room;
+  if (rx_count == 0) {
+    return false;
   }
 
-  size_t avail = available();
-  if (available()) {
-    // There is still data in the buffer, so we have to move that out of
-    // the way (but keep it available at what will be the start of the
-    // buffer).
-    // Note that this could have been more efficient with a circular
-    // buffer, but since this really a corner case that should not occur
-    // normally, this extra copy is preferred over the extra complexity
-    // of a circular buffer.
-    memmove(rx_ptr - len, rx_ptr, avail);
-  }
-  memcpy(rx_buf + sizeof(rx_buf) - len, buf, len);
-  // By modifying rather than setting rx_ptr, this is also correct when
-  // we moved old data
-  rx_ptr -= len;;
+  RxFrame &frame = rx_frames[rx_head];
+  packet->data = &rx_buf[frame.offset + rx_pos];
+  packet->size = frame.len - rx_pos;
+  packet->port = frame.port;
+  packet->rssi = frame.rssi;
+  packet->snr = frame.snr;
+  packet->slot = frame.slot;
+  packet->fcnt = frame.fcnt;
+  packet->time = frame.time;
+  rx_peeked = true;
+  return true;
+}
+
+void STM32LoRaWAN::add_rx(McpsIndication_t *i, LoRaMacRxStatus_t *status)
+{
+  if (i->BufferSize == 0) {
+    // Nothing to read (e.g. just an ack), only report its metadata
+    // when no packet is waiting to be read.
+    if (rx_count == 0) {
+      rx_port = i->Port;
+      rx_rssi = status->Rssi;
+      rx_snr = status->Snr;
+    }
+    return;
+  }
+
+  if (rx_count == STM32LORAWAN_RX_QUEUE_SIZE) {
+    failure("RX queue overflow, packet dropped\r\n");
+    return;
+  }
+
+  // Packets are stored contiguously (so peekPacket() can return them
+  // without copying), after the last queued one, or wrapping around
+  // to the start of the buffer when that leaves more room.
+  size_t offset = 0;
+  size_t room = sizeof(rx_buf);
+  if (rx_count != 0) {
+    RxFrame &first = rx_frames[rx_head];
+    RxFrame &last = rx_frames[(rx_head + rx_count - 1) % STM32LORAWAN_RX_QUEUE_SIZE];
+    offset = last.offset + last.len;
+    if (offset > first.offset) {
+      room = sizeof(rx_buf) - offset;
+      if (room < i->BufferSize) {
+        offset = 0;
+        room = first.offset;
+      }
+    } else {
+      room = first.offset - offset;
+    }
+  }
+
+  if (room < i->BufferSize) {
+    failure("RX buffer overflow (%u > %u), packet dropped\r\n", (unsigned)i->BufferSize, (unsigned)room);
+    return;
+  }
+
+  RxFrame &frame = rx_frames[(rx_head + rx_count) % STM32LORAWAN_RX_QUEUE_SIZE];
+  frame.offset = offset;
+  frame.len = i->BufferSize;
+  frame.port = i->Port;
+  frame.rssi = status->Rssi;
+  frame.snr = status->Snr;
+  frame.slot = status->RxSlot;
+  frame.fcnt = i->DownLinkCounter;
+  frame.time = millis();
+  memcpy(&rx_buf[offset], i->Buffer, i->BufferSize);
+
+  if (rx_count++ == 0) {
+    rx_port = frame.port;
+    rx_rssi = frame.rssi;
+    rx_snr = frame.snr;
+  }
+}
+
+void STM32LoRaWAN::release_rx()
+{
+  rx_head = (rx_head + 1) % STM32LORAWAN_RX_QUEUE_SIZE;
+  rx_count--;
+  rx_pos = 0;
+  rx_peeked = false;
+
+  if (rx_count != 0) {
+    RxFrame &frame = rx_frames[rx_head];
+    rx_port = frame.port;
+    rx_rssi = frame.rssi;
+    rx_snr = frame.snr;
+  }
+}
+
+void STM32LoRaWAN::release_read_rx()
+{
+  if (rx_count != 0 && rx_pos == rx_frames[rx_head].len) {
+    release_rx();
+  }
 }
 
 uint64_t STM32LoRaWAN::builtinDevEUI()
@@ -1407,6 +2234,22 @@ void STM32LoRaWAN::MacMcpsConfirm(McpsConfirm_t *c)
     (unsigned)c->TxTimeOnAir, (unsigned)c->UpLinkCounter, (unsigned)c->Channel);
   instance->last_tx_acked = c->AckReceived;
   instance->fcnt_up = c->UpLinkCounter;
+
+  // The empty uplink that requestUplink() sends to flush MAC commands
+  // does not complete the pending uplink
+  if (!instance->tx_requested) {
+    return;
+  }
+  instance->tx_requested = false;
+
+  // The callback is only called from maintain(), after LoRaMacProcess()
+  // has also passed any received data to MacMcpsIndication.
+  instance->tx_result.status = c->Status;
+  instance->tx_result.ack = c->AckReceived;
+  instance->tx_result.airtime = c->TxTimeOnAir;
+  instance->tx_result.datarate = c->Datarate;
+  instance->tx_result.fcnt = c->UpLinkCounter;
+  instance->tx_done = true;
 }
 
 void STM32LoRaWAN::MacMcpsIndication(McpsIndication_t *i, LoRaMacRxStatus_t *status)
@@ -1422,10 +2265,7 @@ void STM32LoRaWAN::MacMcpsIndication(McpsIndication_t *i, LoRaMacRxStatus_t *sta
   instance->fcnt_down = i->DownLinkCounter;
 
   if ((i->McpsIndication == MCPS_CONFIRMED || i->McpsIndication == MCPS_UNCONFIRMED) && i->Status == LORAMAC_EVENT_INFO_STATUS_OK) {
-    instance->add_rx(i->Buffer, i->BufferSize);
-    instance->rx_port = i->Port;
-    instance->rx_rssi = status->Rssi;
-    instance->rx_snr = status->Snr;
+    instance->add_rx(i, status);
   }
 }
 
@@ -1436,6 +2276,25 @@ void STM32LoRaWAN::MacMlmeConfirm(MlmeConfirm_t *c)
   core_debug(
     "MlmeConfirm: req=%s, status=%s, airtime=%u, margin=%u, gateways=%u\r\n",
     toString(c->MlmeRequest), toString(c->Status), c->TxTimeOnAir, c->DemodMargin, c->NbGateways);
+
+  if (c->MlmeRequest == MLME_JOIN) {
+    if (c->Status == LORAMAC_EVENT_INFO_STATUS_OK) {
+      instance->join_dr = instance->getDataRate();
+      instance->join_stats.total_joins++;
+
+      // The JoinReq was heard on this channel, so lock in on its
+      // sub-band (once LoRaMacProcess() is done with the join).
+      if (instance->region == LORAMAC_REGION_US915 || instance->region == LORAMAC_REGION_AU915) {
+        instance->learned_sub_band = c->Channel < 64 ? c->Channel / 8 : c->Channel - 64;
+      }
+    }
+    instance->join_result.status = c->Status;
+    instance->join_result.ack = (c->Status == LORAMAC_EVENT_INFO_STATUS_OK);
+    instance->join_result.airtime = c->TxTimeOnAir;
+    instance->join_result.datarate = instance->getDataRate();
+    instance->join_result.fcnt = 0;
+    instance->join_done = true;
+  }
 }
 
 void STM32LoRaWAN::MacMlmeIndication(MlmeIndication_t *i, LoRaMacRxStatus_t *status)
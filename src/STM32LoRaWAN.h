@@ -44,7 +44,67 @@
 #include "BSP/mw_log_conf.h"
 #include "BSP/timer_if.h"
 #include "STM32RTC.h"
+#include <atomic>
 
+/*
+ * The STM32LORAWAN_* settings below change the layout of the
+ * STM32LoRaWAN class, so they must be defined for the whole build
+ * (e.g. with -D in build_opt.h), not just in the sketch.
+ */
+
+#ifndef STM32LORAWAN_TX_QUEUE_SIZE
+/**
+ * Number of packets that can be waiting in the uplink queue filled by
+ * STM32LoRaWAN::queuePacket(). Each entry takes a full size payload
+ * buffer (255 bytes) plus a few bytes of metadata, so the queue (and
+ * queuePacket()) is left out by default, with 0.
+ */
+#define STM32LORAWAN_TX_QUEUE_SIZE 0
+#endif
+
+#ifndef STM32LORAWAN_REQUEST_QUEUE_SIZE
+/**
+ * Number of requests that can be posted by other tasks (see
+ * STM32LoRaWAN::postSend()) before they are processed. Must be a power
+ * of two. Each entry holds a copy of the payload (255 bytes), so the
+ * queue (and the post methods) is left out by default, with 0.
+ */
+#define STM32LORAWAN_REQUEST_QUEUE_SIZE 0
+#endif
+
+#ifndef STM32LORAWAN_RX_QUEUE_SIZE
+/**
+ * Number of received packets that can be waiting to be read (see
+ * STM32LoRaWAN::parsePacket()).
+ */
+#define STM32LORAWAN_RX_QUEUE_SIZE 2
+#endif
+
+#ifndef STM32LORAWAN_RX_BUFFER_SIZE
+/**
+ * Size of the buffer holding the payload of the received packets
+ * waiting to be read. Each packet is stored contiguously, so this must
+ * be at least 255 bytes to accept any packet. Raise it to queue
+ * several large packets.
+ */
+#define STM32LORAWAN_RX_BUFFER_SIZE 255
+#endif
+
+#ifndef STM32LORAWAN_RECORD_BUFFER_SIZE
+/**
+ * Size of the buffer in which STM32LoRaWAN::addRecord() aggregates
+ * records. This bounds the size of the aggregated packets, e.g. 64 or
+ * more to fill the larger packets allowed by the faster datarates.
+ * The aggregation is left out by default, with 0. It passes its
+ * packets to the uplink queue, so that needs
+ * STM32LORAWAN_TX_QUEUE_SIZE too.
+ */
+#define STM32LORAWAN_RECORD_BUFFER_SIZE 0
+#endif
+
+#if STM32LORAWAN_RECORD_BUFFER_SIZE > 0 && STM32LORAWAN_TX_QUEUE_SIZE == 0
+#error "STM32LORAWAN_RECORD_BUFFER_SIZE needs STM32LORAWAN_TX_QUEUE_SIZE"
+#endif
 
 /**
  * Supported regions, to be passed to STM32LoRaWAN::begin() to select
@@ -122,9 +182,19 @@ class STM32LoRaWAN : public Stream {
      *    joinOTAA returns.
      *  - With MKRWAN the module automatically decreases/alternates the
      *    datarate in a region-specific way for all regions, this
-     *    library uses the configured datarate (with `datarate()`) for
-     *    most regions, but uses fixed datarates (according to LoRaWAN
-     *    regional parameters) for US915/AU915/AS923.
+     *    library starts with the datarate of the previous successful
+     *    join (unless `dataRate()` was called since), or else the
+     *    configured datarate, and decreases it every few failed
+     *    attempts for most regions, but uses fixed datarates
+     *    (according to LoRaWAN regional parameters) for
+     *    US915/AU915/AS923. The configured datarate is used again for
+     *    the uplinks once joinOTAA returns.
+     *  - Between failed attempts, this library waits for a randomized
+     *    and exponentially increasing delay (on top of the join duty
+     *    cycle enforced by the stack), sleeping meanwhile.
+     *
+     * The number of attempts and time taken can be queried afterwards
+     * with joinStats().
      *
      * \MKRWANApiDifference{Timeout parameter omitted (also omitted in MKRWAN_v2)}
      * \MKRWANApiDifference{Added version that accepts uint64_t appEUI}
@@ -209,6 +279,14 @@ class STM32LoRaWAN : public Stream {
      * The send() method offers an alternative (and always non-blocking)
      * API, where you pass a payload already built into your own buffer.
      * @{ */
+
+    /**
+     * Start a new packet. The packet is written directly into the
+     * frame buffer of the stack, reserved as reserveTx() does until
+     * endPacket(), so this must be called while the stack is idle
+     * (i.e. busy() returns false). When it is not, nothing can be
+     * written and endPacket() fails.
+     */
     void beginPacket();
     /**
      * Finalize and send a packet previously prepared using
@@ -228,6 +306,69 @@ class STM32LoRaWAN : public Stream {
     /// @}
 
 
+#if STM32LORAWAN_RECORD_BUFFER_SIZE > 0
+    /**
+     * @anchor aggregation
+     * @name Record aggregation
+     *
+     * These methods allow packing small application records (e.g. a
+     * single sensor reading) into as few packets as possible, which
+     * saves the per-packet overhead (13 bytes of LoRaWAN headers plus
+     * the preamble) in airtime and energy.
+     *
+     * A record is built like a packet, by calling beginRecord(),
+     * writing data using the Stream write methods and calling
+     * endRecord(), or passed at once using addRecord(). Each record is
+     * stored as a type byte, a length byte and the data, and records
+     * are appended to a pending packet as long as it fits into the
+     * maximum payload at the current datarate (and into
+     * STM32LORAWAN_RECORD_BUFFER_SIZE bytes). The pending packet is
+     * passed to the uplink queue (see queuePacket()) when the next
+     * record does not fit, when the maximum delay configured with
+     * setAggregation() has expired since its first record, or when
+     * flushRecords() is called.
+     *
+     * \NotInMKRWAN
+     * @{ */
+
+    /**
+     * Configure the port used for packets of aggregated records, and
+     * the maximum delay (in milliseconds) between the first record of
+     * a packet and its transmission. A delay of 0 disables the
+     * deadline, so packets are only sent when full or flushed.
+     */
+    void setAggregation(uint8_t port, uint32_t max_delay = 0)
+    {
+      agg_port = port;
+      agg_max_delay = max_delay;
+    }
+
+    /** Start building a record of the given type. */
+    void beginRecord(uint8_t type);
+
+    /**
+     * Append the record previously prepared using beginRecord() and
+     * write() to the pending packet.
+     *
+     * \return true when the record was added, false when it is too
+     * long for the current datarate or the uplink queue is full.
+     */
+    bool endRecord();
+
+    /** Append a record built into your own buffer to the pending packet. */
+    bool addRecord(uint8_t type, const uint8_t *data, size_t size);
+
+    /**
+     * Pass the pending packet (if any) to the uplink queue.
+     *
+     * \return false when the uplink queue is full, in which case the
+     * records are kept.
+     */
+    bool flushRecords();
+    /// @}
+#endif
+
+
     /**
      * @anchor print
      * @name Stream/Print writing
@@ -257,7 +398,7 @@ class STM32LoRaWAN : public Stream {
      *
      * This takes the maximum payload size at the current datarate into
      * account. When this is called directly after beginPacket(), it returns
-     * the maximum payload size.
+     * the maximum payload size. Before beginPacket(), it returns 0.
      *
      * You can usually write more than this amount, but then sending the
      * packet with endPacket() will likely fail.
@@ -283,30 +424,71 @@ class STM32LoRaWAN : public Stream {
      * see if any bytes are ready to read). If so, the contents of the
      * packet can be read using the Stream read methods.
      *
+     * Received packets are queued (up to STM32LORAWAN_RX_QUEUE_SIZE
+     * packets and STM32LORAWAN_RX_BUFFER_SIZE bytes), each with its own
+     * metadata, so back-to-back downlinks (e.g. in class C or
+     * multicast) keep their boundaries. The read methods only return
+     * data from the current packet. Once that is fully read, the next
+     * packet becomes current on the next call to parsePacket() or
+     * maintain().
+     *
      * @{ */
 
     /**
-     * Alias of available(), returns the number of bytes available to
-     * read.
-     *
-     * \note The MKRWAN documentation suggests this method must be
-     * called before calling read, but the code gives no indication that
-     * this is at all required.
+     * Return the number of bytes available to read from the current
+     * packet, like available().
+     *
+     * A packet that is not fully read stays current, so this can be
+     * called before reading as the MKRWAN documentation suggests, and
+     * again while reading. Once the current packet was fully read, or
+     * returned by peekPacket() (whose data is not consumed by the read
+     * methods), the next received packet is made current.
      */
     int parsePacket();
 
+    /** A received packet, as returned by peekPacket() */
+    struct DownlinkPacket {
+      /** Unread payload of the packet */
+      const uint8_t *data;
+      /** Number of bytes at data */
+      size_t size;
+      uint8_t port;
+      int16_t rssi;
+      int8_t snr;
+      /** Receive window, see LoRaMacRxSlot_t */
+      uint8_t slot;
+      /** Downlink frame counter of the packet */
+      uint32_t fcnt;
+      /** Value of millis() when the packet was received */
+      uint32_t time;
+    };
+
     /**
-     * Returns the port number of the most recently received packet.
+     * Get the current packet and its metadata without copying its
+     * payload. The data pointer remains valid until the packet is
+     * released by parsePacket() or maintain() (which happens once
+     * the packet is fully read, or when parsePacket() is called after
+     * this method).
+     *
+     * \return false when there is no packet to read.
+     *
+     * \NotInMKRWAN
+     */
+    bool peekPacket(DownlinkPacket *packet);
+
+    /**
+     * Returns the port number of the current (or most recently read)
+     * packet.
      */
     uint8_t getDownlinkPort() { return rx_port; }
 
     /**
-     * Returns the RSSI of the most recently received packet.
+     * Returns the RSSI of the current (or most recently read) packet.
      */
     int16_t getDownlinkRssi() { return rx_rssi; }
 
     /**
-     * Returns the SNR of the most recently received packet.
+     * Returns the SNR of the current (or most recently read) packet.
      */
     int8_t getDownlinkSnr() { return rx_snr; }
     /// @}
@@ -328,12 +510,8 @@ class STM32LoRaWAN : public Stream {
      * read, how many are left to be read), and various read() versions
      * can be used to read the data.
      *
-     * \note If data is left unread when a new packet is received,
-     * the new data will be appended to the unread data and it becomes
-     * impossible to query where the first packet ends and the second
-     * begins. It is recommended to always fully read any received data
-     * before transmitting a new packet (which is, in class A LoRaWAN,
-     * the only time a new packet can be received).
+     * \note These only return data of the current packet, see
+     * parsePacket() to move on to the next one.
      *
      * @{ */
     int read(uint8_t *buf, size_t size);
@@ -454,6 +632,26 @@ class STM32LoRaWAN : public Stream {
      */
     bool connected();
 
+    /** Statistics about the OTAA joins, see joinStats() */
+    struct JoinStats {
+      /** Number of join attempts (JoinReq sent) by the last joinOTAA() call */
+      uint16_t attempts;
+      /** Time taken by the last joinOTAA() call, in milliseconds */
+      uint32_t duration;
+      /** Number of join attempts since begin(), including async ones */
+      uint32_t total_attempts;
+      /** Number of successful joins since begin() */
+      uint32_t total_joins;
+    };
+
+    /**
+     * Returns statistics about the OTAA joins, e.g. to evaluate the
+     * coverage from the number of attempts needed per join.
+     *
+     * \NotInMKRWAN
+     */
+    const JoinStats &joinStats() { return join_stats; }
+
     /**
      * Returns whether the modem is currently busy processing a request.
      * After a non-blocking request (e.g. unconfirmed uplink), this
@@ -574,6 +772,22 @@ class STM32LoRaWAN : public Stream {
      */
     bool dutyCycle(bool on);
 
+    /**
+     * Set the device class, CLASS_A (the default) or CLASS_C.
+     *
+     * In class C, the device listens for downlinks in between its
+     * uplinks, on the RX2 frequency and datarate, so the receiver is
+     * on most of the time. Enabling LORAMAC_CLASSC_RX_SNIFF in
+     * lorawan_conf.h duty-cycles the receiver instead: it only wakes
+     * up long enough to detect the preamble of a downlink. With the
+     * short preamble of LoRaWAN downlinks, this divides the reception
+     * current by about 3 at best. Downlinks received in class C can be
+     * read like any other received packet.
+     *
+     * Class B is not supported, requesting it fails.
+     */
+    bool configureClass(_lora_class _class);
+
     /**
      * Configure the syncword to use. The default is the "public"
      * (LoRaWAN standard) syncword, when set to false this uses another
@@ -627,6 +841,73 @@ class STM32LoRaWAN : public Stream {
     /** \NotInMKRWAN */
     bool modifyChannelEnabled(unsigned pos, bool value);
     bool isChannelEnabled(unsigned pos);
+
+    /**
+     * For the US915 and AU915 regions, restrict the channels used for
+     * joins and uplinks to a single sub-band (0-7, i.e. its eight
+     * 125 kHz channels and its 500 kHz channel), or use all channels
+     * again when passing -1.
+     *
+     * Unlike the channel mask set by the methods above, this survives
+     * joins (it also changes the default channel mask of the stack).
+     *
+     * After a successful join, the sub-band the JoinReq was sent on is
+     * selected automatically, since that is one the gateways listen
+     * on. This only happens when the join used all channels and the
+     * network did not send a channel mask with the JoinAccept. If
+     * joinOTAA() then fails repeatedly, it goes back to all sub-bands.
+     * A sub-band selected with this method is always kept.
+     *
+     * This library does not probe the sub-bands in an order of its
+     * own: on all channels, the stack already sends each 125 kHz
+     * JoinReq on the next sub-band in turn. Nor does it store the
+     * learned sub-band, since it uses no non-volatile memory. The
+     * sketch can store getSubBand() to restore it with this method
+     * after a reset, and avoid probing again.
+     *
+     * \NotInMKRWAN
+     */
+    bool setSubBand(int8_t sub_band);
+
+    /**
+     * Returns the sub-band selected by setSubBand() or learned when
+     * joining, or -1 when all channels are used.
+     *
+     * \NotInMKRWAN
+     */
+    int8_t getSubBand() { return sub_band; }
+
+    /** Link quality of an uplink channel, see channelQuality() */
+    struct ChannelQuality {
+      /**
+       * Relative chance (0-255) of the channel to be selected for
+       * uplinks, lowered when expected downlinks are missed
+       */
+      uint8_t weight;
+      /** Decayed average RSSI of the downlinks received, in dBm */
+      int16_t rssi;
+      /** Decayed average SNR of the downlinks received, in dB */
+      int8_t snr;
+      /** Number of downlinks received after uplinks on the channel */
+      uint16_t received;
+      /** Number of expected downlinks missed after uplinks on the channel */
+      uint16_t missed;
+    };
+
+    /**
+     * Retrieve the link quality of the given channel, as tracked by the
+     * stack to select uplink channels with working downlinks (e.g.
+     * avoiding a jammed channel) more often. The quality of a channel
+     * starts afresh when it is redefined, enabled or disabled.
+     *
+     * This is only available when LORAMAC_CHANNEL_QUALITY is enabled
+     * in lorawan_conf.h. The weight is not used in the US915 and AU915
+     * regions, where frequency hopping rules require a uniform channel
+     * selection.
+     *
+     * \NotInMKRWAN
+     */
+    bool channelQuality(unsigned pos, ChannelQuality *quality);
     /// @}
 
 
@@ -708,8 +989,31 @@ class STM32LoRaWAN : public Stream {
      * performed. This must be done at least until `busy()` returns
      * false. You can use `maintainUntilIdle()` for this if you no
      * longer have other things to do while waiting.
+     *
+     * Instead of polling `busy()`, `connected()` or `lastAck()`, a
+     * completion callback can be passed to joinOTAAAsync(),
+     * endPacketAsync() and sendAsync(). It is called once the operation
+     * is complete (i.e. after the receive windows), from `maintain()`
+     * and after any downlink received was made available for reading,
+     * so it may use the full API (but not block).
      */
 
+    /** Outcome of an operation started by a non-blocking method */
+    struct Completion {
+      /** LORAMAC_EVENT_INFO_STATUS_OK when the operation succeeded */
+      LoRaMacEventInfoStatus_t status;
+      /** Whether the packet was acked (for confirmed packets) or the join accepted */
+      bool ack;
+      /** Time on air of the (last) transmission, in milliseconds */
+      uint32_t airtime;
+      uint8_t datarate;
+      /** Uplink frame counter of the packet (0 for a join) */
+      uint32_t fcnt;
+    };
+
+    /** Callback passed to the non-blocking methods */
+    typedef std::function<void(const Completion &)> CompletionCallback;
+
     /**
      * Do an asynchronous OTAA join using previously configured AppEui,
      * AppKey and optionally DevEui. This can be used in place of
@@ -721,9 +1025,12 @@ class STM32LoRaWAN : public Stream {
      * was successful. If not, it is up to the sketch to decide on
      * retries.
      *
+     * When the join attempt could be started, the callback (if any) is
+     * called when it is complete.
+     *
      * \NotInMKRWAN
      */
-    bool joinOTAAAsync();
+    bool joinOTAAAsync(CompletionCallback callback = nullptr);
 
     /**
      * Finalize and asynchronously send a packet. This can be used in
@@ -731,11 +1038,12 @@ class STM32LoRaWAN : public Stream {
      *
      * The return value only reflects whether the packet could
      * successfully queued, to see if a confirmed packet was actually
-     * confirmed by the network, call lastAck().
+     * confirmed by the network, call lastAck() or pass a callback, that
+     * is called when the packet was sent.
      *
      * \NotInMKRWAN
      */
-    int endPacketAsync(bool confirmed = false);
+    int endPacketAsync(bool confirmed = false, CompletionCallback callback = nullptr);
 
     /**
      * Send a packet asynchronously by passing a buffer. This can be
@@ -751,6 +1059,77 @@ class STM32LoRaWAN : public Stream {
      */
     bool send(const uint8_t *payload, size_t size, bool confirmed);
 
+    /**
+     * Variant of send() that calls the given callback when the packet
+     * was sent (i.e. after its receive windows), with its ack status,
+     * airtime, datarate and frame counter.
+     *
+     * \NotInMKRWAN
+     */
+    bool sendAsync(const uint8_t *payload, size_t size, bool confirmed, CompletionCallback callback);
+
+    /**
+     * Reserve room for the payload of the next packet directly in the
+     * frame buffer of the stack, to be sent by commitTx(). This can be
+     * used instead of send() to serialize data without copying it from
+     * an intermediate buffer. beginPacket() and write() use the same
+     * buffer.
+     *
+     * The returned buffer is only valid until commitTx() is called.
+     * Until then, the packets of queuePacket() and postSend() are held
+     * back. Sending a packet in any other way (e.g. send()) meanwhile
+     * overwrites the buffer, in which case commitTx() fails.
+     *
+     * \return A buffer of at least size bytes, or nullptr when the stack
+     * is busy or size is too long for the current datarate.
+     *
+     * \NotInMKRWAN
+     */
+    uint8_t *reserveTx(size_t size);
+
+    /**
+     * Send the payload written into the buffer returned by reserveTx().
+     * Like send(), this is non-blocking and the return value only
+     * reflects whether the packet could be passed to the stack. When it
+     * could not, the reservation is released and the payload must be
+     * written again after a new reserveTx().
+     *
+     * \NotInMKRWAN
+     */
+    bool commitTx(uint8_t port, bool confirmed = false);
+
+#if STM32LORAWAN_TX_QUEUE_SIZE > 0
+    /**
+     * Queue a packet to be sent as soon as possible. This can be used
+     * instead of send() when packets are produced faster than they can
+     * be transmitted.
+     *
+     * The payload is copied into the queue, which is then drained by
+     * `maintain()`: the first packet is passed to the stack as soon as
+     * it is idle and the duty cycle allows a transmission. When the
+     * duty cycle does not allow it, a timer is armed for the time
+     * returned by the stack, which calls the maintain needed callback
+     * when it expires, so there is no need for polling.
+     *
+     * Packets with a higher priority are sent first, packets with the
+     * same priority are sent in the order they were queued.
+     *
+     * The return value only reflects whether the packet could be
+     * queued (there is room for STM32LORAWAN_TX_QUEUE_SIZE packets).
+     *
+     * \NotInMKRWAN
+     */
+    bool queuePacket(uint8_t port, const uint8_t *payload, size_t size, bool confirmed = false, uint8_t priority = 0);
+
+    /**
+     * Returns the number of packets in the queue filled by
+     * queuePacket() that were not passed to the stack yet.
+     *
+     * \NotInMKRWAN
+     */
+    size_t queuedPackets() { return tx_queue_len; }
+#endif
+
     /**
      * Returns true when the most recently transmitted packet has
      * received a confirmation from the network (if requested). Directly
@@ -775,6 +1154,16 @@ class STM32LoRaWAN : public Stream {
      * Call maintain() to process any background work for as long as the
      * stack is busy (i.e. until busy() returns false).
      *
+     * Between two events, the core is put in sleep mode (WFI) and is
+     * woken up by the next interrupt (radio, RTC alarm of the MAC timers,
+     * or anything else). This is what all blocking methods use, e.g.
+     * `endPacket()` while waiting for the RX1 and RX2 windows. The
+     * systick interrupt stays enabled and wakes the core up every
+     * millisecond, so the core still runs briefly a thousand times per
+     * second; how much this saves depends on the board and has not been
+     * measured. To use stop mode instead, use the async methods with
+     * `setMaintainNeededCallback()` and the STM32LowPower library.
+     *
      * \NotInMKRWAN
      */
     void maintainUntilIdle();
@@ -796,6 +1185,9 @@ class STM32LoRaWAN : public Stream {
      * Only one callback can be active at the same time, so any
      * previously configured callback is replaced by the new one passed.
      *
+     * The post methods (e.g. postSend()) also call it, from the task
+     * that posts the request.
+     *
      * \NotInMKRWAN
      */
     void setMaintainNeededCallback(std::function<void(void)> callback) { this->maintain_needed_callback = callback; }
@@ -814,6 +1206,63 @@ class STM32LoRaWAN : public Stream {
     void setBatteryLevelCallback(std::function<uint8_t(void)> callback) { this->battery_level_callback = callback; }
     /// @}
 
+#if STM32LORAWAN_REQUEST_QUEUE_SIZE > 0
+    /**
+     * @anchor requests
+     * @name Thread-safe requests
+     *
+     * Apart from these methods, this class must only be used from a
+     * single task (the LoRa task), which calls `maintain()` whenever
+     * the maintain needed callback was called (e.g. by waiting on a
+     * semaphore given by that callback).
+     *
+     * These methods can be called from any task (but not from an ISR)
+     * after begin() to post a request into a lock-free queue, and then
+     * call the maintain needed callback (from the posting task) to wake
+     * up the LoRa task. The request is executed by `maintain()` in the
+     * LoRa task. Requests are executed in the order they were posted:
+     * send and join requests wait for the stack to be idle, and a
+     * request only runs once all requests posted before it were passed
+     * to the stack (which does not wait for those to complete).
+     * The outcome is reported in the RequestSlot passed (if any), which
+     * must stay valid until its `done` member becomes true, so the
+     * posting task never blocks on the radio nor touches the stack.
+     *
+     * \NotInMKRWAN
+     * @{ */
+
+    /** Completion slot of a posted request */
+    struct RequestSlot {
+      /** Set by the LoRa task when the request is complete */
+      std::atomic<bool> done{false};
+      /**
+       * Outcome of the request, valid once done is set. For MIB
+       * requests, only status is meaningful.
+       */
+      Completion result;
+    };
+
+    /**
+     * Post a request to send a packet. The payload is copied.
+     *
+     * \return false when the request queue is full.
+     */
+    bool postSend(uint8_t port, const uint8_t *payload, size_t size, bool confirmed, RequestSlot *slot = nullptr);
+
+    /** Post a request to do a single OTAA join attempt, see joinOTAAAsync(). */
+    bool postJoin(RequestSlot *slot = nullptr);
+
+    /**
+     * Post a request to get (set = false) or set (set = true) a MIB
+     * parameter. Only the pointer is queued, the request is not
+     * copied, so it (and any buffer it points to) must stay valid and
+     * unchanged until the slot is done, after which it contains the
+     * value for a get request.
+     */
+    bool postMib(MibRequestConfirm_t *mibReq, bool set, RequestSlot *slot);
+    /// @}
+#endif
+
     /**
      * Set the radio into continuous wave (CW) mode. In this mode radio outputs
      * a signal at the specified frequency and power for the specified duration.
@@ -933,10 +1382,6 @@ class STM32LoRaWAN : public Stream {
     [[gnu::error("Not implemented in STM32LoRaWAN: Internal method in MKRWAN")]]
     bool init();
 
-    /** \NotImplemented{only class A supported} */
-    [[gnu::error("Not implemented in STM32LoRaWAN: Only class A supported")]]
-    bool configureClass(_lora_class _class);
-
     /** \NotImplemented{Keys cannot be retrieved} */
     [[gnu::error("Not implemented in STM32LoRaWAN: Keys cannot be retrieved")]]
     String getNwkSKey();
@@ -980,6 +1425,13 @@ class STM32LoRaWAN : public Stream {
     static void MacMlmeIndication(MlmeIndication_t *MlmeIndication, LoRaMacRxStatus_t *RxStatus);
     static void MacProcessNotify();
     static uint8_t GetBatteryLevel();
+#if STM32LORAWAN_TX_QUEUE_SIZE > 0
+    static void TxQueueTimerCallback(void *context);
+#endif
+#if STM32LORAWAN_RECORD_BUFFER_SIZE > 0
+    static void AggregationTimerCallback(void *context);
+#endif
+    static void JoinTimerCallback(void *context);
 
     static STM32LoRaWAN *instance;
 
@@ -1034,11 +1486,134 @@ class STM32LoRaWAN : public Stream {
     static bool failure(const char *fmt, ...)
     __attribute__((format(printf, 1, 2)));
 
-    /** Empty the rx buffer */
-    void clear_rx() { rx_ptr = rx_buf + sizeof(rx_buf); }
+    /**
+     * Build an uplink and pass it to the stack, printing a message
+     * when it fails. When the duty cycle does not allow transmitting
+     * and allowDelayedTx is false, LORAMAC_STATUS_DUTYCYCLE_RESTRICTED
+     * is returned silently and the time to wait is stored into
+     * waitTime.
+     */
+    LoRaMacStatus_t requestUplink(uint8_t port, const uint8_t *payload, size_t size, bool confirmed, bool allowDelayedTx, TimerTime_t *waitTime);
+
+#if STM32LORAWAN_TX_QUEUE_SIZE > 0
+    /**
+     * Add a packet to the uplink queue. When records is set, the
+     * payload is a sequence of aggregated records, which can be split
+     * at record boundaries when it no longer fits.
+     */
+    bool enqueuePacket(uint8_t port, const uint8_t *payload, size_t size, bool confirmed, uint8_t priority, bool records);
+
+    /** Pass the first packet of the uplink queue to the stack if possible */
+    void processTxQueue();
+#endif
+
+    /**
+     * Reserve the payload buffer of the stack, for reserveTx() and
+     * beginPacket(), or return nullptr when the stack is busy.
+     */
+    uint8_t *reservePayloadBuffer();
+
+    /**
+     * Return the room left for writing size bytes into the current
+     * packet or record, starting the next packet of records first if
+     * that makes room for the record being written.
+     */
+    size_t txRoom(size_t size);
+
+    /**
+     * Return the maximum application payload at the current datarate,
+     * ignoring pending MAC commands (which the uplink queue flushes
+     * first when they do not fit along with the payload).
+     */
+    size_t maxPayload();
+
+    /** Call the completion callbacks of the operations that completed */
+    void processCompletions();
+
+#if STM32LORAWAN_REQUEST_QUEUE_SIZE > 0
+    /** Execute the posted requests, as far as the stack allows */
+    void processRequests();
+
+    /** Report the outcome of a posted request */
+    static void completeRequest(RequestSlot *slot, const Completion &result);
+
+    enum RequestType : uint8_t {
+      REQUEST_SEND,
+      REQUEST_JOIN,
+      REQUEST_MIB_GET,
+      REQUEST_MIB_SET,
+    };
+
+    struct Request {
+      /** Sequence number synchronizing the producers and the consumer */
+      std::atomic<uint32_t> seq;
+      RequestType type;
+      uint8_t port;
+      bool confirmed;
+      uint8_t len;
+      MibRequestConfirm_t *mib;
+      RequestSlot *slot;
+      uint8_t payload[255];
+    };
+
+    /**
+     * Reserve an entry in the request queue, or return nullptr when it
+     * is full. The entry must be filled and then passed to
+     * commitRequest().
+     */
+    Request *reserveRequest(uint32_t *pos);
+    /** Publish a filled entry to the LoRa task, and notify it */
+    void commitRequest(Request *request, uint32_t pos);
+#endif
+
+    /**
+     * Start a single OTAA join attempt at the given datarate, see
+     * joinOTAAAsync().
+     */
+    bool requestJoin(int8_t dr, CompletionCallback callback);
+
+    /** Wait for the given number of milliseconds between join attempts, sleeping meanwhile */
+    void joinBackoff(uint32_t ms);
+    bool joinBackoffPending() { return join_backoff_pending; }
+
+    /**
+     * Sleep (WFI) until the next interrupt, unless maintain() has work
+     * to do or the stack is idle.
+     */
+    void sleepUntilMaintainNeeded();
+
+    /**
+     * Sleep (WFI) until the next interrupt, unless maintain() has work
+     * to do or the given condition is false. The condition is
+     * evaluated with interrupts masked.
+     */
+    void sleepWhile(bool (STM32LoRaWAN::*condition)());
+
+    /**
+     * Return whether both the current and the default channel mask
+     * enable all US915/AU915 channels.
+     */
+    bool allSubBandsEnabled();
+
+    /** Empty the rx queue */
+    void clear_rx()
+    {
+      rx_count = 0;
+      rx_pos = 0;
+      rx_peeked = false;
+    }
+
+    /** Add a received packet to the rx queue */
+    void add_rx(McpsIndication_t *i, LoRaMacRxStatus_t *status);
+
+    /**
+     * Drop the current packet from the rx queue, and load the metadata
+     * of the next one (if any).
+     */
+    void release_rx();
 
-    /** Add data to the rx buffer */
-    void add_rx(const uint8_t *buf, size_t len);
+    /** Release the current packet if it was fully read */
+    void release_read_rx();
 
     /**
      * Datarate for joining and data transmission (until ADR changes it,
@@ -1052,23 +1627,55 @@ class STM32LoRaWAN : public Stream {
     /** Port for data transmissions. Default taken from MKRWAN_v2 / mkrwan1300-fw */
     uint8_t tx_port = 2;
 
-    /** Port for most recently received packet */
+    /** Port for the current (or most recently read) received packet */
     uint8_t rx_port = 0;
 
-    /** RSSI for most recently received packet */
+    /** RSSI for the current (or most recently read) received packet */
     int16_t rx_rssi = 0;
 
-    /** SNR for most recently received packet */
+    /** SNR for the current (or most recently read) received packet */
     int8_t rx_snr = 0;
 
     bool nwk_key_set = false;
 
-    // Buffer sizes match LORAMAC_PHY_MAXPAYLOAD (but that is not
-    // public).
-    uint8_t tx_buf[255];
-    uint8_t *tx_ptr;
-    uint8_t rx_buf[255];
-    uint8_t *rx_ptr;
+    // Size of the payload buffer of the stack, matches
+    // LORAMAC_PHY_MAXPAYLOAD (but that is not public).
+    static constexpr size_t TX_PAYLOAD_SIZE = 255;
+    /**
+     * Packet or record being written by write(): its start, the write
+     * position and the end of its buffer (all nullptr when there is
+     * none)
+     */
+    uint8_t *tx_start = nullptr;
+    uint8_t *tx_ptr = nullptr;
+    uint8_t *tx_end = nullptr;
+    /** Buffer and size returned by / passed to reserveTx() */
+    uint8_t *reserved_tx_buf = nullptr;
+    size_t reserved_tx_size = 0;
+    /** Generation of the stack payload buffer when it was reserved */
+    uint32_t reserved_tx_generation = 0;
+
+    struct RxFrame {
+      uint16_t offset;
+      uint8_t len;
+      uint8_t port;
+      int16_t rssi;
+      int8_t snr;
+      uint8_t slot;
+      uint32_t fcnt;
+      uint32_t time;
+    };
+
+    /** Payload of the queued rx packets, each stored contiguously */
+    uint8_t rx_buf[STM32LORAWAN_RX_BUFFER_SIZE];
+    /** Queued rx packets, starting with the current one at rx_head */
+    RxFrame rx_frames[STM32LORAWAN_RX_QUEUE_SIZE];
+    uint8_t rx_head = 0;
+    uint8_t rx_count = 0;
+    /** Read position in the current packet */
+    uint8_t rx_pos = 0;
+    /** Whether the current packet was returned by peekPacket() */
+    bool rx_peeked = false;
 
     bool last_tx_acked = false;
     uint32_t fcnt_up = 0;
@@ -1077,9 +1684,88 @@ class STM32LoRaWAN : public Stream {
     std::function<void(void)> maintain_needed_callback;
     std::function<uint8_t(void)> battery_level_callback;
 
-    bool mac_process_pending = false;
+    /** Callbacks of the pending join / uplink, and their outcome once complete */
+    CompletionCallback join_callback;
+    CompletionCallback tx_callback;
+    Completion join_result;
+    Completion tx_result;
+    bool join_done = false;
+    bool tx_done = false;
+    /**
+     * Set while an uplink of the sketch (rather than one flushing MAC
+     * commands) was passed to the stack and not confirmed yet
+     */
+    bool tx_requested = false;
+
+    std::atomic<bool> mac_process_pending{false};
+
+#if STM32LORAWAN_REQUEST_QUEUE_SIZE > 0
+    /**
+     * Bounded multi-producer single-consumer queue of the posted
+     * requests. Each entry is free for position pos when its seq is
+     * pos, and filled when it is pos + 1.
+     */
+    Request requests[STM32LORAWAN_REQUEST_QUEUE_SIZE];
+    std::atomic<uint32_t> request_enqueue_pos{0};
+    uint32_t request_dequeue_pos = 0;
+#endif
+
+#if STM32LORAWAN_TX_QUEUE_SIZE > 0
+    struct TxQueueEntry {
+      uint8_t port;
+      uint8_t priority;
+      bool confirmed;
+      /** Whether the payload consists of aggregated records */
+      bool records;
+      uint8_t len;
+      uint8_t payload[255];
+    };
+
+    TxQueueEntry tx_queue[STM32LORAWAN_TX_QUEUE_SIZE];
+    /** Indices into tx_queue of the queued packets, in transmission order */
+    uint8_t tx_queue_order[STM32LORAWAN_TX_QUEUE_SIZE];
+    uint8_t tx_queue_len = 0;
+    /** Set while tx_queue_timer waits for the duty cycle to allow a transmission */
+    volatile bool tx_queue_waiting = false;
+    UTIL_TIMER_Object_t tx_queue_timer;
+    /** Delay before retrying when the stack reports a duty cycle restriction without a wait time */
+    static constexpr uint32_t TX_QUEUE_RETRY_DELAY = 100;
+#endif
+
+#if STM32LORAWAN_RECORD_BUFFER_SIZE > 0
+    /** Packet of aggregated records being built */
+    uint8_t agg_buf[STM32LORAWAN_RECORD_BUFFER_SIZE];
+    uint8_t agg_len = 0;
+    uint8_t agg_port = 2;
+    uint32_t agg_max_delay = 0;
+    uint8_t record_type = 0;
+    /** Set when the deadline of the pending packet has expired */
+    volatile bool agg_flush_pending = false;
+    UTIL_TIMER_Object_t agg_timer;
+#endif
 
     static constexpr uint32_t DEFAULT_JOIN_TIMEOUT = 60000;
+    /** Number of join attempts at each datarate before decreasing it */
+    static constexpr uint8_t JOIN_ATTEMPTS_PER_DR = 2;
+    /** Number of failed join attempts on the selected sub-band before using all of them again */
+    static constexpr uint8_t JOIN_ATTEMPTS_PER_SUB_BAND = 4;
+    /** Bounds of the delay between join attempts, doubled after each attempt */
+    static constexpr uint32_t JOIN_BACKOFF_MIN = 1000;
+    static constexpr uint32_t JOIN_BACKOFF_MAX = 16000;
+
+    LoRaMacRegion_t region;
+    /** Datarate of the last successful join, or -1 */
+    int8_t join_dr = -1;
+    JoinStats join_stats = {};
+    volatile bool join_backoff_pending = false;
+    UTIL_TIMER_Object_t join_timer;
+
+    /** Selected sub-band (US915/AU915), or -1 for all channels */
+    int8_t sub_band = -1;
+    /** Sub-band learned by a join, to be selected by maintain(), or -1 */
+    int8_t learned_sub_band = -1;
+    /** Whether sub_band was learned rather than selected by the sketch */
+    bool sub_band_learned = false;
 };
 // For MKRWAN compatibility
 using LoRaModem = STM32LoRaWAN;